@@ -59,10 +59,44 @@
  */
 struct _bstr_t
 {
+  size_t  capacity;
   size_t  size;
   char    str[];
 };
 
+/*
+ * The capacity and the length are stored, in this order, just before the
+ * string. Keeping the length right before the string means bstr_len() and the
+ * %B printer only look one size_t back.
+ */
+#define BSTR_HEADER     (2 * sizeof(size_t))
+#define BSTR_LEN(b)     (((size_t *)(b))[-1])
+#define BSTR_CAPSLOT(b) (((size_t *)(b))[-2])
+#define BSTR_CAP(b)     (BSTR_CAPSLOT(b) & ~(BSTR_INARENA | BSTR_SHARED))
+
+/*
+ * Strings allocated in an arena (see bstr_arenaNew()) have the high bit of
+ * their capacity set and the arena stored before the capacity. They are never
+ * freed or reallocated individually. Strings stored in a caller's buffer (see
+ * bstr_newInBuffer()) are handled the same way, with a NULL arena.
+ */
+#define BSTR_INARENA    ((size_t)1 << (sizeof(size_t) * 8 - 1))
+#define BSTR_ARENA(b)   (((bstr_arena_t **)((size_t *)(b) - 2))[-1])
+#define BSTR_ISARENA(b) (BSTR_CAPSLOT(b) & BSTR_INARENA)
+
+/*
+ * Shared strings (see bstr_ref()) have the next bit of their capacity set and
+ * a reference count stored before the capacity. They are immutable: functions
+ * modifying a bstring give a private copy back instead.
+ */
+#define BSTR_SHARED     ((size_t)1 << (sizeof(size_t) * 8 - 2))
+#define BSTR_REFS(b)    (((size_t *)(b))[-3])
+#define BSTR_ISSHARED(b) (BSTR_CAPSLOT(b) & BSTR_SHARED)
+
+static bstr_t _bstr_arenaAllocRaw(bstr_arena_t *arena,
+                                  size_t       size,
+                                  size_t       capacity);
+
 static short bstr_initDone = 0;
 static int PA_BSTR;
 
@@ -83,7 +117,6 @@ static int _bstr_print(FILE *stream,
   const bstr_t *arg;
   bstr_t       bstr;
   size_t       len;
-  int          i;
 
   /* Get the bstr address */
   arg = *((const bstr_t **) (args[0]));
@@ -103,9 +136,8 @@ static int _bstr_print(FILE *stream,
    */
   len = *((size_t *)bstr - 1);
 
-  /* Finally, print all chars to the stream */
-  for (i=0; i<len; i++)
-    fputc(((char *)bstr)[i], stream);
+  /* Finally, print all chars to the stream at once */
+  fwrite(bstr, sizeof(char), len, stream);
 
   /* Return the number of bytes printed.
    * Usually, this is the value returned by sprintf.
@@ -150,42 +182,340 @@ void __attribute__((constructor)) _bstr_init()
   bstr_initDone = 1;
 }
 
-static bstr_t _bstr_malloc(size_t size)
+/*
+ * Memory allocation.
+ *
+ * Every allocation of libredis goes through the hooks below (see
+ * bstr_setAllocator()). When built with BSTR_MEM_STATS defined, each block is
+ * preceded by a header recording its size and component, and live bytes and
+ * blocks are counted per component (see bstr_memStats()).
+ */
+static void* _bstr_defaultMalloc(size_t size, void *ctx)
+{
+  return malloc(size);
+}
+
+static void* _bstr_defaultCalloc(size_t count, size_t size, void *ctx)
+{
+  return calloc(count, size);
+}
+
+static void* _bstr_defaultRealloc(void *ptr, size_t size, void *ctx)
+{
+  return realloc(ptr, size);
+}
+
+static void _bstr_defaultFree(void *ptr, void *ctx)
+{
+  free(ptr);
+}
+
+static bstr_mallocFunc  _bstr_mallocHook  = _bstr_defaultMalloc;
+static bstr_callocFunc  _bstr_callocHook  = _bstr_defaultCalloc;
+static bstr_reallocFunc _bstr_reallocHook = _bstr_defaultRealloc;
+static bstr_freeFunc    _bstr_freeHook    = _bstr_defaultFree;
+static void             *_bstr_allocCtx   = NULL;
+
+#ifdef BSTR_MEM_STATS
+/* Kept 16 bytes long so the memory handed out stays suitably aligned */
+typedef union
+{
+  struct
+  {
+    size_t size;
+    size_t component;
+  } info;
+  char pad[16];
+} bstr_memHeader;
+
+static size_t _bstr_memBytes[BSTR_MEM_COMPONENTS];
+static size_t _bstr_memBlocks[BSTR_MEM_COMPONENTS];
+
+/* Record a block of size bytes for component and return its usable part */
+static void* _bstr_memTrack(bstr_memHeader *header,
+                            bstr_memComponent component,
+                            size_t size)
+{
+  if (header == NULL) return NULL;
+  header->info.size      = size;
+  header->info.component = component;
+  __atomic_add_fetch(&_bstr_memBytes[component], size, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&_bstr_memBlocks[component], 1, __ATOMIC_RELAXED);
+  return header + 1;
+}
+
+/* Forget the block header describes and return it */
+static bstr_memHeader* _bstr_memUntrack(bstr_memHeader *header)
+{
+  size_t component = header->info.component;
+
+  __atomic_sub_fetch(&_bstr_memBytes[component], header->info.size,
+                     __ATOMIC_RELAXED);
+  __atomic_sub_fetch(&_bstr_memBlocks[component], 1, __ATOMIC_RELAXED);
+  return header;
+}
+#endif
+
+/**
+ * bstr_setAllocator:
+ * @mallocFunc: function replacing <function>malloc()</function>.
+ * @callocFunc: function replacing <function>calloc()</function>.
+ * @reallocFunc: function replacing <function>realloc()</function>.
+ * @freeFunc: function replacing <function>free()</function>.
+ * @ctx: pointer passed as is to the functions above.
+ *
+ * Route all the memory allocated by libredis (bstrings, arenas, connections,
+ * commands and replies) to the given functions, to use another allocator,
+ * per-thread or NUMA-local pools, or to account for the memory used.
+ * Passing <code>NULL</code> for all of them restores the standard functions.
+ *
+ * Memory must be freed by the allocator it comes from, so this must be called
+ * before anything is allocated by libredis (and not while it is in use by
+ * other threads).
+ **/
+void bstr_setAllocator(bstr_mallocFunc  mallocFunc,
+                       bstr_callocFunc  callocFunc,
+                       bstr_reallocFunc reallocFunc,
+                       bstr_freeFunc    freeFunc,
+                       void             *ctx)
+{
+  _bstr_mallocHook  = mallocFunc  ? mallocFunc  : _bstr_defaultMalloc;
+  _bstr_callocHook  = callocFunc  ? callocFunc  : _bstr_defaultCalloc;
+  _bstr_reallocHook = reallocFunc ? reallocFunc : _bstr_defaultRealloc;
+  _bstr_freeHook    = freeFunc    ? freeFunc    : _bstr_defaultFree;
+  _bstr_allocCtx    = ctx;
+}
+
+/**
+ * bstr_memAlloc:
+ * @component: the part of libredis the memory is accounted to.
+ * @size: number of bytes to allocate.
+ *
+ * Allocate memory with the allocator set by bstr_setAllocator().
+ *
+ * Returns: the allocated memory or <code>NULL</code> on error. It should be
+ * freed with bstr_memFree().
+ **/
+void* bstr_memAlloc(bstr_memComponent component, size_t size)
+{
+#ifdef BSTR_MEM_STATS
+  return _bstr_memTrack(_bstr_mallocHook(sizeof(bstr_memHeader) + size,
+                                         _bstr_allocCtx),
+                        component, size);
+#else
+  return _bstr_mallocHook(size, _bstr_allocCtx);
+#endif
+}
+
+/**
+ * bstr_memCalloc:
+ * @component: the part of libredis the memory is accounted to.
+ * @count: number of elements.
+ * @size: size of an element.
+ *
+ * Allocate zeroed memory for @count elements of @size bytes with the allocator
+ * set by bstr_setAllocator().
+ *
+ * Returns: the allocated memory or <code>NULL</code> on error. It should be
+ * freed with bstr_memFree().
+ **/
+void* bstr_memCalloc(bstr_memComponent component, size_t count, size_t size)
+{
+#ifdef BSTR_MEM_STATS
+  void *ret;
+
+  if (size != 0 && count > ((size_t)-1 - sizeof(bstr_memHeader)) / size)
+    return NULL;
+  ret = bstr_memAlloc(component, count * size);
+  if (ret != NULL) memset(ret, 0, count * size);
+  return ret;
+#else
+  return _bstr_callocHook(count, size, _bstr_allocCtx);
+#endif
+}
+
+/**
+ * bstr_memRealloc:
+ * @component: the part of libredis the memory is accounted to.
+ * @ptr: memory obtained from bstr_memAlloc() and friends or <code>NULL</code>.
+ * @size: new size in bytes.
+ *
+ * Resize @ptr with the allocator set by bstr_setAllocator().
+ *
+ * Returns: the reallocated memory or <code>NULL</code> on error, in which case
+ * @ptr is left untouched.
+ **/
+void* bstr_memRealloc(bstr_memComponent component, void *ptr, size_t size)
+{
+#ifdef BSTR_MEM_STATS
+  bstr_memHeader *header;
+
+  if (ptr == NULL) return bstr_memAlloc(component, size);
+  header = _bstr_memUntrack((bstr_memHeader *)ptr - 1);
+  ptr = _bstr_reallocHook(header, sizeof(bstr_memHeader) + size,
+                          _bstr_allocCtx);
+  if (ptr == NULL)
+  {
+    /* Still allocated, count it again */
+    _bstr_memTrack(header, header->info.component, header->info.size);
+    return NULL;
+  }
+  return _bstr_memTrack((bstr_memHeader *)ptr, component, size);
+#else
+  return _bstr_reallocHook(ptr, size, _bstr_allocCtx);
+#endif
+}
+
+/**
+ * bstr_memFree:
+ * @ptr: memory obtained from bstr_memAlloc() and friends or <code>NULL</code>.
+ *
+ * Free memory allocated by libredis, like the string returned by
+ * bstr_toCStr().
+ **/
+void bstr_memFree(void *ptr)
+{
+  if (ptr == NULL) return;
+#ifdef BSTR_MEM_STATS
+  ptr = _bstr_memUntrack((bstr_memHeader *)ptr - 1);
+#endif
+  _bstr_freeHook(ptr, _bstr_allocCtx);
+}
+
+/**
+ * bstr_memStats:
+ * @component: the part of libredis to report on.
+ * @bytes: where to store the number of bytes in use or <code>NULL</code>.
+ * @blocks: where to store the number of blocks in use or <code>NULL</code>.
+ *
+ * Report the memory currently allocated by libredis for @component. Memory is
+ * only accounted when libredis is built with <code>BSTR_MEM_STATS</code>
+ * defined (<code>./configure CPPFLAGS=-DBSTR_MEM_STATS</code>); it costs a
+ * 16 bytes header per allocation. Memory kept for reuse (arena blocks, reply
+ * pools, buffers...) counts as in use.
+ *
+ * Returns: 0 on success, -1 if libredis was built without
+ * <code>BSTR_MEM_STATS</code> or @component is invalid.
+ **/
+int bstr_memStats(bstr_memComponent component, size_t *bytes, size_t *blocks)
+{
+  if (component < 0 || component >= BSTR_MEM_COMPONENTS) return -1;
+#ifdef BSTR_MEM_STATS
+  if (bytes != NULL)
+    *bytes  = __atomic_load_n(&_bstr_memBytes[component], __ATOMIC_RELAXED);
+  if (blocks != NULL)
+    *blocks = __atomic_load_n(&_bstr_memBlocks[component], __ATOMIC_RELAXED);
+  return 0;
+#else
+  return -1;
+#endif
+}
+
+/*
+ * Allocate a bstring of length size able to hold capacity chars without being
+ * reallocated. The content is left uninitialized, only the terminating \0 is
+ * set, for callers that overwrite it anyway.
+ */
+static bstr_t _bstr_allocRaw(size_t size, size_t capacity)
 {
   size_t *ret;
 
-  /* Allocating the size required plus the memory zone required
-   * to stock the length of the string plus a <code>\0</code>.
+  /* Allocating the capacity required plus the memory zone required
+   * to stock the capacity and the length of the string plus a <code>\0</code>.
    *
    * This is a rough representation of a pascal string where
    * the length of the string precede the string. No NULL char
    * is required to end the string. The \0 at the end guarantee
    * a safe use of bstr as a char*.
    */
-  ret = (size_t*)malloc(sizeof(size_t) + size * sizeof(char) + sizeof(char));
-  memset(ret, 0, sizeof(size_t) + size * sizeof(char) + sizeof(char));
+  ret = (size_t*)bstr_memAlloc(BSTR_MEM_STRING,
+                               BSTR_HEADER + capacity * sizeof(char) + sizeof(char));
   if (ret == NULL) return NULL;
-  /* Stock the length of the allocated string at the begening of
-   * the allocated zone
-   */
-  *ret = size;
+  ret[0] = capacity;
+  ret[1] = size;
+  ((char *)(ret + 2))[size] = '\0';
   /* Return the real position of the string */
-  return (bstr_t)(ret + 1);
+  return (bstr_t)(ret + 2);
 }
 
-static bstr_t _bstr_resize(bstr_t bstr, size_t size)
+/* Allocate a zeroed bstring of length size */
+static bstr_t _bstr_malloc(size_t size)
+{
+  bstr_t ret;
+
+  ret = _bstr_allocRaw(size, size);
+  if (ret == NULL) return NULL;
+  memset(ret, 0, size * sizeof(char));
+  return ret;
+}
+
+/* Change the capacity of bstr, its length is unchanged */
+static bstr_t _bstr_realloc(bstr_t bstr, size_t capacity)
 {
   size_t *ret;
-  /* If bstr is NULL, this is equivalent to _bstr_malloc */
-  if (bstr == NULL) return _bstr_malloc(size);
 
-  ret = ((size_t *)bstr) - 1;
-  /* The rest is the same as _bstr_new */
-  ret = (size_t*)realloc(ret, sizeof(size_t) + size * sizeof(char) + sizeof(char));
+  if (BSTR_ISSHARED(bstr))
+  {
+    /* Copy on write, the other owners keep the shared string */
+    bstr_t copy;
+    size_t len;
+
+    len  = (BSTR_LEN(bstr) < capacity) ? BSTR_LEN(bstr) : capacity;
+    copy = _bstr_allocRaw(len, capacity);
+    if (copy == NULL) return NULL;
+    memcpy(copy, bstr, len * sizeof(char));
+    bstr_unref(bstr);
+    return copy;
+  }
+  if (BSTR_ISARENA(bstr))
+  {
+    /*
+     * Move to a bigger place in the arena, or to the heap for a string in a
+     * buffer. The old place is left unused.
+     */
+    bstr_t moved;
+
+    if (BSTR_ARENA(bstr) != NULL)
+      moved = _bstr_arenaAllocRaw(BSTR_ARENA(bstr), BSTR_LEN(bstr), capacity);
+    else
+      moved = _bstr_allocRaw(BSTR_LEN(bstr), capacity);
+    if (moved == NULL) return NULL;
+    memcpy(moved, bstr, BSTR_LEN(bstr) * sizeof(char) + sizeof(char));
+    return moved;
+  }
+  ret = (size_t*)bstr_memRealloc(BSTR_MEM_STRING, (size_t *)bstr - 2,
+                                 BSTR_HEADER + capacity * sizeof(char) + sizeof(char));
   if (ret == NULL) return NULL;
+  ret[0] = capacity;
+  return (bstr_t)(ret + 2);
+}
+
+/*
+ * Set the length of bstr to size. When the capacity is exceeded, it is at
+ * least doubled so a sequence of appends is amortized O(1).
+ */
+static bstr_t _bstr_resize(bstr_t bstr, size_t size)
+{
+  size_t capacity;
+
+  /* If bstr is NULL, a new string is allocated, its content is left to the
+   * caller */
+  if (bstr == NULL) return _bstr_allocRaw(size, size);
 
-  *ret = size;
-  return (bstr_t)(ret+1);
+  if (size > BSTR_CAP(bstr))
+  {
+    capacity = BSTR_CAP(bstr) * 2;
+    if (capacity < size) capacity = size;
+    bstr = _bstr_realloc(bstr, capacity);
+    if (bstr == NULL) return NULL;
+  }
+  else if (BSTR_ISSHARED(bstr))
+  {
+    bstr = _bstr_realloc(bstr, size);
+    if (bstr == NULL) return NULL;
+  }
+  BSTR_LEN(bstr) = size;
+  return bstr;
 }
 
 /**
@@ -213,14 +543,13 @@ bstr_t bstr_new(char *from, size_t size)
   bstr_t ret;
   size_t len;
 
+  /* If from is NULL, we return a cleared size length string. */
+  if (from == NULL) return _bstr_malloc(size);
   len = (size == -1) ? strlen(from)
                      : size;
-  ret = _bstr_malloc(len);
+  /* The content is copied right away, no need to clear it first */
+  ret = _bstr_allocRaw(len, len);
   if (ret == NULL) return NULL;
-  /* If size is 0, we return a 0 length string.
-   * If from is NULL, we return a cleared size length string.
-   */
-  if (size == 0 || from == NULL) return ret;
   /*
    * If size is -1, we use strlen to get the string length and the function
    * will be equivalent to bstr_newFromCStr
@@ -245,12 +574,15 @@ bstr_t bstr_new(char *from, size_t size)
 bstr_t bstr_newFromCStr(char *cstr)
 {
   bstr_t ret;
+  size_t len;
 
   /* If cstr is NULL we return an empty string */
   if (cstr == NULL) return _bstr_malloc(0);
   /* Allocate the string, copy it and return the newly created bstr*/
-  ret = _bstr_malloc(strlen(cstr));
-  memcpy(ret, cstr, strlen(cstr)*sizeof(char));
+  len = strlen(cstr);
+  ret = _bstr_allocRaw(len, len);
+  if (ret == NULL) return NULL;
+  memcpy(ret, cstr, len * sizeof(char));
   return ret;
 }
 
@@ -265,8 +597,15 @@ bstr_t bstr_newFromCStr(char *cstr)
 void bstr_free(bstr_t bstr)
 {
   if (bstr == NULL) return;
+  /* Strings of an arena are released with the arena */
+  if (BSTR_ISARENA(bstr)) return;
+  if (BSTR_ISSHARED(bstr))
+  {
+    bstr_unref(bstr);
+    return;
+  }
   /* Roll back to the begenning of the allocated zone and free it*/
-  free(((size_t *)bstr) - 1);
+  bstr_memFree(((size_t *)bstr) - 2);
 
 }
 
@@ -297,8 +636,8 @@ void bstr_free(bstr_t bstr)
  * and even this is not needed since the <code>\%B</code> modifier can be used
  * to print a bstring.
  *
- * Returns: a C-style string. The returned string should be freed withe
- * <function>free()</function> when no longer needed.
+ * Returns: a C-style string. The returned string should be freed with
+ * bstr_memFree() when no longer needed.
  **/
 char* bstr_toCStr(bstr_t bstr)
 {
@@ -306,7 +645,14 @@ char* bstr_toCStr(bstr_t bstr)
    * But notice that this will truncate the string on the first \0 if bstr
    * is a binary string.
    */
-  return strdup((char*)bstr);
+  char   *ret;
+  size_t len;
+
+  len = strlen((char *)bstr);
+  ret = (char *)bstr_memAlloc(BSTR_MEM_OTHER, len + 1);
+  if (ret == NULL) return NULL;
+  memcpy(ret, bstr, len + 1);
+  return ret;
 }
 
 /**
@@ -320,7 +666,82 @@ char* bstr_toCStr(bstr_t bstr)
 size_t bstr_len(bstr_t bstr)
 {
   /* Simply return the lenght part of bstr*/
-  return *(((size_t*)bstr) -1);
+  return BSTR_LEN(bstr);
+}
+
+/**
+ * bstr_capacity:
+ * @bstr: a bstring.
+ *
+ * Retrieve the number of characters @bstr can hold without being reallocated.
+ *
+ * Returns: the capacity of @bstr, never less than its length.
+ **/
+size_t bstr_capacity(bstr_t bstr)
+{
+  return BSTR_CAP(bstr);
+}
+
+/**
+ * bstr_reserve:
+ * @bstr: the bstring to grow or NULL.
+ * @capacity: the number of characters @bstr should hold without reallocation.
+ *
+ * Make sure @bstr can grow to @capacity characters without being reallocated.
+ * The length and the content of @bstr are unchanged.
+ *
+ * If @bstr is NULL, an empty bstring of capacity @capacity is created.
+ *
+ * Returns: the bstring (which may have moved) or NULL on error (usually a
+ * result of memory allocation error), in which case @bstr is left untouched.
+ **/
+bstr_t bstr_reserve(bstr_t bstr, size_t capacity)
+{
+  if (bstr == NULL) return _bstr_allocRaw(0, capacity);
+  if (capacity <= BSTR_CAP(bstr)) return bstr;
+  return _bstr_realloc(bstr, capacity);
+}
+
+/**
+ * bstr_shrinkToFit:
+ * @bstr: the bstring to shrink.
+ *
+ * Release the memory reserved beyond the length of @bstr.
+ *
+ * Returns: the bstring (which may have moved) or NULL on error, in which case
+ * @bstr is left untouched.
+ **/
+bstr_t bstr_shrinkToFit(bstr_t bstr)
+{
+  if (BSTR_CAP(bstr) == BSTR_LEN(bstr) || BSTR_ISARENA(bstr) ||
+      BSTR_ISSHARED(bstr))
+    return bstr;
+  return _bstr_realloc(bstr, BSTR_LEN(bstr));
+}
+
+/**
+ * bstr_setLen:
+ * @bstr: the bstring to modify or NULL.
+ * @size: the new length of @bstr.
+ *
+ * Set the length of @bstr to @size, growing it if needed. Characters kept from
+ * the previous content are unchanged, the others are undefined and should be
+ * written by the caller (through a <code>char *</code> cast). The string is
+ * always <code>\0</code> terminated after @size characters.
+ *
+ * This is the way to reuse a bstring as a buffer: setting a shorter length
+ * keeps the memory for later use.
+ *
+ * Returns: the bstring (which may have moved) or NULL on error.
+ **/
+bstr_t bstr_setLen(bstr_t bstr, size_t size)
+{
+  bstr_t ret;
+
+  ret = _bstr_resize(bstr, size);
+  if (ret == NULL) return NULL;
+  ((char *)ret)[size] = '\0';
+  return ret;
 }
 
 /**
@@ -417,7 +838,8 @@ bstr_t bstr_catCStr(bstr_t bstr, char *cstr)
  * bstr_dup:
  * @bstr: the bstring to duplicate
  * 
- * Duplicates a bstring and return the newly created one.
+ * Duplicates a bstring and return the newly created one. A shared bstring
+ * (see bstr_ref()) is not copied, a new reference to it is returned.
  *
  * Returns: a bstring copy of @bstr or NULL on error (memory allocation error).
  * The returned value should be freed with bstr_free() when no longer needed.
@@ -428,33 +850,163 @@ bstr_t bstr_dup(bstr_t bstr)
   size_t fromlen;
   bstr_t ret;
 
+  if (BSTR_ISSHARED(bstr)) return bstr_ref(bstr);
   fromlen = bstr_len(bstr);
-  ret = _bstr_malloc(fromlen);
+  ret = _bstr_allocRaw(fromlen, fromlen);
   if (ret == NULL) return NULL;
 
   memcpy(ret, bstr, fromlen);
   return ret;
 }
 
+/**
+ * bstr_newShared:
+ * @from: a string from which to create the bstring or NULL.
+ * @size: number of characters to use in creating the bstring or -1.
+ *
+ * Same as bstr_new() but the bstring is shared: it is reference counted and
+ * immutable, so bstr_ref() and bstr_dup() give it to other owners without
+ * copying it. See bstr_ref().
+ *
+ * Returns: a shared bstring with one reference or NULL on error. It should be
+ * released with bstr_unref() (or bstr_free()) when no longer needed.
+ **/
+bstr_t bstr_newShared(char *from, size_t size)
+{
+  size_t *ret;
+  size_t len;
+
+  if (size == -1) len = (from != NULL) ? strlen(from) : 0;
+  else            len = size;
+  /* The reference count, then the usual capacity and length header */
+  ret = (size_t*)bstr_memAlloc(BSTR_MEM_STRING, sizeof(size_t) + BSTR_HEADER
+                                                + len * sizeof(char)
+                                                + sizeof(char));
+  if (ret == NULL) return NULL;
+  ret[0] = 1;
+  ret[1] = len | BSTR_SHARED;
+  ret[2] = len;
+  if (from == NULL) memset(ret + 3, 0, len * sizeof(char));
+  else              memcpy(ret + 3, from, len * sizeof(char));
+  ((char *)(ret + 3))[len] = '\0';
+  return (bstr_t)(ret + 3);
+}
+
+/**
+ * bstr_ref:
+ * @bstr: the bstring to share or NULL.
+ *
+ * Get a reference to @bstr to keep it without copying it, for example to send
+ * the same value to several servers or to retry a command.
+ *
+ * If @bstr is shared (created by bstr_newShared() or returned by bstr_ref()),
+ * its reference count is incremented and @bstr itself is returned. The count
+ * is atomic, so references can be taken and released from any thread.
+ * Otherwise @bstr is left to its owner and a shared copy of it is returned:
+ * references to that copy are then free.
+ *
+ * Shared bstrings are immutable. They can be given to all the bstring
+ * functions: the ones modifying their argument (bstr_cat(), bstr_setLen(),
+ * bstr_appendf()...) release the reference and return a private copy.
+ *
+ * Returns: a shared bstring or NULL on error. Each reference should be
+ * released with bstr_unref() (or bstr_free()) when no longer needed.
+ **/
+bstr_t bstr_ref(bstr_t bstr)
+{
+  if (bstr == NULL) return NULL;
+  if (!BSTR_ISSHARED(bstr)) return bstr_newShared((char *)bstr, BSTR_LEN(bstr));
+  __atomic_add_fetch(&BSTR_REFS(bstr), 1, __ATOMIC_RELAXED);
+  return bstr;
+}
+
+/**
+ * bstr_unref:
+ * @bstr: the bstring to release or NULL.
+ *
+ * Release a reference to @bstr, which is freed with the last one. On a
+ * bstring that is not shared, this is the same as bstr_free().
+ **/
+void bstr_unref(bstr_t bstr)
+{
+  if (bstr == NULL) return;
+  if (!BSTR_ISSHARED(bstr))
+  {
+    bstr_free(bstr);
+    return;
+  }
+  if (__atomic_sub_fetch(&BSTR_REFS(bstr), 1, __ATOMIC_ACQ_REL) == 0)
+    bstr_memFree((size_t *)bstr - 3);
+}
+
+/**
+ * bstr_isShared:
+ * @bstr: a bstring.
+ *
+ * Tell whether @bstr is a shared bstring (see bstr_ref()).
+ *
+ * Returns: 1 if @bstr is shared, 0 otherwise.
+ **/
+int bstr_isShared(bstr_t bstr)
+{
+  return BSTR_ISSHARED(bstr) ? 1 : 0;
+}
+
 /*
  * Used by printf variants witch use variadic attributes.
- * Storage is allocated automatically, so no need to preallocate it.
+ * Format directly in the spare capacity of *bstr (created if NULL), growing it
+ * once if the result does not fit.
+ * Return the number of appended chars or -1 on error (*bstr is unchanged).
  */
-static int _bstr_vasprintf(bstr_t *bstr, char *fmt, va_list ap)
+static int _bstr_vappendf(bstr_t *bstr, char *fmt, va_list ap)
 {
-  char    *buf;
-  int     len;
+  va_list aq;
+  bstr_t  ret;
+  size_t  len, avail;
+  int     n;
 
-  len = vasprintf(&buf, fmt, ap);
-  if (len < 0)
+  ret = (*bstr == NULL) ? _bstr_allocRaw(0, 64) : *bstr;
+  if (ret == NULL) return -1;
+  if (BSTR_ISSHARED(ret))
   {
-    free(buf);
-    return -1;
+    /* Print to a private copy, with the same content */
+    if ((ret = _bstr_realloc(ret, BSTR_LEN(ret))) == NULL) return -1;
+    *bstr = ret;
   }
+  len   = BSTR_LEN(ret);
+  avail = BSTR_CAP(ret) - len;
 
-  *bstr = bstr_new(buf, len);
-  free(buf);
-  return len;
+  /* The allocation always has room for the \0 after the capacity */
+  va_copy(aq, ap);
+  n = vsnprintf((char *)ret + len, avail + 1, fmt, aq);
+  va_end(aq);
+  if (n >= 0 && n > avail)
+  {
+    bstr_t grown;
+    size_t capacity;
+
+    capacity = BSTR_CAP(ret) * 2;
+    if (capacity < len + n) capacity = len + n;
+    grown = _bstr_realloc(ret, capacity);
+    if (grown == NULL)
+      n = -1;
+    else
+    {
+      ret = grown;
+      va_copy(aq, ap);
+      n = vsnprintf((char *)ret + len, n + 1, fmt, aq);
+      va_end(aq);
+    }
+  }
+  if (n < 0)
+  {
+    if (*bstr == NULL) bstr_free(ret);
+    else               ((char *)ret)[len] = '\0';
+    return -1;
+  }
+  BSTR_LEN(ret) = len + n;
+  *bstr = ret;
+  return n;
 }
 
 /*
@@ -483,8 +1035,9 @@ int bstr_asprintf(bstr_t *bstr, char *fmt, ...)
 {
   va_list ap;
   int     len;
+  *bstr = NULL;
   va_start(ap, fmt);
-  len = _bstr_vasprintf(bstr, fmt, ap);
+  len = _bstr_vappendf(bstr, fmt, ap);
   va_end(ap);  /* Not required for GNU C */
   return len;
 }
@@ -496,7 +1049,7 @@ int bstr_asprintf(bstr_t *bstr, char *fmt, ...)
  * @...: the list of args conforming to @fmt format.
  *
  * Like bstr_asprintf(), but append to the input bstr_t var. @bstr is resized
- * to fit to the concatenated string.
+ * to fit to the concatenated string. This is the same as bstr_appendf().
  *
  * <note><para>
  * There is also the new printf modifier <code>\%B</code> that can be used
@@ -509,20 +1062,296 @@ int bstr_asprintf(bstr_t *bstr, char *fmt, ...)
 int     bstr_scatprintf(bstr_t *bstr, char *fmt, ...)
 {
   va_list ap;
-  bstr_t buf;
   int    len;
 
   va_start(ap, fmt);
-  len = _bstr_vasprintf(&buf, fmt, ap);
+  len = _bstr_vappendf(bstr, fmt, ap);
+  va_end(ap);
+  return len;
+}
+
+/**
+ * bstr_appendf:
+ * @bstr: the bstring to append to. If it points to NULL, a new bstring is
+ * created.
+ * @fmt: the printf-style format string.
+ * @...: the list of args conforming to @fmt format.
+ *
+ * Format @fmt and its args at the end of @bstr. The text is written directly
+ * in the spare capacity of @bstr (see bstr_reserve()) so, when @bstr is large
+ * enough, nothing is allocated or copied. Otherwise @bstr grows geometrically.
+ *
+ * Returns: the number of appended characters or -1 on error, in which case
+ * @bstr is left unchanged.
+ **/
+int     bstr_appendf(bstr_t *bstr, char *fmt, ...)
+{
+  va_list ap;
+  int    len;
+
+  va_start(ap, fmt);
+  len = _bstr_vappendf(bstr, fmt, ap);
   va_end(ap);
-  if (len < 0)
+  return len;
+}
+
+/*
+ * Arenas.
+ *
+ * An arena hands out memory from large blocks with a bump pointer. Nothing is
+ * freed individually: bstr_arenaReset() rewinds all the blocks at once and
+ * keeps them for the next use, so a steady workload stops calling malloc.
+ * Allocations bigger than a quarter of a block get their own block, released
+ * on reset.
+ */
+#define BSTR_ARENA_ALIGN 16
+#define BSTR_ARENA_ROUND(n) (((n) + BSTR_ARENA_ALIGN - 1) & ~(size_t)(BSTR_ARENA_ALIGN - 1))
+
+typedef struct _bstr_arenaBlock bstr_arenaBlock;
+struct _bstr_arenaBlock
+{
+  bstr_arenaBlock *next;
+  size_t          size;         /* Usable bytes after the header          */
+  size_t          used;
+};
+
+/* Start of the usable part of a block, aligned */
+#define BSTR_BLOCK_DATA(b) \
+  ((char *)(b) + BSTR_ARENA_ROUND(sizeof(bstr_arenaBlock)))
+
+struct _bstr_arena
+{
+  bstr_arenaBlock *blocks;      /* Reusable blocks                        */
+  bstr_arenaBlock *current;     /* Block allocations are made from        */
+  bstr_arenaBlock *large;       /* Oversized allocations                  */
+  size_t          blockSize;
+};
+
+static bstr_arenaBlock* _bstr_arenaNewBlock(size_t size)
+{
+  bstr_arenaBlock *block;
+
+  block = (bstr_arenaBlock *)bstr_memAlloc(BSTR_MEM_ARENA,
+                                    BSTR_ARENA_ROUND(sizeof(bstr_arenaBlock))
+                                    + size);
+  if (block == NULL) return NULL;
+  block->next = NULL;
+  block->size = size;
+  block->used = 0;
+  return block;
+}
+
+/**
+ * bstr_arenaNew:
+ * @blockSize: size of the blocks the arena allocates from, or 0 for the
+ * default (64KB).
+ *
+ * Create an arena. Bstrings created with bstr_newInArena() and other memory
+ * obtained with bstr_arenaAlloc() live until bstr_arenaReset() or
+ * bstr_arenaFree() releases all of them at once. A typical use is one arena
+ * per request, reset when the request is done:
+ * <informalexample><programlisting>
+ * arena = bstr_arenaNew(0);
+ * while (handle_request(arena))
+ *   bstr_arenaReset(arena);
+ * bstr_arenaFree(arena);
+ * </programlisting></informalexample>
+ *
+ * Returns: the new arena or NULL on error. It should be freed with
+ * bstr_arenaFree() when no longer needed.
+ **/
+bstr_arena_t* bstr_arenaNew(size_t blockSize)
+{
+  bstr_arena_t *arena;
+
+  arena = (bstr_arena_t *)bstr_memAlloc(BSTR_MEM_ARENA, sizeof(bstr_arena_t));
+  if (arena == NULL) return NULL;
+  arena->blocks    = NULL;
+  arena->current   = NULL;
+  arena->large     = NULL;
+  arena->blockSize = blockSize ? BSTR_ARENA_ROUND(blockSize) : 64 * 1024;
+  return arena;
+}
+
+/**
+ * bstr_arenaAlloc:
+ * @arena: the arena to allocate from.
+ * @size: number of bytes to allocate.
+ *
+ * Allocate @size bytes from @arena, suitably aligned for any type. The memory
+ * is not cleared and must not be passed to <function>free()</function>.
+ *
+ * Returns: the allocated memory or NULL on error.
+ **/
+void* bstr_arenaAlloc(bstr_arena_t *arena, size_t size)
+{
+  bstr_arenaBlock *block;
+
+  size = BSTR_ARENA_ROUND(size);
+  if (size > arena->blockSize / 4)
   {
-    bstr_free(buf);
-    return -1;
+    block = _bstr_arenaNewBlock(size);
+    if (block == NULL) return NULL;
+    block->next  = arena->large;
+    arena->large = block;
+    return BSTR_BLOCK_DATA(block);
   }
 
-  *bstr = bstr_catBStr(*bstr, buf);
-  bstr_free(buf);
-  return len;
+  block = arena->current;
+  /* Blocks after the current one are empty ones kept by bstr_arenaReset() */
+  while (block != NULL && block->used + size > block->size)
+    block = block->next;
+  if (block == NULL)
+  {
+    block = _bstr_arenaNewBlock(arena->blockSize);
+    if (block == NULL) return NULL;
+    if (arena->current == NULL) arena->blocks = block;
+    else
+    {
+      /* Append after the last block */
+      bstr_arenaBlock *last = arena->current;
+      while (last->next != NULL) last = last->next;
+      last->next = block;
+    }
+  }
+  arena->current = block;
+  block->used += size;
+  return BSTR_BLOCK_DATA(block) + block->used - size;
+}
+
+/* Allocate an uninitialized bstring in arena */
+static bstr_t _bstr_arenaAllocRaw(bstr_arena_t *arena,
+                                  size_t       size,
+                                  size_t       capacity)
+{
+  size_t *ret;
+
+  /* The arena, then the usual capacity and length header */
+  ret = (size_t *)bstr_arenaAlloc(arena, sizeof(bstr_arena_t *) + BSTR_HEADER
+                                         + capacity * sizeof(char)
+                                         + sizeof(char));
+  if (ret == NULL) return NULL;
+  *(bstr_arena_t **)ret = arena;
+  ret = (size_t *)((char *)ret + sizeof(bstr_arena_t *));
+  ret[0] = capacity | BSTR_INARENA;
+  ret[1] = size;
+  ((char *)(ret + 2))[size] = '\0';
+  return (bstr_t)(ret + 2);
+}
 
+/**
+ * bstr_newInArena:
+ * @arena: the arena to allocate from.
+ * @from: a string from which to create the bstring or NULL.
+ * @size: number of characters to use in creating the bstring or -1.
+ *
+ * Same as bstr_new() but the bstring is allocated from @arena. It can be used
+ * with all the bstring functions: growing it moves it to a bigger place in
+ * @arena and bstr_free() does nothing on it. It is released with the arena.
+ *
+ * Returns: a bstring allocated in @arena or NULL on error.
+ **/
+bstr_t bstr_newInArena(bstr_arena_t *arena, char *from, size_t size)
+{
+  bstr_t ret;
+  size_t len;
+
+  if (size == -1) len = (from != NULL) ? strlen(from) : 0;
+  else            len = size;
+  ret = _bstr_arenaAllocRaw(arena, len, len);
+  if (ret == NULL) return NULL;
+  if (from == NULL) memset(ret, 0, len * sizeof(char));
+  else              memcpy(ret, from, len * sizeof(char));
+  return ret;
+}
+
+/**
+ * bstr_inBufferSize:
+ * @size: length of a bstring.
+ *
+ * Get the number of bytes bstr_newInBuffer() needs to store a bstring of
+ * length @size. It is a multiple of <code>sizeof(size_t)</code>.
+ *
+ * Returns: the size of the buffer needed.
+ **/
+size_t bstr_inBufferSize(size_t size)
+{
+  size_t n;
+
+  /* A NULL arena, the header, the string and its \0 */
+  n = sizeof(bstr_arena_t *) + BSTR_HEADER + size * sizeof(char) + sizeof(char);
+  return (n + sizeof(size_t) - 1) & ~(sizeof(size_t) - 1);
+}
+
+/**
+ * bstr_newInBuffer:
+ * @buffer: memory to store the bstring in, aligned on <code>sizeof(size_t)</code>.
+ * @from: a string from which to create the bstring or NULL.
+ * @size: number of characters to use in creating the bstring.
+ *
+ * Same as bstr_new() but the bstring is stored in @buffer, which must be
+ * at least bstr_inBufferSize(@size) bytes long and outlive the bstring. It
+ * lets a structure embed its short strings instead of allocating each one.
+ *
+ * bstr_free() does nothing on such a bstring and growing it past its length
+ * moves it to the heap, after which it must be freed with bstr_free() as
+ * usual. Calling bstr_free() on the result in all cases is always right.
+ *
+ * Returns: a bstring stored in @buffer.
+ **/
+bstr_t bstr_newInBuffer(void *buffer, char *from, size_t size)
+{
+  size_t *ret;
+
+  ret = (size_t *)((char *)buffer + sizeof(bstr_arena_t *));
+  *(bstr_arena_t **)buffer = NULL;
+  ret[0] = size | BSTR_INARENA;
+  ret[1] = size;
+  if (from == NULL) memset(ret + 2, 0, size * sizeof(char));
+  else              memcpy(ret + 2, from, size * sizeof(char));
+  ((char *)(ret + 2))[size] = '\0';
+  return (bstr_t)(ret + 2);
+}
+
+/**
+ * bstr_arenaReset:
+ * @arena: the arena to reset.
+ *
+ * Release everything allocated from @arena at once. The memory is kept by
+ * @arena for the next allocations (except for oversized allocations).
+ * Bstrings and memory previously obtained from @arena must no longer be used.
+ **/
+void bstr_arenaReset(bstr_arena_t *arena)
+{
+  bstr_arenaBlock *block, *next;
+
+  for (block = arena->blocks; block != NULL; block = block->next)
+    block->used = 0;
+  arena->current = arena->blocks;
+  for (block = arena->large; block != NULL; block = next)
+  {
+    next = block->next;
+    bstr_memFree(block);
+  }
+  arena->large = NULL;
+}
+
+/**
+ * bstr_arenaFree:
+ * @arena: the arena to free.
+ *
+ * Release everything allocated from @arena and @arena itself.
+ **/
+void bstr_arenaFree(bstr_arena_t *arena)
+{
+  bstr_arenaBlock *block, *next;
+
+  if (arena == NULL) return;
+  bstr_arenaReset(arena);
+  for (block = arena->blocks; block != NULL; block = next)
+  {
+    next = block->next;
+    bstr_memFree(block);
+  }
+  bstr_memFree(arena);
 }
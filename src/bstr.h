@@ -35,9 +35,11 @@
  * pascal string where the length of the string precede the string itself, so
  * <code>\0</code> characters can be embedded in the string without truncating it.
  *
- * The memory occupied by #bstr_t is represented internally as <code>size_t</code>
- * followed by a <code>char *</code> and a <code>\0</code> character, and
- * #bstr_t itself points to the <code>char *</code> portion.
+ * The memory occupied by #bstr_t is represented internally as two
+ * <code>size_t</code> (the capacity and the length) followed by a
+ * <code>char *</code> and a <code>\0</code> character, and #bstr_t itself
+ * points to the <code>char *</code> portion. The capacity lets appends grow
+ * the allocation geometrically instead of reallocating on every call.
  * This is set manually rather than using a <code>struct</code> to emphasis the
  * fact that the only exploitable part is the string part.
  * The length part is updated automatically by #bstr_t related functions.<sbr/>
@@ -60,17 +62,121 @@
  **/
 typedef struct _bstr_t * bstr_t;
 
+/**
+ * bstr_arena_t:
+ *
+ * An opaque arena bstrings (and any other memory) can be allocated from, to
+ * release all of them at once (see bstr_arenaNew()).
+ **/
+typedef struct _bstr_arena bstr_arena_t;
+
+/**
+ * bstr_memComponent:
+ * @BSTR_MEM_STRING: bstrings.
+ * @BSTR_MEM_ARENA: arenas and their blocks.
+ * @BSTR_MEM_CONNECTION: connections and their buffers.
+ * @BSTR_MEM_COMMAND: commands, prepared commands and command arrays.
+ * @BSTR_MEM_REPLY: replies and their pools.
+ * @BSTR_MEM_OTHER: everything else, including memory handed to the caller.
+ * @BSTR_MEM_COMPONENTS: number of components.
+ *
+ * Parts of libredis memory is accounted to (see bstr_memStats()).
+ **/
+typedef enum
+{
+  BSTR_MEM_STRING,
+  BSTR_MEM_ARENA,
+  BSTR_MEM_CONNECTION,
+  BSTR_MEM_COMMAND,
+  BSTR_MEM_REPLY,
+  BSTR_MEM_OTHER,
+  BSTR_MEM_COMPONENTS
+} bstr_memComponent;
+
+/**
+ * bstr_mallocFunc:
+ * @size: number of bytes to allocate.
+ * @ctx: the context given to bstr_setAllocator().
+ *
+ * Replacement for <function>malloc()</function>.
+ *
+ * Returns: the allocated memory or <code>NULL</code>.
+ **/
+typedef void* (*bstr_mallocFunc)(size_t size, void *ctx);
+
+/**
+ * bstr_callocFunc:
+ * @count: number of elements.
+ * @size: size of an element.
+ * @ctx: the context given to bstr_setAllocator().
+ *
+ * Replacement for <function>calloc()</function>.
+ *
+ * Returns: the allocated memory or <code>NULL</code>.
+ **/
+typedef void* (*bstr_callocFunc)(size_t count, size_t size, void *ctx);
+
+/**
+ * bstr_reallocFunc:
+ * @ptr: memory to resize or <code>NULL</code>.
+ * @size: new size in bytes.
+ * @ctx: the context given to bstr_setAllocator().
+ *
+ * Replacement for <function>realloc()</function>.
+ *
+ * Returns: the reallocated memory or <code>NULL</code>.
+ **/
+typedef void* (*bstr_reallocFunc)(void *ptr, size_t size, void *ctx);
+
+/**
+ * bstr_freeFunc:
+ * @ptr: memory to free or <code>NULL</code>.
+ * @ctx: the context given to bstr_setAllocator().
+ *
+ * Replacement for <function>free()</function>.
+ **/
+typedef void  (*bstr_freeFunc)(void *ptr, void *ctx);
+
 bstr_t  bstr_new(char *from, size_t size);
 bstr_t  bstr_newFromCStr(char *cstr);
 void    bstr_free(bstr_t bstr);
 char*   bstr_toCStr(bstr_t bstr);
 size_t  bstr_len(bstr_t bstr);
+size_t  bstr_capacity(bstr_t bstr);
+bstr_t  bstr_reserve(bstr_t bstr, size_t capacity);
+bstr_t  bstr_shrinkToFit(bstr_t bstr);
+bstr_t  bstr_setLen(bstr_t bstr, size_t size);
 bstr_t  bstr_cat(bstr_t bstr, char *cstr, size_t size);
 bstr_t  bstr_catBStr(bstr_t to, bstr_t from);
 bstr_t  bstr_catCStr(bstr_t bstr, char *cstr);
 bstr_t  bstr_dup(bstr_t bstr);
 
+bstr_t  bstr_newShared(char *from, size_t size);
+bstr_t  bstr_ref(bstr_t bstr);
+void    bstr_unref(bstr_t bstr);
+int     bstr_isShared(bstr_t bstr);
+
 int     bstr_asprintf(bstr_t *bstr, char *fmt, ...);
 int     bstr_scatprintf(bstr_t *bstr, char *fmt, ...);
+int     bstr_appendf(bstr_t *bstr, char *fmt, ...);
+
+bstr_arena_t* bstr_arenaNew(size_t blockSize);
+void*         bstr_arenaAlloc(bstr_arena_t *arena, size_t size);
+bstr_t        bstr_newInArena(bstr_arena_t *arena, char *from, size_t size);
+void          bstr_arenaReset(bstr_arena_t *arena);
+void          bstr_arenaFree(bstr_arena_t *arena);
+size_t        bstr_inBufferSize(size_t size);
+bstr_t        bstr_newInBuffer(void *buffer, char *from, size_t size);
+
+void  bstr_setAllocator(bstr_mallocFunc  mallocFunc,
+                        bstr_callocFunc  callocFunc,
+                        bstr_reallocFunc reallocFunc,
+                        bstr_freeFunc    freeFunc,
+                        void             *ctx);
+void* bstr_memAlloc(bstr_memComponent component, size_t size);
+void* bstr_memCalloc(bstr_memComponent component, size_t count, size_t size);
+void* bstr_memRealloc(bstr_memComponent component, void *ptr, size_t size);
+void  bstr_memFree(void *ptr);
+int   bstr_memStats(bstr_memComponent component, size_t *bytes, size_t *blocks);
 
 #endif /* BSTR_H_ */
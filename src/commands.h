@@ -0,0 +1,287 @@
+/* commands.h
+ *
+ * Generated by gencommands.awk from commands.def. Do not edit.
+ */
+
+#define REDIS_CMD_HASHSEED  127U
+#define REDIS_CMD_SLOTCOUNT 2048
+
+/* List of Redis commands */
+static struct RedisCmdSpec redisCommandSpecTable[] = {
+    {"auth",2,REDIS_CMD_INLINE,0,0,0,0},
+    {"get",2,REDIS_CMD_INLINE,REDIS_COMMAND_READONLY|REDIS_COMMAND_IDEMPOTENT|REDIS_COMMAND_CACHEABLE,1,1,1},
+    {"set",3,REDIS_CMD_BULK,REDIS_COMMAND_WRITE|REDIS_COMMAND_IDEMPOTENT,1,1,1},
+    {"setnx",3,REDIS_CMD_BULK,REDIS_COMMAND_WRITE,1,1,1},
+    {"append",3,REDIS_CMD_BULK,REDIS_COMMAND_WRITE,1,1,1},
+    {"substr",4,REDIS_CMD_INLINE,REDIS_COMMAND_READONLY|REDIS_COMMAND_IDEMPOTENT|REDIS_COMMAND_CACHEABLE,1,1,1},
+    {"del",-2,REDIS_CMD_INLINE,REDIS_COMMAND_WRITE|REDIS_COMMAND_IDEMPOTENT,1,-1,1},
+    {"exists",2,REDIS_CMD_INLINE,REDIS_COMMAND_READONLY|REDIS_COMMAND_IDEMPOTENT|REDIS_COMMAND_CACHEABLE,1,1,1},
+    {"incr",2,REDIS_CMD_INLINE,REDIS_COMMAND_WRITE,1,1,1},
+    {"decr",2,REDIS_CMD_INLINE,REDIS_COMMAND_WRITE,1,1,1},
+    {"rpush",3,REDIS_CMD_BULK,REDIS_COMMAND_WRITE,1,1,1},
+    {"lpush",3,REDIS_CMD_BULK,REDIS_COMMAND_WRITE,1,1,1},
+    {"rpop",2,REDIS_CMD_INLINE,REDIS_COMMAND_WRITE,1,1,1},
+    {"lpop",2,REDIS_CMD_INLINE,REDIS_COMMAND_WRITE,1,1,1},
+    {"brpop",-3,REDIS_CMD_INLINE,REDIS_COMMAND_WRITE,1,-2,1},
+    {"blpop",-3,REDIS_CMD_INLINE,REDIS_COMMAND_WRITE,1,-2,1},
+    {"llen",2,REDIS_CMD_INLINE,REDIS_COMMAND_READONLY|REDIS_COMMAND_IDEMPOTENT|REDIS_COMMAND_CACHEABLE,1,1,1},
+    {"lindex",3,REDIS_CMD_INLINE,REDIS_COMMAND_READONLY|REDIS_COMMAND_IDEMPOTENT|REDIS_COMMAND_CACHEABLE,1,1,1},
+    {"lset",4,REDIS_CMD_BULK,REDIS_COMMAND_WRITE|REDIS_COMMAND_IDEMPOTENT,1,1,1},
+    {"lrange",4,REDIS_CMD_INLINE,REDIS_COMMAND_READONLY|REDIS_COMMAND_IDEMPOTENT|REDIS_COMMAND_CACHEABLE,1,1,1},
+    {"ltrim",4,REDIS_CMD_INLINE,REDIS_COMMAND_WRITE|REDIS_COMMAND_IDEMPOTENT,1,1,1},
+    {"lrem",4,REDIS_CMD_BULK,REDIS_COMMAND_WRITE|REDIS_COMMAND_IDEMPOTENT,1,1,1},
+    {"rpoplpush",3,REDIS_CMD_BULK,REDIS_COMMAND_WRITE,1,2,1},
+    {"sadd",3,REDIS_CMD_BULK,REDIS_COMMAND_WRITE|REDIS_COMMAND_IDEMPOTENT,1,1,1},
+    {"srem",3,REDIS_CMD_BULK,REDIS_COMMAND_WRITE|REDIS_COMMAND_IDEMPOTENT,1,1,1},
+    {"smove",4,REDIS_CMD_BULK,REDIS_COMMAND_WRITE|REDIS_COMMAND_IDEMPOTENT,1,2,1},
+    {"sismember",3,REDIS_CMD_BULK,REDIS_COMMAND_READONLY|REDIS_COMMAND_IDEMPOTENT|REDIS_COMMAND_CACHEABLE,1,1,1},
+    {"scard",2,REDIS_CMD_INLINE,REDIS_COMMAND_READONLY|REDIS_COMMAND_IDEMPOTENT|REDIS_COMMAND_CACHEABLE,1,1,1},
+    {"spop",2,REDIS_CMD_INLINE,REDIS_COMMAND_WRITE,1,1,1},
+    {"srandmember",2,REDIS_CMD_INLINE,REDIS_COMMAND_READONLY,1,1,1},
+    {"sinter",-2,REDIS_CMD_INLINE,REDIS_COMMAND_READONLY|REDIS_COMMAND_IDEMPOTENT,1,-1,1},
+    {"sinterstore",-3,REDIS_CMD_INLINE,REDIS_COMMAND_WRITE|REDIS_COMMAND_IDEMPOTENT,1,-1,1},
+    {"sunion",-2,REDIS_CMD_INLINE,REDIS_COMMAND_READONLY|REDIS_COMMAND_IDEMPOTENT,1,-1,1},
+    {"sunionstore",-3,REDIS_CMD_INLINE,REDIS_COMMAND_WRITE|REDIS_COMMAND_IDEMPOTENT,1,-1,1},
+    {"sdiff",-2,REDIS_CMD_INLINE,REDIS_COMMAND_READONLY|REDIS_COMMAND_IDEMPOTENT,1,-1,1},
+    {"sdiffstore",-3,REDIS_CMD_INLINE,REDIS_COMMAND_WRITE|REDIS_COMMAND_IDEMPOTENT,1,-1,1},
+    {"smembers",2,REDIS_CMD_INLINE,REDIS_COMMAND_READONLY|REDIS_COMMAND_IDEMPOTENT|REDIS_COMMAND_CACHEABLE,1,1,1},
+    {"zadd",4,REDIS_CMD_BULK,REDIS_COMMAND_WRITE|REDIS_COMMAND_IDEMPOTENT,1,1,1},
+    {"zincrby",4,REDIS_CMD_BULK,REDIS_COMMAND_WRITE,1,1,1},
+    {"zrem",3,REDIS_CMD_BULK,REDIS_COMMAND_WRITE|REDIS_COMMAND_IDEMPOTENT,1,1,1},
+    {"zremrangebyscore",4,REDIS_CMD_INLINE,REDIS_COMMAND_WRITE|REDIS_COMMAND_IDEMPOTENT,1,1,1},
+    {"zmerge",-3,REDIS_CMD_INLINE,REDIS_COMMAND_WRITE|REDIS_COMMAND_IDEMPOTENT,1,-1,1},
+    {"zmergeweighed",-4,REDIS_CMD_INLINE,REDIS_COMMAND_WRITE|REDIS_COMMAND_IDEMPOTENT,1,1,1},
+    {"zrange",-4,REDIS_CMD_INLINE,REDIS_COMMAND_READONLY|REDIS_COMMAND_IDEMPOTENT|REDIS_COMMAND_CACHEABLE,1,1,1},
+    {"zrank",3,REDIS_CMD_BULK,REDIS_COMMAND_READONLY|REDIS_COMMAND_IDEMPOTENT|REDIS_COMMAND_CACHEABLE,1,1,1},
+    {"zrevrank",3,REDIS_CMD_BULK,REDIS_COMMAND_READONLY|REDIS_COMMAND_IDEMPOTENT|REDIS_COMMAND_CACHEABLE,1,1,1},
+    {"zrangebyscore",-4,REDIS_CMD_INLINE,REDIS_COMMAND_READONLY|REDIS_COMMAND_IDEMPOTENT|REDIS_COMMAND_CACHEABLE,1,1,1},
+    {"zcount",4,REDIS_CMD_INLINE,REDIS_COMMAND_READONLY|REDIS_COMMAND_IDEMPOTENT|REDIS_COMMAND_CACHEABLE,1,1,1},
+    {"zrevrange",-4,REDIS_CMD_INLINE,REDIS_COMMAND_READONLY|REDIS_COMMAND_IDEMPOTENT|REDIS_COMMAND_CACHEABLE,1,1,1},
+    {"zcard",2,REDIS_CMD_INLINE,REDIS_COMMAND_READONLY|REDIS_COMMAND_IDEMPOTENT|REDIS_COMMAND_CACHEABLE,1,1,1},
+    {"zscore",3,REDIS_CMD_BULK,REDIS_COMMAND_READONLY|REDIS_COMMAND_IDEMPOTENT|REDIS_COMMAND_CACHEABLE,1,1,1},
+    {"incrby",3,REDIS_CMD_INLINE,REDIS_COMMAND_WRITE,1,1,1},
+    {"decrby",3,REDIS_CMD_INLINE,REDIS_COMMAND_WRITE,1,1,1},
+    {"getset",3,REDIS_CMD_BULK,REDIS_COMMAND_WRITE,1,1,1},
+    {"randomkey",1,REDIS_CMD_INLINE,REDIS_COMMAND_READONLY,0,0,0},
+    {"select",2,REDIS_CMD_INLINE,REDIS_COMMAND_IDEMPOTENT,0,0,0},
+    {"move",3,REDIS_CMD_INLINE,REDIS_COMMAND_WRITE,1,1,1},
+    {"rename",3,REDIS_CMD_INLINE,REDIS_COMMAND_WRITE,1,2,1},
+    {"renamenx",3,REDIS_CMD_INLINE,REDIS_COMMAND_WRITE,1,2,1},
+    {"keys",2,REDIS_CMD_INLINE,REDIS_COMMAND_READONLY|REDIS_COMMAND_IDEMPOTENT,0,0,0},
+    {"dbsize",1,REDIS_CMD_INLINE,REDIS_COMMAND_READONLY|REDIS_COMMAND_IDEMPOTENT,0,0,0},
+    {"ping",1,REDIS_CMD_INLINE,REDIS_COMMAND_READONLY|REDIS_COMMAND_IDEMPOTENT,0,0,0},
+    {"echo",2,REDIS_CMD_BULK,REDIS_COMMAND_READONLY|REDIS_COMMAND_IDEMPOTENT,0,0,0},
+    {"save",1,REDIS_CMD_INLINE,0,0,0,0},
+    {"bgsave",1,REDIS_CMD_INLINE,0,0,0,0},
+    {"rewriteaof",1,REDIS_CMD_INLINE,0,0,0,0},
+    {"bgrewriteaof",1,REDIS_CMD_INLINE,0,0,0,0},
+    {"shutdown",1,REDIS_CMD_INLINE,0,0,0,0},
+    {"lastsave",1,REDIS_CMD_INLINE,REDIS_COMMAND_READONLY|REDIS_COMMAND_IDEMPOTENT,0,0,0},
+    {"type",2,REDIS_CMD_INLINE,REDIS_COMMAND_READONLY|REDIS_COMMAND_IDEMPOTENT|REDIS_COMMAND_CACHEABLE,1,1,1},
+    {"flushdb",1,REDIS_CMD_INLINE,REDIS_COMMAND_WRITE|REDIS_COMMAND_IDEMPOTENT,0,0,0},
+    {"flushall",1,REDIS_CMD_INLINE,REDIS_COMMAND_WRITE|REDIS_COMMAND_IDEMPOTENT,0,0,0},
+    {"sort",-2,REDIS_CMD_INLINE,REDIS_COMMAND_WRITE,1,1,1},
+    {"info",1,REDIS_CMD_INLINE,REDIS_COMMAND_READONLY|REDIS_COMMAND_IDEMPOTENT,0,0,0},
+    {"mget",-2,REDIS_CMD_INLINE,REDIS_COMMAND_READONLY|REDIS_COMMAND_IDEMPOTENT,1,-1,1},
+    {"expire",3,REDIS_CMD_INLINE,REDIS_COMMAND_WRITE|REDIS_COMMAND_IDEMPOTENT,1,1,1},
+    {"expireat",3,REDIS_CMD_INLINE,REDIS_COMMAND_WRITE|REDIS_COMMAND_IDEMPOTENT,1,1,1},
+    {"ttl",2,REDIS_CMD_INLINE,REDIS_COMMAND_READONLY|REDIS_COMMAND_IDEMPOTENT,1,1,1},
+    {"slaveof",3,REDIS_CMD_INLINE,0,0,0,0},
+    {"debug",-2,REDIS_CMD_INLINE,0,0,0,0},
+    {"mset",-3,REDIS_CMD_MULTIBULK,REDIS_COMMAND_WRITE|REDIS_COMMAND_IDEMPOTENT,1,-1,2},
+    {"msetnx",-3,REDIS_CMD_MULTIBULK,REDIS_COMMAND_WRITE,1,-1,2},
+    {"monitor",1,REDIS_CMD_INLINE,0,0,0,0},
+    {"multi",1,REDIS_CMD_INLINE,0,0,0,0},
+    {"exec",1,REDIS_CMD_INLINE,0,0,0,0},
+    {"discard",1,REDIS_CMD_INLINE,0,0,0,0},
+    {"hset",4,REDIS_CMD_MULTIBULK,REDIS_COMMAND_WRITE|REDIS_COMMAND_IDEMPOTENT,1,1,1},
+    {"hget",3,REDIS_CMD_BULK,REDIS_COMMAND_READONLY|REDIS_COMMAND_IDEMPOTENT|REDIS_COMMAND_CACHEABLE,1,1,1},
+    {"hdel",3,REDIS_CMD_BULK,REDIS_COMMAND_WRITE|REDIS_COMMAND_IDEMPOTENT,1,1,1},
+    {"hlen",2,REDIS_CMD_INLINE,REDIS_COMMAND_READONLY|REDIS_COMMAND_IDEMPOTENT|REDIS_COMMAND_CACHEABLE,1,1,1},
+    {"hkeys",2,REDIS_CMD_INLINE,REDIS_COMMAND_READONLY|REDIS_COMMAND_IDEMPOTENT|REDIS_COMMAND_CACHEABLE,1,1,1},
+    {"hvals",2,REDIS_CMD_INLINE,REDIS_COMMAND_READONLY|REDIS_COMMAND_IDEMPOTENT|REDIS_COMMAND_CACHEABLE,1,1,1},
+    {"hgetall",2,REDIS_CMD_INLINE,REDIS_COMMAND_READONLY|REDIS_COMMAND_IDEMPOTENT|REDIS_COMMAND_CACHEABLE,1,1,1},
+    {"hexists",3,REDIS_CMD_BULK,REDIS_COMMAND_READONLY|REDIS_COMMAND_IDEMPOTENT|REDIS_COMMAND_CACHEABLE,1,1,1},
+    {"config",-2,REDIS_CMD_BULK,0,0,0,0},
+    {"setex",4,REDIS_CMD_MULTIBULK,REDIS_COMMAND_WRITE|REDIS_COMMAND_IDEMPOTENT,1,1,1},
+    {"psetex",4,REDIS_CMD_MULTIBULK,REDIS_COMMAND_WRITE|REDIS_COMMAND_IDEMPOTENT,1,1,1},
+    {"strlen",2,REDIS_CMD_MULTIBULK,REDIS_COMMAND_READONLY|REDIS_COMMAND_IDEMPOTENT|REDIS_COMMAND_CACHEABLE,1,1,1},
+    {"getrange",4,REDIS_CMD_MULTIBULK,REDIS_COMMAND_READONLY|REDIS_COMMAND_IDEMPOTENT|REDIS_COMMAND_CACHEABLE,1,1,1},
+    {"setrange",4,REDIS_CMD_MULTIBULK,REDIS_COMMAND_WRITE|REDIS_COMMAND_IDEMPOTENT,1,1,1},
+    {"getbit",3,REDIS_CMD_MULTIBULK,REDIS_COMMAND_READONLY|REDIS_COMMAND_IDEMPOTENT|REDIS_COMMAND_CACHEABLE,1,1,1},
+    {"setbit",4,REDIS_CMD_MULTIBULK,REDIS_COMMAND_WRITE|REDIS_COMMAND_IDEMPOTENT,1,1,1},
+    {"bitcount",-2,REDIS_CMD_MULTIBULK,REDIS_COMMAND_READONLY|REDIS_COMMAND_IDEMPOTENT|REDIS_COMMAND_CACHEABLE,1,1,1},
+    {"incrbyfloat",3,REDIS_CMD_MULTIBULK,REDIS_COMMAND_WRITE,1,1,1},
+    {"getdel",2,REDIS_CMD_MULTIBULK,REDIS_COMMAND_WRITE,1,1,1},
+    {"unlink",-2,REDIS_CMD_MULTIBULK,REDIS_COMMAND_WRITE|REDIS_COMMAND_IDEMPOTENT,1,-1,1},
+    {"touch",-2,REDIS_CMD_MULTIBULK,REDIS_COMMAND_READONLY|REDIS_COMMAND_IDEMPOTENT,1,-1,1},
+    {"persist",2,REDIS_CMD_MULTIBULK,REDIS_COMMAND_WRITE|REDIS_COMMAND_IDEMPOTENT,1,1,1},
+    {"pexpire",3,REDIS_CMD_MULTIBULK,REDIS_COMMAND_WRITE|REDIS_COMMAND_IDEMPOTENT,1,1,1},
+    {"pexpireat",3,REDIS_CMD_MULTIBULK,REDIS_COMMAND_WRITE|REDIS_COMMAND_IDEMPOTENT,1,1,1},
+    {"pttl",2,REDIS_CMD_MULTIBULK,REDIS_COMMAND_READONLY|REDIS_COMMAND_IDEMPOTENT,1,1,1},
+    {"dump",2,REDIS_CMD_MULTIBULK,REDIS_COMMAND_READONLY|REDIS_COMMAND_IDEMPOTENT,1,1,1},
+    {"restore",-4,REDIS_CMD_MULTIBULK,REDIS_COMMAND_WRITE,1,1,1},
+    {"scan",-2,REDIS_CMD_MULTIBULK,REDIS_COMMAND_READONLY|REDIS_COMMAND_IDEMPOTENT,0,0,0},
+    {"lpushx",-3,REDIS_CMD_MULTIBULK,REDIS_COMMAND_WRITE,1,1,1},
+    {"rpushx",-3,REDIS_CMD_MULTIBULK,REDIS_COMMAND_WRITE,1,1,1},
+    {"linsert",5,REDIS_CMD_MULTIBULK,REDIS_COMMAND_WRITE,1,1,1},
+    {"lpos",-3,REDIS_CMD_MULTIBULK,REDIS_COMMAND_READONLY|REDIS_COMMAND_IDEMPOTENT|REDIS_COMMAND_CACHEABLE,1,1,1},
+    {"brpoplpush",4,REDIS_CMD_MULTIBULK,REDIS_COMMAND_WRITE,1,2,1},
+    {"smismember",-3,REDIS_CMD_MULTIBULK,REDIS_COMMAND_READONLY|REDIS_COMMAND_IDEMPOTENT|REDIS_COMMAND_CACHEABLE,1,1,1},
+    {"sscan",-3,REDIS_CMD_MULTIBULK,REDIS_COMMAND_READONLY|REDIS_COMMAND_IDEMPOTENT,1,1,1},
+    {"zrevrangebyscore",-4,REDIS_CMD_MULTIBULK,REDIS_COMMAND_READONLY|REDIS_COMMAND_IDEMPOTENT|REDIS_COMMAND_CACHEABLE,1,1,1},
+    {"zremrangebyrank",4,REDIS_CMD_MULTIBULK,REDIS_COMMAND_WRITE|REDIS_COMMAND_IDEMPOTENT,1,1,1},
+    {"zpopmin",-2,REDIS_CMD_MULTIBULK,REDIS_COMMAND_WRITE,1,1,1},
+    {"zpopmax",-2,REDIS_CMD_MULTIBULK,REDIS_COMMAND_WRITE,1,1,1},
+    {"zmscore",-3,REDIS_CMD_MULTIBULK,REDIS_COMMAND_READONLY|REDIS_COMMAND_IDEMPOTENT|REDIS_COMMAND_CACHEABLE,1,1,1},
+    {"zscan",-3,REDIS_CMD_MULTIBULK,REDIS_COMMAND_READONLY|REDIS_COMMAND_IDEMPOTENT,1,1,1},
+    {"hmset",-4,REDIS_CMD_MULTIBULK,REDIS_COMMAND_WRITE|REDIS_COMMAND_IDEMPOTENT,1,1,1},
+    {"hmget",-3,REDIS_CMD_MULTIBULK,REDIS_COMMAND_READONLY|REDIS_COMMAND_IDEMPOTENT|REDIS_COMMAND_CACHEABLE,1,1,1},
+    {"hsetnx",4,REDIS_CMD_MULTIBULK,REDIS_COMMAND_WRITE,1,1,1},
+    {"hincrby",4,REDIS_CMD_MULTIBULK,REDIS_COMMAND_WRITE,1,1,1},
+    {"hincrbyfloat",4,REDIS_CMD_MULTIBULK,REDIS_COMMAND_WRITE,1,1,1},
+    {"hstrlen",3,REDIS_CMD_MULTIBULK,REDIS_COMMAND_READONLY|REDIS_COMMAND_IDEMPOTENT|REDIS_COMMAND_CACHEABLE,1,1,1},
+    {"hscan",-3,REDIS_CMD_MULTIBULK,REDIS_COMMAND_READONLY|REDIS_COMMAND_IDEMPOTENT,1,1,1},
+    {"pfadd",-2,REDIS_CMD_MULTIBULK,REDIS_COMMAND_WRITE|REDIS_COMMAND_IDEMPOTENT,1,1,1},
+    {"pfcount",-2,REDIS_CMD_MULTIBULK,REDIS_COMMAND_READONLY|REDIS_COMMAND_IDEMPOTENT,1,-1,1},
+    {"publish",3,REDIS_CMD_MULTIBULK,0,0,0,0},
+    {"watch",-2,REDIS_CMD_MULTIBULK,0,1,-1,1},
+    {"unwatch",1,REDIS_CMD_MULTIBULK,0,0,0,0},
+    {"time",1,REDIS_CMD_MULTIBULK,REDIS_COMMAND_READONLY,0,0,0},
+    {"hello",-1,REDIS_CMD_MULTIBULK,0,0,0,0},
+    {"client",-2,REDIS_CMD_MULTIBULK,0,0,0,0},
+    {"command",-1,REDIS_CMD_MULTIBULK,REDIS_COMMAND_READONLY|REDIS_COMMAND_IDEMPOTENT,0,0,0},
+    {NULL,0,0,0,0,0,0}
+};
+
+/* Perfect hash slot -> index in redisCommandSpecTable + 1 (0: no command) */
+static const unsigned short redisCommandSlotTable[REDIS_CMD_SLOTCOUNT] = {
+    0, 0, 0, 0, 0, 0, 2, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 110, 0, 138, 128, 0, 0, 0, 0, 0, 0, 127, 0, 0,
+    0, 0, 73, 0, 66, 141, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 51, 0, 0, 0, 79, 0, 0, 0, 0,
+    49, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 111, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    130, 0, 0, 8, 0, 0, 0, 139, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 99, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 4, 0, 0, 0, 19, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 18, 0,
+    0, 0, 0, 0, 0, 0, 62, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    42, 0, 0, 0, 59, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 94, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 104, 0, 0, 0, 78, 0, 0, 0, 0, 0,
+    0, 135, 0, 55, 0, 44, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    38, 0, 0, 0, 0, 0, 0, 126, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 90, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 31, 6, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 12, 0, 0, 0, 0,
+    77, 0, 0, 0, 0, 0, 0, 54, 0, 0, 0, 53, 40, 47, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 10,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    105, 0, 0, 0, 0, 0, 0, 0, 0, 0, 101, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 84,
+    0, 0, 0, 75, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 140, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 5, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 95, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 109, 0, 0, 24, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 114, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 61, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 17, 1, 33, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 3, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 68, 0, 0, 0, 0, 0, 0,
+    0, 25, 0, 0, 0, 0, 0, 0, 0, 0, 0, 7, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 60, 0, 0, 0, 0, 71, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    123, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 50, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 115, 0, 0, 0, 0, 0, 0, 0, 0, 143, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 92, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 86, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 29, 0, 0, 0,
+    0, 0, 0, 106, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 137,
+    0, 0, 0, 0, 0, 0, 0, 121, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 88, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    34, 0, 0, 0, 0, 0, 0, 0, 0, 120, 0, 0, 0, 0, 0, 0,
+    0, 0, 122, 76, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 80,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 37, 0, 0, 0,
+    0, 0, 41, 35, 0, 0, 22, 0, 58, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 108, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 48, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 16, 0, 0, 0, 0, 0, 0, 67, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 45, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 64, 0, 129, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 83, 0, 0, 0, 0, 81,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 11, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 21, 0, 32, 0, 0, 0,
+    0, 14, 0, 0, 118, 0, 0, 0, 0, 0, 0, 0, 0, 65, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 103, 0,
+    0, 0, 0, 0, 0, 39, 0, 30, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 116, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 119, 0, 102, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 134, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 52, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 117,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    9, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 131, 0, 57, 0, 0,
+    0, 125, 0, 0, 0, 0, 113, 0, 91, 0, 0, 0, 0, 100, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 63, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    74, 0, 0, 0, 0, 56, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 93, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 70, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 132, 0, 0, 0, 0, 0, 46, 0, 0,
+    43, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 15, 0,
+    0, 0, 0, 0, 0, 0, 0, 27, 97, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 69, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 23, 0, 112, 87, 72, 0, 0, 0, 0, 0, 124,
+    0, 0, 0, 0, 0, 0, 36, 85, 0, 0, 0, 0, 0, 0, 82, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 142, 98,
+    89, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 26, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 13, 0, 0, 0, 0, 0,
+    0, 96, 0, 0, 28, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 136, 0, 20,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 133, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 107, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+};
@@ -0,0 +1,91 @@
+# gencommands.awk
+#
+# Generate commands.h from commands.def: the table of command specs and a
+# case-insensitive perfect hash indexing it. The hash, computed the same way
+# by _redis_lookupCommandSpec(), is
+#
+#   h = seed; for each char c: h = h * 33 + tolower(c)    (mod 2^32)
+#   slot = (h + (h >> 16)) mod 2^32 mod REDIS_CMD_SLOTCOUNT
+#
+# and the generator looks for a seed (and a slot count) without collision.
+#
+# Usage: awk -f gencommands.awk commands.def > commands.h
+
+BEGIN {
+  for (i = 32; i < 127; i++) ord[sprintf("%c", i)] = i
+  type["inline"]    = "REDIS_CMD_INLINE"
+  type["bulk"]      = "REDIS_CMD_BULK"
+  type["multibulk"] = "REDIS_CMD_MULTIBULK"
+  n = 0
+}
+
+/^[ \t]*(#|$)/ { next }
+
+{
+  if (NF != 7 || !($3 in type)) {
+    printf("%s:%d: invalid command spec\n", FILENAME, FNR) > "/dev/stderr"
+    exit 1
+  }
+  name[n] = tolower($1)
+  arity[n] = $2
+  ctype[n] = type[$3]
+  flags[n] = ""
+  if ($4 ~ /r/) flags[n] = flags[n] "|REDIS_COMMAND_READONLY"
+  if ($4 ~ /w/) flags[n] = flags[n] "|REDIS_COMMAND_WRITE"
+  if ($4 ~ /i/) flags[n] = flags[n] "|REDIS_COMMAND_IDEMPOTENT"
+  if ($4 ~ /c/) flags[n] = flags[n] "|REDIS_COMMAND_CACHEABLE"
+  flags[n] = (flags[n] == "") ? "0" : substr(flags[n], 2)
+  keys[n] = $5 "," $6 "," $7
+  n++
+}
+
+function slot(str, seed, count,    h, i) {
+  h = seed
+  for (i = 1; i <= length(str); i++)
+    h = (h * 33 + ord[substr(str, i, 1)]) % 4294967296
+  return ((h + int(h / 65536)) % 4294967296) % count
+}
+
+END {
+  if (n == 0) exit 1
+  for (count = 1; count < 8 * n; count *= 2) ;
+  found = 0
+  while (!found) {
+    for (seed = 1; seed <= 5000 && !found; seed++) {
+      delete used
+      found = 1
+      for (i = 0; i < n; i++) {
+        s = slot(name[i], seed, count)
+        if (s in used) { found = 0; break }
+        used[s] = i
+      }
+    }
+    if (!found) count *= 2
+  }
+  seed--
+
+  print "/* commands.h"
+  print " *"
+  print " * Generated by gencommands.awk from commands.def. Do not edit."
+  print " */"
+  print ""
+  printf("#define REDIS_CMD_HASHSEED  %uU\n", seed)
+  printf("#define REDIS_CMD_SLOTCOUNT %d\n", count)
+  print ""
+  print "/* List of Redis commands */"
+  print "static struct RedisCmdSpec redisCommandSpecTable[] = {"
+  for (i = 0; i < n; i++)
+    printf("    {\"%s\",%d,%s,%s,%s},\n", name[i], arity[i], ctype[i], flags[i], keys[i])
+  print "    {NULL,0,0,0,0,0,0}"
+  print "};"
+  print ""
+  print "/* Perfect hash slot -> index in redisCommandSpecTable + 1 (0: no command) */"
+  print "static const unsigned short redisCommandSlotTable[REDIS_CMD_SLOTCOUNT] = {"
+  for (s = 0; s < count; s += 16) {
+    line = "   "
+    for (j = s; j < s + 16 && j < count; j++)
+      line = line " " ((j in used) ? used[j] + 1 : 0) ","
+    print line
+  }
+  print "};"
+}
@@ -28,11 +28,20 @@
 #include <string.h>
 #include <stdarg.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
 #include <ctype.h>
+#include <math.h>
+#include <float.h>
 #include <assert.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
 
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <arpa/inet.h>
 #include <netinet/tcp.h>
 #include <netdb.h>
@@ -68,6 +77,20 @@
  * redisError_getStr() and redisError_getSysErrorStr() can be used to get error
  * details and their return values should never be freed.
  *
+ * <code>redis_errCode</code> and <code>redis_sysErrno</code> are thread local:
+ * each thread sees the errors of its own calls only. Connection errors are
+ * also kept by the #REDIS structure (see redis_getLastError()).
+ *
+ * Threads: libredis keeps no shared mutable state, a #REDIS structure holds
+ * all the state of its connection (including the MULTI state). Different
+ * threads can use different connections, commands and replies concurrently
+ * without locking, so one connection per thread scales with the number of
+ * threads. A #REDIS structure, a #RedisCmd, a #RedisCmdArray or a reply must
+ * not be used by two threads at the same time; it can be handed from one
+ * thread to another. bstr_setAllocator() and redis_setPoolLimit() are
+ * meant to be called before the threads start. Shared bstrings (see
+ * bstr_ref()) can be referenced and released from any thread.
+ *
  * <example>
  * <title>Example using libredis.</title>
  * <programlisting>
@@ -142,14 +165,31 @@
 
 #define MAXDATASIZE  1024
 #define MAXSTRLENGTH 1024
+#ifndef IOV_MAX
+#define IOV_MAX      1024
+#endif
+#ifndef REDIS_IO_TIMEOUT
+/* Time allowed to a send or receive, in microseconds */
+#define REDIS_IO_TIMEOUT (10 * 1000000LL)
+#endif
 
 struct _REDIS
 {
   int   fd;                     /* socket descriptor to Redis Server      */
   char  host[INET6_ADDRSTRLEN]; /* Redis server host                      */
   char  *port;                  /* Redis server port, service name or num */
-  int   lasterror;              /* Last error                             */
+  int   lasterror;              /* Last connection error                  */
+  int   sysErrno;               /* errno of lasterror, if any             */
   char  *errorstr;              /* Error details                          */
+  int   multiMode;              /* In a MULTI transaction?                */
+  int   protocolVersion;        /* RESP version negotiated with HELLO     */
+  char  *outBuf;                /* Reused by redis_execFmt()              */
+  size_t outBufSize;
+  bstr_arena_t *arena;          /* Arena replies are allocated from       */
+  struct _RedisPipeline *pipeline; /* Commands of redis_submit(), if any  */
+  RedisWaitFunc waitFunc;       /* Replaces select() if not NULL          */
+  void          *waitData;
+  struct _RedisCache *cache;    /* Cache tracking this connection, if any */
 };
 
 struct _RedisRetVal
@@ -157,10 +197,17 @@ struct _RedisRetVal
  RedisReturnType  type;
  bstr_t           errorMsg;
  bstr_t           line;
- bstr_t           bulk;
+ bstr_t           bulk;           /* also big numbers and verbatim strings  */
  bstr_t           *multibulk;
  int              multibulkSize;
- int              integer;
+ int              integer;        /* also booleans                          */
+ double           doubleValue;
+ char             verbatimFormat[4];
+ RedisRetVal      **elements;     /* children of aggregate replies. For a
+                                   * map, keys and values alternate.        */
+ int              elementCount;
+ RedisRetVal      *attributes;    /* RESP3 attribute map, if any            */
+ bstr_arena_t     *arena;         /* Arena the reply lives in, if any       */
 };
 
 struct _RedisCmd
@@ -168,20 +215,59 @@ struct _RedisCmd
    RedisProtocolType   protocolType;
    bstr_t              *args;
    int                 argsCount;
+   int                 argsSize;        /* Allocated entries of args */
+   bstr_arena_t        *arena;          /* Arena the command lives in */
    bstr_t              protocolString;
    RedisRetVal         *returnValue;
+   char                *inlineBuf;      /* Short args are stored here */
+   size_t              inlineUsed;
  };
 
+/*
+ * A command is allocated in one block with room for REDIS_CMD_INLINE_ARGS
+ * args and a REDIS_CMD_INLINE_SIZE bytes buffer holding the args of up to
+ * REDIS_CMD_INLINE_ARGLEN bytes, so a typical command (a name, a key and a
+ * value or a few fields) needs no other allocation. Longer args, and args that
+ * grow, go to the heap.
+ */
+#define REDIS_CMD_INLINE_ARGS   8
+#define REDIS_CMD_INLINE_SIZE   256
+#define REDIS_CMD_INLINE_ARGLEN 32
+
+/* Start of the args array allocated with cmd */
+#define REDIS_CMD_INLINEARGS(cmd) ((bstr_t *)((RedisCmd *)(cmd) + 1))
+
+struct _RedisPreparedCmd
+{
+  char        *buf;             /* Encoded command                        */
+  size_t      len;              /* Length of the encoded command          */
+  size_t      size;             /* Allocated size of buf                  */
+  size_t      *slots;           /* Offset of each encoded arg in buf      */
+  int         argsCount;
+  RedisRetVal *returnValue;
+};
+
 struct _RedisCmdArray
 {
-  RedisCmd    **cmds;
+  RedisCmd    **cmds;           /* Commands, NULL terminated, followed by
+                                 * spare commands at the end of the array */
   RedisRetVal **returnValues;
   int         cmdCount;
+  int         cmdsSize;         /* Allocated entries of cmds              */
+  int         spareCount;       /* Commands kept by redisCmdArray_reset() */
+  int         returnValuesSize; /* Allocated entries of returnValues      */
   bstr_t      protocolString;
+  bstr_t      protocolBuffer;   /* Outdated protocolString, kept to be
+                                 * rebuilt in place                       */
 };
 
-/* Are we in multi mode? */
-static volatile short int _redis_multiMode = 0;
+/*
+ * Error of the last failed call made by the calling thread. Connection errors
+ * are also kept in the REDIS structure (see redis_getLastError()).
+ */
+__thread int redis_errCode = 0;
+__thread int redis_sysErrno = 0;
+
 /* Description entry of an errorCode */
 typedef struct
 {
@@ -207,6 +293,8 @@ static RedisErrorSpec redisErrorSpecTable[] =
   {REDIS_ERROR_CMD_UNBALANCEDQ,   "Unbalanced quotes in command string." },
   {REDIS_ERROR_MLT_UNSUPPORTED,   "Multi not supported by server."       },
   {REDIS_ERROR_MLT_NOTMULTIMODE,  "Not in Multi mode"                    },
+  {REDIS_ERROR_RET_UNEXPECTED,    "Unexpected reply from server."        },
+  {REDIS_ERROR_RET_SERVER,        "Server replied with an error."        },
   {-1, NULL}
 };
 
@@ -247,6 +335,65 @@ const char* redisError_getSysErrorStr(RedisErrorCode errorCode, int sysErrCode)
   if (errorCode == REDIS_ERROR_CNX_GAI) return gai_strerror(sysErrCode);
   return strerror(sysErrCode);
 }
+
+/**
+ * redisError_getCode:
+ *
+ * Get the error code of the last libredis call that failed in the calling
+ * thread. It is the value of <code>redis_errCode</code>, which is thread
+ * local: errors of other threads never show here.
+ *
+ * Returns: the error code.
+ **/
+RedisErrorCode redisError_getCode(void)
+{
+  return redis_errCode;
+}
+
+/**
+ * redisError_getSysErrno:
+ *
+ * Get the standard library error code (<code>errno</code>) of the last
+ * libredis call that failed in the calling thread, as
+ * <code>redis_sysErrno</code>.
+ *
+ * Returns: the standard library error code or 0.
+ **/
+int redisError_getSysErrno(void)
+{
+  return redis_sysErrno;
+}
+
+/**
+ * redis_getLastError:
+ * @redis: #REDIS structure to use.
+ *
+ * Get the last connection error of @redis: errors sending or receiving data,
+ * unexpected replies and transaction errors. Unlike
+ * <code>redis_errCode</code>, it is not overwritten by errors of other
+ * connections or of functions not using a connection (like a memory
+ * allocation failure while building a command).
+ *
+ * Returns: the error code, %REDIS_NOERROR if no connection error occurred.
+ **/
+RedisErrorCode redis_getLastError(REDIS *redis)
+{
+  return redis->lasterror;
+}
+
+/**
+ * redis_getLastSysErrno:
+ * @redis: #REDIS structure to use.
+ *
+ * Get the standard library error code of the last connection error of
+ * @redis (see redis_getLastError()).
+ *
+ * Returns: the standard library error code or 0.
+ **/
+int redis_getLastSysErrno(REDIS *redis)
+{
+  return redis->sysErrno;
+}
 /* Functions to set errors */
 
 /* Set mem allocation error */
@@ -257,11 +404,16 @@ static int _redis_setMallocError()
   return REDIS_ERROR_MEM_ALLOC;
 }
 
-/* Set connection error */
-static int _redis_setCnxError(int errorCode, int sysErrno)
+/* Set connection error, kept as the last error of redis if not NULL */
+static int _redis_setCnxError(REDIS *redis, int errorCode, int sysErrno)
 {
   redis_errCode = errorCode;
   redis_sysErrno = sysErrno;
+  if (redis != NULL)
+  {
+    redis->lasterror = errorCode;
+    redis->sysErrno  = sysErrno;
+  }
   return errorCode;
 }
 
@@ -287,130 +439,71 @@ struct RedisCmdSpec
 {
   char *name;
   int  arity;
-  int  flags;
+  int  type;                    /* REDIS_CMD_* used with REDIS_PROTOCOL_OLD */
+  int  flags;                   /* RedisCommandFlags                      */
+  int  firstKey;                /* Position of the first key arg or 0     */
+  int  lastKey;                 /* Last key arg, negative from the end    */
+  int  keyStep;                 /* Step between key args                  */
 };
 
-/* List of Redis commands (relative to version 1.2.6) */
-static struct RedisCmdSpec redisCommandSpecTable[] = {
-    {"auth",2,REDIS_CMD_INLINE},
-    {"get",2,REDIS_CMD_INLINE},
-    {"set",3,REDIS_CMD_BULK},
-    {"setnx",3,REDIS_CMD_BULK},
-    {"append",3,REDIS_CMD_BULK},
-    {"substr",4,REDIS_CMD_INLINE},
-    {"del",-2,REDIS_CMD_INLINE},
-    {"exists",2,REDIS_CMD_INLINE},
-    {"incr",2,REDIS_CMD_INLINE},
-    {"decr",2,REDIS_CMD_INLINE},
-    {"rpush",3,REDIS_CMD_BULK},
-    {"lpush",3,REDIS_CMD_BULK},
-    {"rpop",2,REDIS_CMD_INLINE},
-    {"lpop",2,REDIS_CMD_INLINE},
-    {"brpop",-3,REDIS_CMD_INLINE},
-    {"blpop",-3,REDIS_CMD_INLINE},
-    {"llen",2,REDIS_CMD_INLINE},
-    {"lindex",3,REDIS_CMD_INLINE},
-    {"lset",4,REDIS_CMD_BULK},
-    {"lrange",4,REDIS_CMD_INLINE},
-    {"ltrim",4,REDIS_CMD_INLINE},
-    {"lrem",4,REDIS_CMD_BULK},
-    {"rpoplpush",3,REDIS_CMD_BULK},
-    {"sadd",3,REDIS_CMD_BULK},
-    {"srem",3,REDIS_CMD_BULK},
-    {"smove",4,REDIS_CMD_BULK},
-    {"sismember",3,REDIS_CMD_BULK},
-    {"scard",2,REDIS_CMD_INLINE},
-    {"spop",2,REDIS_CMD_INLINE},
-    {"srandmember",2,REDIS_CMD_INLINE},
-    {"sinter",-2,REDIS_CMD_INLINE},
-    {"sinterstore",-3,REDIS_CMD_INLINE},
-    {"sunion",-2,REDIS_CMD_INLINE},
-    {"sunionstore",-3,REDIS_CMD_INLINE},
-    {"sdiff",-2,REDIS_CMD_INLINE},
-    {"sdiffstore",-3,REDIS_CMD_INLINE},
-    {"smembers",2,REDIS_CMD_INLINE},
-    {"zadd",4,REDIS_CMD_BULK},
-    {"zincrby",4,REDIS_CMD_BULK},
-    {"zrem",3,REDIS_CMD_BULK},
-    {"zremrangebyscore",4,REDIS_CMD_INLINE},
-    {"zmerge",-3,REDIS_CMD_INLINE},
-    {"zmergeweighed",-4,REDIS_CMD_INLINE},
-    {"zrange",-4,REDIS_CMD_INLINE},
-    {"zrank",3,REDIS_CMD_BULK},
-    {"zrevrank",3,REDIS_CMD_BULK},
-    {"zrangebyscore",-4,REDIS_CMD_INLINE},
-    {"zcount",4,REDIS_CMD_INLINE},
-    {"zrevrange",-4,REDIS_CMD_INLINE},
-    {"zcard",2,REDIS_CMD_INLINE},
-    {"zscore",3,REDIS_CMD_BULK},
-    {"incrby",3,REDIS_CMD_INLINE},
-    {"decrby",3,REDIS_CMD_INLINE},
-    {"getset",3,REDIS_CMD_BULK},
-    {"randomkey",1,REDIS_CMD_INLINE},
-    {"select",2,REDIS_CMD_INLINE},
-    {"move",3,REDIS_CMD_INLINE},
-    {"rename",3,REDIS_CMD_INLINE},
-    {"renamenx",3,REDIS_CMD_INLINE},
-    {"keys",2,REDIS_CMD_INLINE},
-    {"dbsize",1,REDIS_CMD_INLINE},
-    {"ping",1,REDIS_CMD_INLINE},
-    {"echo",2,REDIS_CMD_BULK},
-    {"save",1,REDIS_CMD_INLINE},
-    {"bgsave",1,REDIS_CMD_INLINE},
-    {"rewriteaof",1,REDIS_CMD_INLINE},
-    {"bgrewriteaof",1,REDIS_CMD_INLINE},
-    {"shutdown",1,REDIS_CMD_INLINE},
-    {"lastsave",1,REDIS_CMD_INLINE},
-    {"type",2,REDIS_CMD_INLINE},
-    {"flushdb",1,REDIS_CMD_INLINE},
-    {"flushall",1,REDIS_CMD_INLINE},
-    {"sort",-2,REDIS_CMD_INLINE},
-    {"info",1,REDIS_CMD_INLINE},
-    {"mget",-2,REDIS_CMD_INLINE},
-    {"expire",3,REDIS_CMD_INLINE},
-    {"expireat",3,REDIS_CMD_INLINE},
-    {"ttl",2,REDIS_CMD_INLINE},
-    {"slaveof",3,REDIS_CMD_INLINE},
-    {"debug",-2,REDIS_CMD_INLINE},
-    {"mset",-3,REDIS_CMD_MULTIBULK},
-    {"msetnx",-3,REDIS_CMD_MULTIBULK},
-    {"monitor",1,REDIS_CMD_INLINE},
-    {"multi",1,REDIS_CMD_INLINE},
-    {"exec",1,REDIS_CMD_INLINE},
-    {"discard",1,REDIS_CMD_INLINE},
-    {"hset",4,REDIS_CMD_MULTIBULK},
-    {"hget",3,REDIS_CMD_BULK},
-    {"hdel",3,REDIS_CMD_BULK},
-    {"hlen",2,REDIS_CMD_INLINE},
-    {"hkeys",2,REDIS_CMD_INLINE},
-    {"hvals",2,REDIS_CMD_INLINE},
-    {"hgetall",2,REDIS_CMD_INLINE},
-    {"hexists",3,REDIS_CMD_BULK},
-    {"config",-2,REDIS_CMD_BULK},
-    {NULL,0,0}
-};
+/*
+ * The table of commands and its perfect hash are generated at build time
+ * from commands.def (see gencommands.awk).
+ */
+#include "commands.h"
 
 /* Retrieve the spec of a given Redis command name */
 static struct RedisCmdSpec* _redis_lookupCommandSpec(char *name)
 {
-  int i = 0;
-  while(redisCommandSpecTable[i].name != NULL)
-  {
-    if (!strcasecmp(name,redisCommandSpecTable[i].name)) return &redisCommandSpecTable[i];
-    i++;
-  }
-  return NULL;
+  uint32_t h = REDIS_CMD_HASHSEED;
+  char     *p;
+  int      i;
+
+  for (p = name; *p != '\0'; p++)
+    h = h * 33 + tolower((unsigned char)*p);
+  i = redisCommandSlotTable[(h + (h >> 16)) % REDIS_CMD_SLOTCOUNT];
+  if (i == 0 || strcasecmp(name, redisCommandSpecTable[i - 1].name) != 0)
+    return NULL;
+  return &redisCommandSpecTable[i - 1];
+}
+
+/**
+ * redis_getCommandFlags:
+ * @cmdName: a Redis command name.
+ *
+ * Get what libredis knows about the command @cmdName: whether it only reads
+ * data (%REDIS_COMMAND_READONLY), writes data (%REDIS_COMMAND_WRITE), can
+ * be safely sent again after a failure (%REDIS_COMMAND_IDEMPOTENT) and has a
+ * reply depending only on the value of its key (%REDIS_COMMAND_CACHEABLE).
+ *
+ * Returns: a combination of #RedisCommandFlags or <code>-1</code> if the
+ * command is unknown.
+ **/
+int redis_getCommandFlags(char *cmdName)
+{
+  struct RedisCmdSpec *cmdSpec;
+
+  if ((cmdSpec = _redis_lookupCommandSpec(cmdName)) == NULL) return -1;
+  return cmdSpec->flags;
 }
 
+static int    _redis_flushPipeline(REDIS *redis);
+static void   _redis_freePipeline(REDIS *redis);
+static int    _redis_readMore(REDIS *redis, bstr_t *buf);
+static char*  _redis_replyEnd(char *p, char *end);
+static bstr_t _redis_receiveReplies(REDIS *redis, int count, char **end);
+
 /*
  * Close connection and free memory
  */
 static void _redis_free(REDIS *redis)
 {
   if (redis == NULL) return;
+  _redis_freePipeline(redis);
   close(redis->fd);
-  if (redis->port) free(redis->port);
-  free(redis);
+  if (redis->port) bstr_memFree(redis->port);
+  if (redis->outBuf) bstr_memFree(redis->outBuf);
+  bstr_memFree(redis);
 
 }
 
@@ -439,7 +532,7 @@ REDIS* redis_connect(char *host, char *port)
   void   *addr;
   int    rc;
 
-  redis = (REDIS*) malloc(sizeof(REDIS));
+  redis = (REDIS*) bstr_memAlloc(BSTR_MEM_CONNECTION, sizeof(REDIS));
   if (redis == NULL)
   {
     _redis_setMallocError();
@@ -447,6 +540,18 @@ REDIS* redis_connect(char *host, char *port)
   }
 
   redis->port = NULL;
+  redis->protocolVersion = 2;
+  redis->outBuf = NULL;
+  redis->outBufSize = 0;
+  redis->arena = NULL;
+  redis->pipeline = NULL;
+  redis->waitFunc = NULL;
+  redis->waitData = NULL;
+  redis->cache = NULL;
+  redis->lasterror = REDIS_NOERROR;
+  redis->sysErrno = 0;
+  redis->errorstr = NULL;
+  redis->multiMode = 0;
   servername = host ? host
                     : "127.0.0.1";
   serverport = port ? port
@@ -460,7 +565,7 @@ REDIS* redis_connect(char *host, char *port)
   if ( rc != 0)
   {
     _redis_free(redis);
-    _redis_setCnxError(REDIS_ERROR_CNX_GAI, rc);
+    _redis_setCnxError(NULL, REDIS_ERROR_CNX_GAI, rc);
     return NULL;
   }
 
@@ -474,7 +579,7 @@ REDIS* redis_connect(char *host, char *port)
 
     if (redis->fd == -1)
     {
-      _redis_setCnxError(REDIS_ERROR_CNX_SOCKET, errno);
+      _redis_setCnxError(NULL, REDIS_ERROR_CNX_SOCKET, errno);
       continue;
     }
 
@@ -484,11 +589,11 @@ REDIS* redis_connect(char *host, char *port)
     {
       freeaddrinfo(servinfo);
       _redis_free(redis);
-      _redis_setCnxError(REDIS_ERROR_CNX_SOCKET, errno);
+      _redis_setCnxError(NULL, REDIS_ERROR_CNX_SOCKET, errno);
       return NULL;
     }
     if (connect(redis->fd, p->ai_addr, p->ai_addrlen) == -1)
-      _redis_setCnxError(REDIS_ERROR_CNX_CONNECT, errno);
+      _redis_setCnxError(NULL, REDIS_ERROR_CNX_CONNECT, errno);
     else
       break;
   }
@@ -518,7 +623,7 @@ REDIS* redis_connect(char *host, char *port)
     addr = &(ipv6->sin6_addr);
   }
 
-  redis->port = malloc(sizeof(serverport));
+  redis->port = bstr_memAlloc(BSTR_MEM_CONNECTION, sizeof(serverport));
 
   if (redis->host == NULL || redis->port == NULL)
   {
@@ -538,106 +643,126 @@ REDIS* redis_connect(char *host, char *port)
   return redis;
 }
 
+/* Get a monotonic time in microseconds */
+static long long _redis_nowUsec()
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/*
+ * Wait until the socket of redis is ready for event, or until deadline, with
+ * the wait function of redis or select().
+ * return 1 when ready, 0 on timeout and -1 on error (errno is set).
+ */
+static int _redis_wait(REDIS *redis, RedisWaitEvent event, long long deadline)
+{
+  fd_set         fds;
+  struct timeval tv;
+  long long      left;
+
+  if (redis->waitFunc != NULL)
+    return redis->waitFunc(redis->fd, event, deadline, redis->waitData);
+  left = deadline - _redis_nowUsec();
+  if (left < 0) left = 0;
+  tv.tv_sec  = left / 1000000;
+  tv.tv_usec = left % 1000000;
+  FD_ZERO(&fds);
+  FD_SET(redis->fd, &fds);
+  if (event == REDIS_WAIT_READ)
+    return select(redis->fd+1, &fds, NULL, NULL, &tv);
+  return select(redis->fd+1, NULL, &fds, NULL, &tv);
+}
+
+/* Tell whether a failed send/recv only means the socket is not ready yet */
+#define REDIS_WOULDBLOCK(err) \
+  ((err) == EAGAIN || (err) == EWOULDBLOCK || (err) == EINTR)
+
 /*
- * Send data to Redis server
+ * Send len bytes of data to Redis server
  * return :
  *    - REDIS_ERROR_CNX_SEND on error.
  *    - REDIS_ERROR_CNX_TIMEOUT on timeout.
  *    - REDIS_NOERROR on success.
  */
-static int _redis_send(REDIS *redis, bstr_t data)
+static int _redis_sendBuf(REDIS *redis, char *data, size_t len)
 {
-  size_t sent;
-  size_t n;
-  fd_set fds;
-  struct timeval tv;
-  int     rc;
+  size_t    sent;
+  ssize_t   n;
+  long long deadline;
+  int       rc;
+
+  if (_redis_flushPipeline(redis) != REDIS_NOERROR) return redis_errCode;
 
   /*
-   * timeval is set to 10sec.
+   * The whole send has 10sec.
    * I think it's useless to give the user the possibility to specify this value.
    */
-  tv.tv_sec = 10;
-  tv.tv_usec = 0;
+  deadline = _redis_nowUsec() + REDIS_IO_TIMEOUT;
   sent = 0;
   rc = 0;
 
-  while (sent < bstr_len(data))
+  while (sent < len)
   {
-    FD_ZERO(&fds);
-    FD_SET(redis->fd, &fds);
-    rc = select(redis->fd+1, NULL, &fds, NULL, &tv);
+    rc = _redis_wait(redis, REDIS_WAIT_WRITE, deadline);
     if (rc <= 0) break;
-    n = send(redis->fd, (char *)data + sent, bstr_len(data)-sent, 0);
-    if (n == -1) return _redis_setCnxError(REDIS_ERROR_CNX_SEND, errno);
+    n = send(redis->fd, data + sent, len - sent, 0);
+    if (n == -1 && REDIS_WOULDBLOCK(errno)) continue;
+    if (n == -1) return _redis_setCnxError(redis, REDIS_ERROR_CNX_SEND, errno);
     sent += n;
   }
-  if (rc == 0)  return _redis_setCnxError(REDIS_ERROR_CNX_TIMEOUT, 0);
-  if (rc == -1) return _redis_setCnxError(REDIS_ERROR_CNX_SEND, errno);
+  if (rc == 0)  return _redis_setCnxError(redis, REDIS_ERROR_CNX_TIMEOUT, 0);
+  if (rc == -1) return _redis_setCnxError(redis, REDIS_ERROR_CNX_SEND, errno);
   return REDIS_NOERROR;
 }
 
 /*
- * Receive data from Redis server
- *
- * return NULL on error and set redis_errCode accordingly.
+ * Send a bstring to Redis server
+ * return the same as _redis_sendBuf().
  */
-static bstr_t _redis_receive(REDIS *redis)
+static int _redis_send(REDIS *redis, bstr_t data)
 {
-  char buffer[MAXDATASIZE];
-  bstr_t data = NULL;
-  int n;
-  fd_set fds;
-  struct timeval tv;
-  int rc;
+  return _redis_sendBuf(redis, (char *)data, bstr_len(data));
+}
 
-  /*
-   * timeval is set to 10sec.
-   * I think it's useless to give the user the possibility to specify this value.
-   */
-  tv.tv_sec = 10;
-  tv.tv_usec = 0;
+/*
+ * Send a vector of buffers to Redis server. The iovec entries are consumed
+ * (modified) as data is written.
+ * return the same as _redis_sendBuf().
+ */
+static int _redis_sendIov(REDIS *redis, struct iovec *iov, int iovCount)
+{
+  ssize_t   n;
+  long long deadline;
+  int       rc;
 
-  /*init data*/
-  data = bstr_new(NULL, 0);
-  if (data == NULL)
-  {
-    _redis_setMallocError();
-    return NULL;
-  }
+  if (_redis_flushPipeline(redis) != REDIS_NOERROR) return redis_errCode;
 
-  while (1)
+  deadline = _redis_nowUsec() + REDIS_IO_TIMEOUT;
+  while (iovCount > 0)
   {
-    /* Prepare the file description */
-    FD_ZERO(&fds);
-    FD_SET(redis->fd, &fds);
-    rc = select(redis->fd+1, &fds, NULL, NULL, &tv);
-    if (rc <= 0)
-    {
-      (rc == 0) ? _redis_setCnxError(REDIS_ERROR_CNX_TIMEOUT, 0)
-                : _redis_setCnxError(REDIS_ERROR_CNX_RECEIVE, errno);
-      free(data);
-      return NULL;
-    }
-
-    /* Reveive data */
-    n = recv(redis->fd, buffer, MAXDATASIZE, 0);
-    if (n == -1)
+    rc = _redis_wait(redis, REDIS_WAIT_WRITE, deadline);
+    if (rc == 0)  return _redis_setCnxError(redis, REDIS_ERROR_CNX_TIMEOUT, 0);
+    if (rc == -1) return _redis_setCnxError(redis, REDIS_ERROR_CNX_SEND, errno);
+    n = writev(redis->fd, iov, (iovCount < IOV_MAX) ? iovCount : IOV_MAX);
+    if (n == -1 && REDIS_WOULDBLOCK(errno)) continue;
+    if (n == -1) return _redis_setCnxError(redis, REDIS_ERROR_CNX_SEND, errno);
+    /* Skip what was written, a partially written buffer is adjusted */
+    while (iovCount > 0 && (size_t)n >= iov->iov_len)
     {
-      _redis_setCnxError(REDIS_ERROR_CNX_RECEIVE, errno);
-      free(data);
-      return NULL;
+      n -= iov->iov_len;
+      iov++;
+      iovCount--;
     }
-    if (n ==  0) return data;
-    data = bstr_cat(data, buffer, n);
-    if (data == NULL)
+    if (iovCount > 0)
     {
-      _redis_setMallocError();
-      return NULL;
+      iov->iov_base = (char *)iov->iov_base + n;
+      iov->iov_len -= n;
     }
-    if (n < MAXDATASIZE) return data;
   }
-  return NULL;
+  return REDIS_NOERROR;
 }
 
 /**
@@ -652,28 +777,23 @@ void redis_close(REDIS *redis)
   _redis_free(redis);
 }
 
-/**
- * redisCmd_new:
- * @protocolType: type of protocol to use.
- * @cmdName: Redis command or <code>NULL</code>.
- *
- * Create a new command structure for cmdName according to @protocolType protocol.
- * If cmdName is <code>NULL</code>, build an empty command structure.
- * <note>
- * %REDIS_PROTOCOL_OLD specify the protocol used in early versions of Redis and
- * will probably be deprecated. Starting from version 1.1, it is recommended to
- * use %REDIS_PROTOCOL_MULTIBULK.
- * </note>
- *
- * Returns: the newly allocated #RedisCmd structure or <code>NULL</code> on error (and
- * <code>redis_errCode</code> will hold the error code).
- **/
-RedisCmd* redisCmd_new(RedisProtocolType protocolType, char *cmdName)
+/*
+ * Create a command for cmdName, allocated from arena if not NULL.
+ * return the command or NULL on error and redis_errCode is set.
+ */
+static RedisCmd* _redisCmd_alloc(bstr_arena_t *arena,
+                                 RedisProtocolType protocolType,
+                                 char *cmdName)
 {
   RedisCmd *ret;
   struct RedisCmdSpec *redis_cmd;
 
-  ret = (RedisCmd *)malloc(sizeof(RedisCmd));
+  /* Commands of an arena are cheap to build already, they have no inline args */
+  if (arena != NULL) ret = (RedisCmd *)bstr_arenaAlloc(arena, sizeof(RedisCmd));
+  else               ret = (RedisCmd *)bstr_memAlloc(BSTR_MEM_COMMAND,
+                                 sizeof(RedisCmd)
+                                 + REDIS_CMD_INLINE_ARGS * sizeof(bstr_t)
+                                 + REDIS_CMD_INLINE_SIZE);
   if (ret == NULL)
   {
     _redis_setMallocError();
@@ -681,9 +801,20 @@ RedisCmd* redisCmd_new(RedisProtocolType protocolType, char *cmdName)
   }
   ret->protocolType   = protocolType;
   ret->argsCount      = 0;
+  ret->argsSize       = 0;
   ret->args           = NULL;
   ret->protocolString = NULL;
   ret->returnValue    = NULL;
+  ret->arena          = arena;
+  ret->inlineBuf      = NULL;
+  ret->inlineUsed     = 0;
+  if (arena == NULL)
+  {
+    ret->args      = REDIS_CMD_INLINEARGS(ret);
+    ret->argsSize  = REDIS_CMD_INLINE_ARGS;
+    memset(ret->args, 0, REDIS_CMD_INLINE_ARGS * sizeof(bstr_t));
+    ret->inlineBuf = (char *)(ret->args + REDIS_CMD_INLINE_ARGS);
+  }
 
   if (cmdName == NULL) return ret;
 
@@ -698,22 +829,55 @@ RedisCmd* redisCmd_new(RedisProtocolType protocolType, char *cmdName)
     }
   }
 
-  ret->argsCount++;
-  ret->args = (bstr_t *)realloc(ret->args, ret->argsCount * sizeof(bstr_t));
-  if (ret->args == NULL)
-  {
-    _redis_setMallocError();
-    redisCmd_free(ret);
-    return NULL;
-  }
-  if ((ret->args[ret->argsCount - 1] = bstr_newFromCStr(cmdName)) == NULL)
+  if (redisCmd_addArg(ret, cmdName, strlen(cmdName)) != REDIS_NOERROR)
   {
-    _redis_setMallocError();
     redisCmd_free(ret);
     return NULL;
   }
   return ret;
+}
+
+/**
+ * redisCmd_new:
+ * @protocolType: type of protocol to use.
+ * @cmdName: Redis command or <code>NULL</code>.
+ *
+ * Create a new command structure for cmdName according to @protocolType protocol.
+ * If cmdName is <code>NULL</code>, build an empty command structure.
+ * <note>
+ * %REDIS_PROTOCOL_OLD specify the protocol used in early versions of Redis and
+ * will probably be deprecated. Starting from version 1.1, it is recommended to
+ * use %REDIS_PROTOCOL_MULTIBULK.
+ * </note>
+ *
+ * Returns: the newly allocated #RedisCmd structure or <code>NULL</code> on error (and
+ * <code>redis_errCode</code> will hold the error code).
+ **/
+RedisCmd* redisCmd_new(RedisProtocolType protocolType, char *cmdName)
+{
+  return _redisCmd_alloc(NULL, protocolType, cmdName);
+}
 
+/**
+ * redisCmd_newInArena:
+ * @arena: the arena to allocate the command from.
+ * @protocolType: type of protocol to use.
+ * @cmdName: Redis command or <code>NULL</code>.
+ *
+ * Same as redisCmd_new() but the command, its args and its protocol string
+ * are allocated from @arena, which makes building short-lived commands cheap.
+ * redisCmd_free() only frees the return value of such a command, the rest is
+ * released with @arena, so the command must not be used after
+ * bstr_arenaReset() or bstr_arenaFree() is called on @arena.
+ *
+ * Returns: the newly allocated #RedisCmd structure or <code>NULL</code> on error (and
+ * <code>redis_errCode</code> will hold the error code).
+ **/
+RedisCmd* redisCmd_newInArena(bstr_arena_t *arena,
+                              RedisProtocolType protocolType,
+                              char *cmdName)
+{
+  return _redisCmd_alloc(arena, protocolType, cmdName);
 }
 
 /*
@@ -733,7 +897,8 @@ static RedisCmd* _redisCmd_newFromSqlString(RedisProtocolType protocol,
 
   str    = (char *)bstr;
   len    = bstr_len(bstr);
-  arg    = (char*)calloc(len+1, sizeof(char)); /* Temp buffer to hold an arg */
+  /* Temp buffer to hold an arg */
+  arg    = (char*)bstr_memCalloc(BSTR_MEM_OTHER, len+1, sizeof(char));
   strEnd = str + len;                          /* The end of the string      */
   /*arg    = bstr_new(NULL, 0);*/
   ret    = redisCmd_new(protocol, NULL);   /* Construct a command struct */
@@ -765,7 +930,7 @@ static RedisCmd* _redisCmd_newFromSqlString(RedisProtocolType protocol,
       if (redisCmd_addArg(ret, arg, arglen) != REDIS_NOERROR)
       {
         redisCmd_free(ret);
-        free(arg);
+        bstr_memFree(arg);
         return NULL;
       }
       /* begin a new arg */
@@ -787,7 +952,7 @@ static RedisCmd* _redisCmd_newFromSqlString(RedisProtocolType protocol,
     {
       _redis_setSrvError(REDIS_ERROR_CMD_UNBALANCEDQ);
       redisCmd_free(ret);
-      free(arg);
+      bstr_memFree(arg);
       return NULL;
     }
     /* append the current char to the buffer and loop */
@@ -795,7 +960,7 @@ static RedisCmd* _redisCmd_newFromSqlString(RedisProtocolType protocol,
     arglen++;
     str++;
   }
-  free(arg);
+  bstr_memFree(arg);
   return ret;
 }
 
@@ -846,185 +1011,703 @@ RedisCmd* redisCmd_newFromStr(RedisProtocolType protocolType,
   return ret;
 }
 
-/**
- * redisCmd_addArg:
- * @cmd: #RedisCmd to add @arg to.
- * @arg: the arg to add.
- * @arglen: length of @arg.
- *
- * Add the argument @arg of length @arglen to an existing #RedisCmd structure.
- * if @arglen is <code>-1</code>, <code>strlen</code> is used to get the length
- * of @arg.
- * Returns: %REDIS_NOERROR if all is ok, else the error code corresponding to
- * the error.
- **/
-RedisErrorCode redisCmd_addArg(RedisCmd *cmd, char *arg, size_t arglen)
-{
-  if (cmd == NULL) return _redis_setSrvError(REDIS_ERROR_CMD_INVALID);
-  if (arg == NULL) return _redis_setSrvError(REDIS_ERROR_CMD_ARGS);
-
-  cmd->argsCount++;
-  cmd->args = (bstr_t *)realloc(cmd->args, cmd->argsCount * sizeof(bstr_t));
-  if (cmd->args == NULL)
-    return _redis_setMallocError();
-  if ((cmd->args[cmd->argsCount - 1] = bstr_new(arg, arglen)) == NULL)
-    return _redis_setMallocError();
-  return REDIS_NOERROR;
-}
+/* Pairs of decimal digits, "00" to "99" */
+static const char _redis_digitPairs[201] =
+  "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+  "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+  "8081828384858687888990919293949596979899";
 
-/**
- * redisCmd_free:
- * @cmd: #RedisCmd to free.
- *
- * Free the memory allocated to @cmd. It is advised to call redisCmd_free() on
- * #RedisCmd structures no longer used.
- */
-void redisCmd_free(RedisCmd *cmd)
+/* Number of decimal digits of n */
+static size_t _redis_numLen(size_t n)
 {
-  int i;
-  if (cmd == NULL) return;
-  if(cmd->protocolString != NULL) bstr_free(cmd->protocolString);
-  if(cmd->returnValue != NULL)    redisRetVal_free(cmd->returnValue);
-  if (cmd->args != NULL)
+  size_t len = 1;
+
+  while (n >= 10000)
   {
-    for(i = 0; i < cmd->argsCount; i++)
-      if (cmd->args[i] != NULL) bstr_free(cmd->args[i]);
-    free(cmd->args);
+    n /= 10000;
+    len += 4;
   }
-  free(cmd);
+  if (n >= 1000) return len + 3;
+  if (n >= 100)  return len + 2;
+  if (n >= 10)   return len + 1;
+  return len;
 }
 
 /*
- * Duplicate a RedisCmd.
+ * Write the decimal representation of n at p, two digits at a time.
+ * return a pointer past the last digit.
  */
-RedisCmd* _redisCmd_dup(RedisCmd *cmd)
+static char* _redis_writeNum(char *p, size_t n)
 {
-  RedisCmd *ret;
-  int i;
-  ret = redisCmd_new(cmd->protocolType, NULL);
-  if (ret == NULL) return NULL;
-  for (i = 0; i<cmd->argsCount; i++)
+  char   *end;
+  size_t d;
+
+  end = p + _redis_numLen(n);
+  p = end;
+  while (n >= 100)
   {
-    int rc;
-    rc = redisCmd_addArg(ret, (char *)cmd->args[i], bstr_len(cmd->args[i]));
-    if (rc != REDIS_NOERROR)
-    {
-      redisCmd_free(ret);
-      return NULL;
-    }
+    d = (n % 100) * 2;
+    n /= 100;
+    *--p = _redis_digitPairs[d + 1];
+    *--p = _redis_digitPairs[d];
   }
-  if (redisCmd_buildProtocolStr(ret) == NULL)
+  if (n >= 10)
   {
-    redisCmd_free(ret);
-    return NULL;
+    *--p = _redis_digitPairs[n * 2 + 1];
+    *--p = _redis_digitPairs[n * 2];
   }
-  return ret;
+  else *--p = '0' + n;
+  return end;
+}
+
+/* Magnitude of a signed 64 bits integer, INT64_MIN included */
+static uint64_t _redis_int64Abs(int64_t n)
+{
+  return (n < 0) ? -(uint64_t)n : (uint64_t)n;
 }
+
 /*
- * Generate a multibulk command.
- * return the generated command according to Redis protocol or NULL on error.
+ * Write at buf (32 bytes at least) the shortest representation of value that
+ * converts back to exactly value. Infinities are written "inf" and "-inf".
+ * return the length written or -1 if value is NaN.
  */
-static bstr_t _redisCmd_genMultiBulk (RedisCmd *cmd)
+static int _redis_formatDouble(char *buf, double value)
 {
-  bstr_t  *args;
-  int     rc, i;
+  int precision, len;
 
-  args = cmd->args;
-  rc = bstr_asprintf(&cmd->protocolString, "*%d\r\n", cmd->argsCount);
-  if (rc < 0)
+  if (isnan(value)) return -1;
+  if (isinf(value)) return sprintf(buf, (value < 0) ? "-inf" : "inf");
+  if (value > -1e15 && value < 1e15 && value == (int64_t)value)
   {
-    _redis_setMallocError();
-    return NULL;
+    len = (value < 0);
+    if (len) *buf = '-';
+    return _redis_writeNum(buf + len, _redis_int64Abs((int64_t)value)) - buf;
   }
-  for (i=0; i < cmd->argsCount; i++)
+  /*
+   * 17 significant digits always round-trip. A normal double with a shorter
+   * representation is printed exactly by %.15g (DBL_DIG), so only 15 to 17
+   * digits need to be tried; subnormals have less precision.
+   */
+  precision = (fabs(value) < DBL_MIN) ? 1 : DBL_DIG;
+  for (; precision < 17; precision++)
   {
-    rc = bstr_scatprintf(&cmd->protocolString, "$%lu\r\n%B\r\n", bstr_len(args[i]), args[i]);
-    if (rc < 0)
-    {
-      _redis_setMallocError();
-      return NULL;
-    }
+    len = snprintf(buf, 32, "%.*g", precision, value);
+    if (strtod(buf, NULL) == value) return len;
   }
-  return cmd->protocolString;
+  return snprintf(buf, 32, "%.17g", value);
 }
 
 /*
- * Generate a bulk command.
- * return the generated command according to Redis protocol or NULL on error.
+ * Make room for at least size args in cmd. Entries past argsCount are either
+ * NULL or strings kept by redisCmd_reset() for reuse.
+ * return REDIS_NOERROR or the error code.
  */
-static bstr_t _redisCmd_genBulk (RedisCmd *cmd)
+static int _redisCmd_reserveArgs(RedisCmd *cmd, int size)
 {
   bstr_t *args;
-  int     rc, i;
 
-  args = cmd->args;
-  for (i=0; i < cmd->argsCount - 1; i++)
+  if (size <= cmd->argsSize) return REDIS_NOERROR;
+  if (cmd->arena != NULL || cmd->args == REDIS_CMD_INLINEARGS(cmd))
   {
-    rc = bstr_scatprintf(&cmd->protocolString, "%B ", args[i]);
-    if (rc < 0)
-    {
-      _redis_setMallocError();
-      return NULL;
-    }
+    /* Neither the arena nor the inline args array can be reallocated */
+    if (cmd->arena != NULL)
+      args = (bstr_t *)bstr_arenaAlloc(cmd->arena, size * sizeof(bstr_t));
+    else
+      args = (bstr_t *)bstr_memAlloc(BSTR_MEM_COMMAND, size * sizeof(bstr_t));
+    if (args == NULL) return _redis_setMallocError();
+    if (cmd->argsSize > 0)
+      memcpy(args, cmd->args, cmd->argsSize * sizeof(bstr_t));
   }
+  else
+    args = (bstr_t *)bstr_memRealloc(BSTR_MEM_COMMAND, cmd->args, size * sizeof(bstr_t));
+  if (args == NULL) return _redis_setMallocError();
+  memset(args + cmd->argsSize, 0, (size - cmd->argsSize) * sizeof(bstr_t));
+  cmd->args     = args;
+  cmd->argsSize = size;
+  return REDIS_NOERROR;
+}
+
+/*
+ * Allocate a string of len bytes for cmd, in its arena if it has one.
+ * Its content is left for the caller to fill.
+ */
+static bstr_t _redisCmd_newStr(RedisCmd *cmd, size_t len)
+{
+  if (cmd->arena != NULL) return bstr_newInArena(cmd->arena, NULL, len);
+  return bstr_setLen(NULL, len);
+}
 
-  rc = bstr_scatprintf(&cmd->protocolString, "%lu\r\n%B\r\n",
-                       bstr_len(args[cmd->argsCount - 1]),
-                       args[cmd->argsCount - 1]);
-  if (rc < 0)
+/* The protocol string of cmd no longer matches its args */
+static void _redisCmd_dropProtocolStr(RedisCmd *cmd)
+{
+  if (cmd->protocolString != NULL)
   {
-    _redis_setMallocError();
-    return NULL;
+    bstr_free(cmd->protocolString);
+    cmd->protocolString = NULL;
   }
-  return cmd->protocolString;
 }
 
 /*
- * Generate a bulk command.
- * return the generated command according to Redis protocol or NULL on error.
+ * Append an arg of len bytes to cmd, left for the caller to fill.
+ * return a pointer to the content of the arg or NULL on error and
+ * redis_errCode is set.
  */
-static bstr_t _redisCmd_genInline (RedisCmd *cmd)
+static char* _redisCmd_newArg(RedisCmd *cmd, size_t len)
 {
-  bstr_t  *args;
-  int     rc, i;
+  bstr_t arg;
 
-  args = cmd->args;
-  for (i=0; i < cmd->argsCount; i++)
+  if (cmd->argsCount == cmd->argsSize &&
+      _redisCmd_reserveArgs(cmd, cmd->argsSize ? cmd->argsSize * 2 : 4)
+        != REDIS_NOERROR)
+    return NULL;
+  /* Reuse the string left in this slot by redisCmd_reset(), if any */
+  arg = cmd->args[cmd->argsCount];
+  if (arg != NULL)
+    arg = bstr_setLen(arg, len);
+  else if (cmd->inlineBuf != NULL && len <= REDIS_CMD_INLINE_ARGLEN &&
+           bstr_inBufferSize(len) <= REDIS_CMD_INLINE_SIZE - cmd->inlineUsed)
+  {
+    arg = bstr_newInBuffer(cmd->inlineBuf + cmd->inlineUsed, NULL, len);
+    cmd->inlineUsed += bstr_inBufferSize(len);
+  }
+  else
+    arg = _redisCmd_newStr(cmd, len);
+  if (arg == NULL)
+  {
+    _redis_setMallocError();
+    return NULL;
+  }
+  cmd->args[cmd->argsCount++] = arg;
+  _redisCmd_dropProtocolStr(cmd);
+  return (char *)arg;
+}
+
+/**
+ * redisCmd_addArg:
+ * @cmd: #RedisCmd to add @arg to.
+ * @arg: the arg to add.
+ * @arglen: length of @arg.
+ *
+ * Add the argument @arg of length @arglen to an existing #RedisCmd structure.
+ * if @arglen is <code>-1</code>, <code>strlen</code> is used to get the length
+ * of @arg.
+ * Returns: %REDIS_NOERROR if all is ok, else the error code corresponding to
+ * the error.
+ **/
+RedisErrorCode redisCmd_addArg(RedisCmd *cmd, char *arg, size_t arglen)
+{
+  char *p;
+
+  if (cmd == NULL) return _redis_setSrvError(REDIS_ERROR_CMD_INVALID);
+  if (arg == NULL) return _redis_setSrvError(REDIS_ERROR_CMD_ARGS);
+  if (arglen == -1) arglen = strlen(arg);
+
+  if ((p = _redisCmd_newArg(cmd, arglen)) == NULL) return redis_errCode;
+  memcpy(p, arg, arglen);
+  return REDIS_NOERROR;
+}
+
+/**
+ * redisCmd_addArgRef:
+ * @cmd: #RedisCmd to add @arg to.
+ * @arg: the bstring to add.
+ *
+ * Add @arg as an argument of @cmd, taking a reference to it with bstr_ref()
+ * instead of copying it. When @arg is shared (see bstr_newShared()), the same
+ * bytes can be added to any number of commands, and to the #RedisCmdArray
+ * they join, without being copied.
+ *
+ * Returns: %REDIS_NOERROR if all is ok, else the error code corresponding to
+ * the error.
+ **/
+RedisErrorCode redisCmd_addArgRef(RedisCmd *cmd, bstr_t arg)
+{
+  bstr_t ref;
+
+  if (cmd == NULL) return _redis_setSrvError(REDIS_ERROR_CMD_INVALID);
+  if (arg == NULL) return _redis_setSrvError(REDIS_ERROR_CMD_ARGS);
+
+  if (cmd->argsCount == cmd->argsSize &&
+      _redisCmd_reserveArgs(cmd, cmd->argsSize ? cmd->argsSize * 2 : 4)
+        != REDIS_NOERROR)
+    return redis_errCode;
+  if ((ref = bstr_ref(arg)) == NULL) return _redis_setMallocError();
+  /* The string left in this slot by redisCmd_reset() is not needed */
+  bstr_free(cmd->args[cmd->argsCount]);
+  cmd->args[cmd->argsCount++] = ref;
+  _redisCmd_dropProtocolStr(cmd);
+  return REDIS_NOERROR;
+}
+
+/**
+ * redisCmd_addArgInt64:
+ * @cmd: #RedisCmd to add the arg to.
+ * @value: the integer to add.
+ *
+ * Add @value, in decimal, as an argument of @cmd. The digits are written
+ * directly in the new argument, without formatting @value to a string first.
+ *
+ * Returns: %REDIS_NOERROR if all is ok, else the error code corresponding to
+ * the error.
+ **/
+RedisErrorCode redisCmd_addArgInt64(RedisCmd *cmd, int64_t value)
+{
+  uint64_t magnitude;
+  size_t   len;
+  char     *p;
+
+  if (cmd == NULL) return _redis_setSrvError(REDIS_ERROR_CMD_INVALID);
+
+  magnitude = _redis_int64Abs(value);
+  len = _redis_numLen(magnitude) + (value < 0);
+  if ((p = _redisCmd_newArg(cmd, len)) == NULL) return redis_errCode;
+  if (value < 0) *p++ = '-';
+  _redis_writeNum(p, magnitude);
+  return REDIS_NOERROR;
+}
+
+/**
+ * redisCmd_addArgDouble:
+ * @cmd: #RedisCmd to add the arg to.
+ * @value: the double to add.
+ *
+ * Add @value as an argument of @cmd, using the shortest representation that
+ * converts back to exactly @value (so <code>0.1</code> is sent as "0.1", not
+ * "0.10000000000000001"). Infinities are sent as "inf" and "-inf", as
+ * understood by ZADD and ZRANGEBYSCORE.
+ *
+ * Returns: %REDIS_NOERROR if all is ok, else the error code corresponding to
+ * the error (%REDIS_ERROR_CMD_ARGS if @value is NaN).
+ **/
+RedisErrorCode redisCmd_addArgDouble(RedisCmd *cmd, double value)
+{
+  char buf[32];
+  int  len;
+  char *p;
+
+  if (cmd == NULL) return _redis_setSrvError(REDIS_ERROR_CMD_INVALID);
+  if ((len = _redis_formatDouble(buf, value)) < 0)
+    return _redis_setSrvError(REDIS_ERROR_CMD_ARGS);
+
+  if ((p = _redisCmd_newArg(cmd, len)) == NULL) return redis_errCode;
+  memcpy(p, buf, len);
+  return REDIS_NOERROR;
+}
+
+/**
+ * redisCmd_free:
+ * @cmd: #RedisCmd to free.
+ *
+ * Free the memory allocated to @cmd. It is advised to call redisCmd_free() on
+ * #RedisCmd structures no longer used.
+ */
+void redisCmd_free(RedisCmd *cmd)
+{
+  int i;
+  if (cmd == NULL) return;
+  if(cmd->returnValue != NULL)    redisRetVal_free(cmd->returnValue);
+  if(cmd->protocolString != NULL) bstr_free(cmd->protocolString);
+  /* bstr_free() does nothing on args stored in an arena or inline */
+  for(i = 0; i < cmd->argsSize; i++)
+    if (cmd->args[i] != NULL) bstr_free(cmd->args[i]);
+  /* The rest of a command allocated from an arena is released with it */
+  if (cmd->arena != NULL) return;
+  if (cmd->args != REDIS_CMD_INLINEARGS(cmd)) bstr_memFree(cmd->args);
+  bstr_memFree(cmd);
+}
+
+/*
+ * Duplicate a RedisCmd.
+ */
+RedisCmd* _redisCmd_dup(RedisCmd *cmd)
+{
+  RedisCmd *ret;
+  int i;
+  ret = redisCmd_new(cmd->protocolType, NULL);
+  if (ret == NULL) return NULL;
+  for (i = 0; i<cmd->argsCount; i++)
   {
-    rc = bstr_scatprintf(&cmd->protocolString, "%B ", args[i]);
-    if (rc < 0)
+    int rc;
+    /* Shared args are referenced, not copied */
+    if (bstr_isShared(cmd->args[i]))
+      rc = redisCmd_addArgRef(ret, cmd->args[i]);
+    else
+      rc = redisCmd_addArg(ret, (char *)cmd->args[i], bstr_len(cmd->args[i]));
+    if (rc != REDIS_NOERROR)
     {
-      _redis_setMallocError();
+      redisCmd_free(ret);
       return NULL;
     }
   }
-  rc = bstr_scatprintf(&cmd->protocolString, "\r\n");
-  if (rc < 0)
+  /*
+   * Multibulk commands are encoded lazily, straight into the pipeline string
+   * (see redisCmdArray_buildProtocolStr()).
+   */
+  if (ret->protocolType != REDIS_PROTOCOL_MULTIBULK &&
+      redisCmd_buildProtocolStr(ret) == NULL)
+  {
+    redisCmd_free(ret);
+    return NULL;
+  }
+  return ret;
+}
+
+/* Size of the multibulk encoding of cmd */
+static size_t _redisCmd_multiBulkSize(RedisCmd *cmd)
+{
+  size_t size, len;
+  int    i;
+
+  /* "*<argc>\r\n" then "$<len>\r\n<arg>\r\n" for each arg */
+  size = 1 + _redis_numLen(cmd->argsCount) + 2;
+  for (i=0; i < cmd->argsCount; i++)
+  {
+    len = bstr_len(cmd->args[i]);
+    size += 1 + _redis_numLen(len) + 2 + len + 2;
+  }
+  return size;
+}
+
+/*
+ * Write the multibulk encoding of cmd at p, which must hold
+ * _redisCmd_multiBulkSize() bytes.
+ * return a pointer past the encoded command.
+ */
+static char* _redisCmd_writeMultiBulk(RedisCmd *cmd, char *p)
+{
+  size_t len;
+  int    i;
+
+  *p++ = '*';
+  p = _redis_writeNum(p, cmd->argsCount);
+  *p++ = '\r'; *p++ = '\n';
+  for (i=0; i < cmd->argsCount; i++)
+  {
+    len = bstr_len(cmd->args[i]);
+    *p++ = '$';
+    p = _redis_writeNum(p, len);
+    *p++ = '\r'; *p++ = '\n';
+    memcpy(p, cmd->args[i], len);
+    p += len;
+    *p++ = '\r'; *p++ = '\n';
+  }
+  return p;
+}
+
+/*
+ * Generate a multibulk command.
+ * The exact size of the protocol string is computed first, so it is written
+ * in a single allocation without intermediate copies.
+ * return the generated command according to Redis protocol or NULL on error.
+ */
+static bstr_t _redisCmd_genMultiBulk (RedisCmd *cmd)
+{
+  /* Every byte is written below, so the string is not cleared first */
+  cmd->protocolString = _redisCmd_newStr(cmd, _redisCmd_multiBulkSize(cmd));
+  if (cmd->protocolString == NULL)
+  {
+    _redis_setMallocError();
+    return NULL;
+  }
+  _redisCmd_writeMultiBulk(cmd, (char *)cmd->protocolString);
+  return cmd->protocolString;
+}
+
+/*
+ * Generate a bulk command.
+ * return the generated command according to Redis protocol or NULL on error.
+ */
+static bstr_t _redisCmd_genBulk (RedisCmd *cmd)
+{
+  bstr_t  *args;
+  size_t  size, len;
+  char    *p;
+  int     i;
+
+  args = cmd->args;
+  /* "<arg> " for all args but the last one, then "<len>\r\n<arg>\r\n" */
+  size = 0;
+  for (i=0; i < cmd->argsCount - 1; i++)
+    size += bstr_len(args[i]) + 1;
+  len = bstr_len(args[cmd->argsCount - 1]);
+  size += _redis_numLen(len) + 2 + len + 2;
+  cmd->protocolString = _redisCmd_newStr(cmd, size);
+  if (cmd->protocolString == NULL)
+  {
+    _redis_setMallocError();
+    return NULL;
+  }
+
+  p = (char *)cmd->protocolString;
+  for (i=0; i < cmd->argsCount - 1; i++)
+  {
+    memcpy(p, args[i], bstr_len(args[i]));
+    p += bstr_len(args[i]);
+    *p++ = ' ';
+  }
+  p = _redis_writeNum(p, len);
+  *p++ = '\r'; *p++ = '\n';
+  memcpy(p, args[cmd->argsCount - 1], len);
+  p += len;
+  *p++ = '\r'; *p++ = '\n';
+  return cmd->protocolString;
+}
+
+/*
+ * Generate an inline command.
+ * return the generated command according to Redis protocol or NULL on error.
+ */
+static bstr_t _redisCmd_genInline (RedisCmd *cmd)
+{
+  bstr_t  *args;
+  size_t  size;
+  char    *p;
+  int     i;
+
+  args = cmd->args;
+  /* "<arg> " for each arg then "\r\n" */
+  size = 2;
+  for (i=0; i < cmd->argsCount; i++)
+    size += bstr_len(args[i]) + 1;
+  cmd->protocolString = _redisCmd_newStr(cmd, size);
+  if (cmd->protocolString == NULL)
   {
     _redis_setMallocError();
     return NULL;
   }
+
+  p = (char *)cmd->protocolString;
+  for (i=0; i < cmd->argsCount; i++)
+  {
+    memcpy(p, args[i], bstr_len(args[i]));
+    p += bstr_len(args[i]);
+    *p++ = ' ';
+  }
+  *p++ = '\r'; *p++ = '\n';
   return cmd->protocolString;
 }
 
+/*
+ * Freelists of reply bookkeeping.
+ *
+ * Every thread keeps the RedisRetVal structures and the element arrays
+ * (bstr_t or RedisRetVal pointers) released by redisRetVal_free() and hands
+ * them back to the parsers, so a steady command loop doesn't go through
+ * malloc/free for them. Arrays are grouped in power of two size classes
+ * and the retained memory is capped by _redis_poolLimit.
+ */
+#define REDIS_POOL_CLASSES 16   /* Arrays of up to 1 << 15 elements */
+
+typedef struct
+{
+  RedisRetVal *retVals;                    /* Linked through ->attributes   */
+  void        **arrays[REDIS_POOL_CLASSES];/* Linked through their 1st slot */
+  size_t      retained;                    /* Bytes kept in the freelists   */
+} RedisPool;
+
+static __thread RedisPool *_redis_pool = NULL;
+static pthread_key_t      _redis_poolKey;
+static pthread_once_t     _redis_poolOnce = PTHREAD_ONCE_INIT;
+static volatile size_t    _redis_poolLimit = 1024 * 1024;
+
+/*
+ * Arena of the connection whose reply is being parsed by this thread (see
+ * redis_setArena()). While it is set, reply structures, element arrays and
+ * strings are allocated from it instead of the pool and malloc.
+ */
+static __thread bstr_arena_t *_redis_replyArena = NULL;
+
+/* Release everything kept by a pool */
+static void _redisPool_release(RedisPool *pool)
+{
+  RedisRetVal *rv;
+  void        **array;
+  int         i;
+
+  while ((rv = pool->retVals) != NULL)
+  {
+    pool->retVals = rv->attributes;
+    bstr_memFree(rv);
+  }
+  for (i = 0; i < REDIS_POOL_CLASSES; i++)
+    while ((array = pool->arrays[i]) != NULL)
+    {
+      pool->arrays[i] = (void **)array[0];
+      bstr_memFree(array);
+    }
+  pool->retained = 0;
+}
+
+/* Called when a thread exits */
+static void _redisPool_destroy(void *pool)
+{
+  _redisPool_release((RedisPool *)pool);
+  bstr_memFree(pool);
+  _redis_pool = NULL;
+}
+
+static void _redisPool_initKey()
+{
+  pthread_key_create(&_redis_poolKey, _redisPool_destroy);
+}
+
+/* Get the pool of the calling thread, NULL if it can't be created */
+static RedisPool* _redisPool_get()
+{
+  if (_redis_pool != NULL) return _redis_pool;
+  pthread_once(&_redis_poolOnce, _redisPool_initKey);
+  _redis_pool = (RedisPool *)bstr_memCalloc(BSTR_MEM_REPLY, 1, sizeof(RedisPool));
+  if (_redis_pool != NULL) pthread_setspecific(_redis_poolKey, _redis_pool);
+  return _redis_pool;
+}
+
+/* Size class of an array of count elements or -1 if it is too big */
+static int _redisPool_class(int count)
+{
+  int c = 0;
+  while ((1 << c) < count) c++;
+  return c < REDIS_POOL_CLASSES ? c : -1;
+}
+
+/* Get a zeroed array of count pointers */
+static void* _redisPool_getArray(int count)
+{
+  RedisPool *pool;
+  void      **array;
+  int       c;
+
+  if (_redis_replyArena != NULL)
+  {
+    array = (void **)bstr_arenaAlloc(_redis_replyArena, count * sizeof(void *));
+    if (array != NULL) memset(array, 0, count * sizeof(void *));
+    return array;
+  }
+  c = _redisPool_class(count);
+  if (c < 0 || (pool = _redisPool_get()) == NULL)
+    return bstr_memCalloc(BSTR_MEM_REPLY, count, sizeof(void *));
+  if ((array = pool->arrays[c]) != NULL)
+  {
+    pool->arrays[c] = (void **)array[0];
+    pool->retained -= (1 << c) * sizeof(void *);
+    memset(array, 0, count * sizeof(void *));
+    return array;
+  }
+  /* Allocate the whole class so the array can be reused for any count */
+  return bstr_memCalloc(BSTR_MEM_REPLY, 1 << c, sizeof(void *));
+}
+
+/* Give back an array obtained from _redisPool_getArray() */
+static void _redisPool_putArray(void *array, int count)
+{
+  RedisPool *pool;
+  size_t    size;
+  int       c;
+
+  /* Arrays of an arena are released with the arena */
+  if (_redis_replyArena != NULL) return;
+  c = _redisPool_class(count);
+  size = (c < 0) ? 0 : (1 << c) * sizeof(void *);
+  if (c < 0 || (pool = _redisPool_get()) == NULL ||
+      pool->retained + size > _redis_poolLimit)
+  {
+    bstr_memFree(array);
+    return;
+  }
+  ((void **)array)[0] = pool->arrays[c];
+  pool->arrays[c] = (void **)array;
+  pool->retained += size;
+}
+
+static RedisRetVal* _redisPool_getRetVal()
+{
+  RedisPool   *pool;
+  RedisRetVal *rv;
+
+  if (_redis_replyArena != NULL)
+    return (RedisRetVal *)bstr_arenaAlloc(_redis_replyArena, sizeof(RedisRetVal));
+  if ((pool = _redisPool_get()) == NULL || (rv = pool->retVals) == NULL)
+    return (RedisRetVal *) bstr_memAlloc(BSTR_MEM_REPLY, sizeof(RedisRetVal));
+  pool->retVals = rv->attributes;
+  pool->retained -= sizeof(RedisRetVal);
+  return rv;
+}
+
+static void _redisPool_putRetVal(RedisRetVal *rv)
+{
+  RedisPool *pool;
+
+  if (rv->arena != NULL) return;
+  if ((pool = _redisPool_get()) == NULL ||
+      pool->retained + sizeof(RedisRetVal) > _redis_poolLimit)
+  {
+    bstr_memFree(rv);
+    return;
+  }
+  rv->attributes = pool->retVals;
+  pool->retVals = rv;
+  pool->retained += sizeof(RedisRetVal);
+}
+
+/**
+ * redis_setPoolLimit:
+ * @maxBytes: maximum number of bytes kept by each thread or 0.
+ *
+ * Set the amount of memory each thread may keep in its reply freelists.
+ * Reply structures and element arrays released by redisRetVal_free() are
+ * kept up to this limit and reused by the next replies (1MB by default).
+ * 0 disables pooling.
+ **/
+void redis_setPoolLimit(size_t maxBytes)
+{
+  _redis_poolLimit = maxBytes;
+}
+
+/**
+ * redis_trimPool:
+ *
+ * Release the memory kept in the reply freelists of the calling thread.
+ * This memory is released anyway when the thread exits.
+ **/
+void redis_trimPool()
+{
+  if (_redis_pool != NULL) _redisPool_release(_redis_pool);
+}
+
+/* Copy a string of a reply, in the reply arena if there is one */
+static bstr_t _redis_replyStr(char *from, size_t len)
+{
+  if (_redis_replyArena != NULL)
+    return bstr_newInArena(_redis_replyArena, from, len);
+  return bstr_new(from, len);
+}
+
 /* Initialize Redis return value structure */
 static RedisRetVal* _redis_initReturnValue()
 {
   RedisRetVal *rv;
-  rv = (RedisRetVal *) malloc(sizeof(RedisRetVal));
+  rv = _redisPool_getRetVal();
   if (rv == NULL)
   {
     _redis_setMallocError();
     return NULL;
   }
-  rv->bulk      = NULL;
-  rv->errorMsg  = NULL;
-  rv->multibulk = NULL;
-  rv->line      = NULL;
-  rv->integer   = 0;
+  rv->bulk              = NULL;
+  rv->errorMsg          = NULL;
+  rv->multibulk         = NULL;
+  rv->multibulkSize     = 0;
+  rv->line              = NULL;
+  rv->integer           = 0;
+  rv->doubleValue       = 0;
+  rv->verbatimFormat[0] = '\0';
+  rv->elements          = NULL;
+  rv->elementCount      = 0;
+  rv->attributes        = NULL;
+  rv->arena             = _redis_replyArena;
   return rv;
 }
 
+static RedisRetVal* _redisRetVal_parse(char *rdata, char **tail);
+
 /*
  * parse an error returned by Redis server and make the corresponding RedisRetVal.
  * The value returned is the same as
@@ -1046,7 +1729,7 @@ static RedisRetVal* _redisRetVal_parseError(char *rdata, char **tail)
    */
 
   while(strncmp(p, "\r\n", 2) != 0) p++;
-  rv->errorMsg = bstr_new(rdata, p - rdata);
+  rv->errorMsg = _redis_replyStr(rdata, p - rdata);
   if (rv->errorMsg == NULL)
   {
     _redis_setMallocError();
@@ -1076,7 +1759,7 @@ static RedisRetVal* _redisRetVal_parseLine(char *rdata, char **tail)
    * (the length of '+', '\r' and '\n') : bstr_len(rdata -1) -3
    */
   while(strncmp(p, "\r\n", 2) != 0) p++;
-  rv->line = bstr_new(rdata, p - rdata);
+  rv->line = _redis_replyStr(rdata, p - rdata);
   if (rv->line == NULL)
   {
     _redis_setMallocError();
@@ -1120,10 +1803,14 @@ static RedisRetVal* _redisRetVal_parseBulk(char *rdata, char **tail)
   if (rv == NULL) return NULL;
   bulklen = strtol(rdata, &rest, 0);
   rv->type = REDIS_RETURN_BULK;
-  if (bulklen == -1) return rv;
   rest += 2;
-  rv->bulk = bstr_new(rest, bulklen);
-  if (rv->bulk == NULL)
+  if (bulklen == -1)
+  {
+    if (tail != NULL) *tail = rest;
+    return rv;
+  }
+  rv->bulk = _redis_replyStr(rest, bulklen);
+  if (rv->bulk == NULL)
   {
     _redis_setMallocError();
     redisRetVal_free(rv);
@@ -1134,13 +1821,268 @@ static RedisRetVal* _redisRetVal_parseBulk(char *rdata, char **tail)
   return rv;
 }
 
+/*
+ * parse a RESP3 null ("_\r\n").
+ * return NULL on error.
+ */
+static RedisRetVal* _redisRetVal_parseNull(char *rdata, char **tail)
+{
+  RedisRetVal *rv;
+
+  rv = _redis_initReturnValue();
+  if (rv == NULL) return NULL;
+  rv->type = REDIS_RETURN_NULL;
+  if (tail != NULL) *tail = rdata + 2;
+  return rv;
+}
+
+/*
+ * parse a RESP3 boolean ("#t\r\n" or "#f\r\n").
+ * return NULL on error.
+ */
+static RedisRetVal* _redisRetVal_parseBoolean(char *rdata, char **tail)
+{
+  RedisRetVal *rv;
+
+  rv = _redis_initReturnValue();
+  if (rv == NULL) return NULL;
+  rv->type    = REDIS_RETURN_BOOLEAN;
+  rv->integer = (*rdata == 't');
+  if (tail != NULL) *tail = rdata + 3;
+  return rv;
+}
+
+/*
+ * parse a RESP3 double. strtod() already understands the "inf", "-inf" and
+ * "nan" forms sent by the server.
+ * return NULL on error.
+ */
+static RedisRetVal* _redisRetVal_parseDouble(char *rdata, char **tail)
+{
+  RedisRetVal *rv;
+  char        *rest;
+
+  rv = _redis_initReturnValue();
+  if (rv == NULL) return NULL;
+  rv->type        = REDIS_RETURN_DOUBLE;
+  rv->doubleValue = strtod(rdata, &rest);
+  if (tail != NULL) *tail = rest + 2;
+  return rv;
+}
+
+/*
+ * parse a RESP3 big number. The digits are kept as a string since they may
+ * not fit in any C type.
+ * return NULL on error.
+ */
+static RedisRetVal* _redisRetVal_parseBigNumber(char *rdata, char **tail)
+{
+  RedisRetVal *rv;
+  char        *p = rdata;
+
+  rv = _redis_initReturnValue();
+  if (rv == NULL) return NULL;
+  rv->type = REDIS_RETURN_BIGNUMBER;
+  while(strncmp(p, "\r\n", 2) != 0) p++;
+  rv->bulk = _redis_replyStr(rdata, p - rdata);
+  if (rv->bulk == NULL)
+  {
+    _redis_setMallocError();
+    redisRetVal_free(rv);
+    return NULL;
+  }
+  if (tail != NULL) *tail = p + 2;
+  return rv;
+}
+
+/*
+ * parse a RESP3 verbatim string ("=len\r\nfmt:data\r\n"). The 3 chars format
+ * is stored apart from the data.
+ * return NULL on error.
+ */
+static RedisRetVal* _redisRetVal_parseVerbatim(char *rdata, char **tail)
+{
+  RedisRetVal *rv;
+  int         len;
+  char        *rest;
+
+  len = strtol(rdata, &rest, 10);
+  /* The data starts with a "fmt:" prefix */
+  if (len < 4)
+  {
+    _redis_setSrvError(REDIS_ERROR_RET_UNEXPECTED);
+    return NULL;
+  }
+  rv = _redis_initReturnValue();
+  if (rv == NULL) return NULL;
+  rv->type = REDIS_RETURN_VERBATIM;
+  rest += 2;
+  memcpy(rv->verbatimFormat, rest, 3);
+  rv->verbatimFormat[3] = '\0';
+  rv->bulk = _redis_replyStr(rest + 4, len - 4);
+  if (rv->bulk == NULL)
+  {
+    _redis_setMallocError();
+    redisRetVal_free(rv);
+    return NULL;
+  }
+  if (tail != NULL) *tail = rest + len + 2;
+  return rv;
+}
+
+/*
+ * parse a RESP3 blob error ("!len\r\ndata\r\n"). It is reported as a regular
+ * error.
+ * return NULL on error.
+ */
+static RedisRetVal* _redisRetVal_parseBlobError(char *rdata, char **tail)
+{
+  RedisRetVal *rv;
+  int         len;
+  char        *rest;
+
+  rv = _redis_initReturnValue();
+  if (rv == NULL) return NULL;
+  rv->type = REDIS_RETURN_ERROR;
+  len = strtol(rdata, &rest, 10);
+  rest += 2;
+  rv->errorMsg = _redis_replyStr(rest, len);
+  if (rv->errorMsg == NULL)
+  {
+    _redis_setMallocError();
+    redisRetVal_free(rv);
+    return NULL;
+  }
+  if (tail != NULL) *tail = rest + len + 2;
+  return rv;
+}
+
+/*
+ * parse a RESP3 aggregate (map, set or push) and make the corresponding
+ * RedisRetVal. Children are parsed recursively; a map of N pairs is stored as
+ * 2*N alternating keys and values.
+ * return NULL on error.
+ */
+static RedisRetVal* _redisRetVal_parseAggregate(char            *rdata,
+                                                char            **tail,
+                                                RedisReturnType type)
+{
+  RedisRetVal *rv;
+  char        *rest;
+  int         count;
+  int         i;
+
+  rv = _redis_initReturnValue();
+  if (rv == NULL) return NULL;
+  rv->type = type;
+  count = strtol(rdata, &rest, 10);
+  rest += 2;
+  if (type == REDIS_RETURN_MAP) count *= 2;
+  if (count > 0)
+  {
+    rv->elements = (RedisRetVal **)_redisPool_getArray(count);
+    if (rv->elements == NULL)
+    {
+      _redis_setMallocError();
+      redisRetVal_free(rv);
+      return NULL;
+    }
+    rv->elementCount = count;
+  }
+  for (i = 0; i < count; i++)
+  {
+    rv->elements[i] = _redisRetVal_parse(rest, &rest);
+    if (rv->elements[i] == NULL)
+    {
+      redisRetVal_free(rv);
+      return NULL;
+    }
+  }
+  if (tail != NULL) *tail = rest;
+  return rv;
+}
+
+/*
+ * parse a RESP3 attribute ("|N\r\n" followed by N pairs) and attach it to the
+ * reply that follows it.
+ * return NULL on error.
+ */
+static RedisRetVal* _redisRetVal_parseAttribute(char *rdata, char **tail)
+{
+  RedisRetVal *attributes;
+  RedisRetVal *rv;
+  char        *rest;
+
+  attributes = _redisRetVal_parseAggregate(rdata, &rest, REDIS_RETURN_MAP);
+  if (attributes == NULL) return NULL;
+  rv = _redisRetVal_parse(rest, tail);
+  if (rv == NULL)
+  {
+    redisRetVal_free(attributes);
+    return NULL;
+  }
+  if (rv->attributes != NULL) redisRetVal_free(rv->attributes);
+  rv->attributes = attributes;
+  return rv;
+}
+
+/*
+ * Give a multibulk the children array used by redisRetVal_getElement(). The
+ * first count strings of rv->multibulk are moved to BULK children; from now
+ * on rv->multibulk only borrows them.
+ * return REDIS_NOERROR on success.
+ */
+static int _redisRetVal_doPromote(RedisRetVal *rv, int count)
+{
+  int i;
+
+  rv->elements = (RedisRetVal **)_redisPool_getArray(rv->multibulkSize);
+  if (rv->elements == NULL) return _redis_setMallocError();
+  /* Allocate all children first so a failure leaves rv untouched */
+  for (i = 0; i < count; i++)
+  {
+    if ((rv->elements[i] = _redis_initReturnValue()) == NULL)
+    {
+      while (i--) _redisPool_putRetVal(rv->elements[i]);
+      _redisPool_putArray(rv->elements, rv->multibulkSize);
+      rv->elements = NULL;
+      return redis_errCode;
+    }
+  }
+  for (i = 0; i < count; i++)
+  {
+    rv->elements[i]->type = REDIS_RETURN_BULK;
+    rv->elements[i]->bulk = rv->multibulk[i];
+  }
+  rv->elementCount = rv->multibulkSize;
+  return REDIS_NOERROR;
+}
+
+/* _redisRetVal_doPromote() in the arena of rv, if any */
+static int _redisRetVal_promoteMultiBulk(RedisRetVal *rv, int count)
+{
+  bstr_arena_t *arena;
+  int          i;
+
+  /* Children live where rv lives, even when promoted after parsing */
+  arena = _redis_replyArena;
+  _redis_replyArena = rv->arena;
+  i = _redisRetVal_doPromote(rv, count);
+  _redis_replyArena = arena;
+  return i;
+}
+
 /*
  * parse a multibulk returned by Redis server and make the corresponding RedisRetVal.
+ * Elements that are not bulks (nested multibulks, RESP3 types, ...) are kept
+ * as children (see _redisRetVal_promoteMultiBulk()) and their multibulk entry
+ * borrows their string, if any.
  * return NULL on error.
  */
 static RedisRetVal* _redisRetVal_parseMultiBulk(char *rdata, char **tail)
 {
   RedisRetVal *rv;
+  RedisRetVal *child;
   int         bulklen;
   char        *rest;
   int         i;
@@ -1150,20 +2092,44 @@ static RedisRetVal* _redisRetVal_parseMultiBulk(char *rdata, char **tail)
   rv->type = REDIS_RETURN_MULTIBULK;
   /* Get array size (multibuk size). If -1, an error, return a NULL multibulk. */
   rv->multibulkSize = strtol(rdata, &rest, 0);
-  if (rv->multibulkSize == -1)
+  rest += 2;                          /* Step through "\r\n" */
+  if (rv->multibulkSize <= 0)
+  {
+    if (tail != NULL) *tail = rest;
     return rv;
+  }
   /* Allocate necessary space to store data of size rv->multibulkSize */
-  rv->multibulk = (bstr_t *)calloc(rv->multibulkSize, sizeof(bstr_t));
+  rv->multibulk = (bstr_t *)_redisPool_getArray(rv->multibulkSize);
   if (rv->multibulk == NULL)
   {
     _redis_setMallocError();
     redisRetVal_free(rv);
     return NULL;
   }
-  rest += 2;                          /* Step through "\r\n" */
   i = 0;
   while (i < rv->multibulkSize)       /* For each element in multibulk data */
   {
+    if (*rest != '$' || rv->elements != NULL)
+    {
+      /* Not a plain bulk: keep the element as a child */
+      if (rv->elements == NULL &&
+          _redisRetVal_promoteMultiBulk(rv, i) != REDIS_NOERROR)
+      {
+        redisRetVal_free(rv);
+        return NULL;
+      }
+      child = _redisRetVal_parse(rest, &rest);
+      if (child == NULL)
+      {
+        redisRetVal_free(rv);
+        return NULL;
+      }
+      rv->elements[i] = child;
+      if (child->type == REDIS_RETURN_BULK) rv->multibulk[i] = child->bulk;
+      if (child->type == REDIS_RETURN_LINE) rv->multibulk[i] = child->line;
+      i++;
+      continue;
+    }
     rest++;                           /* Step through $ */
     bulklen = strtol(rest, &rest, 0); /* Get an element length */
     rest += 2;                        /* Step through "\r\n" */
@@ -1174,7 +2140,7 @@ static RedisRetVal* _redisRetVal_parseMultiBulk(char *rdata, char **tail)
       continue;
     }
     /* Store the value of size bulklen starting from rest */
-    rv->multibulk[i] = bstr_new(rest, bulklen);
+    rv->multibulk[i] = _redis_replyStr(rest, bulklen);
     if (rv->multibulk[i] == NULL)
     {
       _redis_setMallocError();
@@ -1218,10 +2184,16 @@ bstr_t redisCmd_buildProtocolStr(RedisCmd *cmd)
    * if a protocol string is already generated, free it and build a new one
    */
   if (cmd->protocolString != NULL) bstr_free (cmd->protocolString);
+  cmd->protocolString = NULL;
   if (cmd->protocolType == REDIS_PROTOCOL_MULTIBULK)
     return _redisCmd_genMultiBulk(cmd);
 
-  cmdSpec = _redis_lookupCommandSpec(*(char **)cmd->args);
+  cmdSpec = _redis_lookupCommandSpec((char *)cmd->args[0]);
+  if (cmdSpec == NULL)
+  {
+    _redis_setSrvError(REDIS_ERROR_CMD_UNKNOWN);
+    return NULL;
+  }
 
   if ((cmdSpec->arity > 0 && cmd->argsCount != cmdSpec->arity) ||
       (cmdSpec->arity < 0 && cmd->argsCount < -cmdSpec->arity)   )
@@ -1230,7 +2202,7 @@ bstr_t redisCmd_buildProtocolStr(RedisCmd *cmd)
     return NULL;
   }
 
-  switch (cmdSpec->flags)
+  switch (cmdSpec->type)
   {
     case REDIS_CMD_MULTIBULK : return _redisCmd_genMultiBulk(cmd);
     case REDIS_CMD_BULK      : return _redisCmd_genBulk(cmd);
@@ -1347,668 +2319,4272 @@ int redisRetVal_getMultiBulkSize(RedisRetVal *rv)
 }
 
 /**
- * redisRetVal_free:
- * @rv: #RedisRetVal structure to free.
- * 
- * Free the memory allocated to @rv. It is recommended to call redisRetVal_free()
- * on #RedisRetVal structures returned by redis_exec() and redis_execStr()
- * when they are no longer used.
+ * redisRetVal_getBoolean:
+ * @rv: a #RedisRetVal of type %REDIS_RETURN_BOOLEAN.
+ *
+ * Get the value of a RESP3 boolean reply.
+ *
+ * Returns: 1 for true, 0 for false.
  **/
-void redisRetVal_free(RedisRetVal *rv)
+int redisRetVal_getBoolean(RedisRetVal *rv)
 {
-  int i;
-
-  if (rv->bulk      != NULL) bstr_free(rv->bulk);
-  if (rv->errorMsg  != NULL) bstr_free(rv->errorMsg);
-  if (rv->line      != NULL) bstr_free(rv->line);
-  if (rv->multibulk != NULL)
-  {
-    for (i=0; i < rv->multibulkSize; i++)
-      if (rv->multibulk[i] != NULL) bstr_free(rv->multibulk[i]);
-    free(rv->multibulk);
-  }
-  free(rv);
+  assert(rv->type == REDIS_RETURN_BOOLEAN);
+  return rv->integer;
 }
 
-/*
- * Return the appropriate returnValue from string reveived from Redis.
- */
-static RedisRetVal* _redisRetVal_parse(char *rdata, char **tail)
+/**
+ * redisRetVal_getDouble:
+ * @rv: a #RedisRetVal of type %REDIS_RETURN_DOUBLE.
+ *
+ * Get the value of a RESP3 double reply (scores of sorted sets, INCRBYFLOAT,
+ * ...). Infinities and NaN are returned as their C counterparts.
+ *
+ * Returns: the double value of @rv.
+ **/
+double redisRetVal_getDouble(RedisRetVal *rv)
 {
-  switch (*rdata)
-  {
-    case '-' : return _redisRetVal_parseError(++rdata, tail);
-    case '+' : return _redisRetVal_parseLine(++rdata, tail);
-    case '$' : return _redisRetVal_parseBulk(++rdata, tail);
-    case '*' : return _redisRetVal_parseMultiBulk(++rdata, tail);
-    case ':' : return _redisRetVal_parseInteger(++rdata, tail);
-    default  : return NULL;
-  }
+  assert(rv->type == REDIS_RETURN_DOUBLE);
+  return rv->doubleValue;
 }
 
-/* Exec a command and return the corresponding returnValue.
- * There is 2 ways to exec the command (depending on cmd->protocolType):
- * - The old way (using the redis_commandSpecTable)
- * - The new way (using the multibulk command format)
- *
- * return NULL on error.
- */
 /**
- * redisCmd_exec:
- * @redis: #REDIS structure to use.
- * @cmd: #RedisCmd structure to execute
+ * redisRetVal_getBigNumber:
+ * @rv: a #RedisRetVal of type %REDIS_RETURN_BIGNUMBER.
  *
- * Execute @cmd by sending the corresponding protocol string and
- * receiving the response from Redis server described by @redis structure. This
- * response will stored in #RedisCmd and can be retrieved with
- * redisCmd_getRetVal().
+ * Get the decimal digits of a RESP3 big number reply.
  *
- * Returns: a #RedisRetVal structure containing the response of the server or
- * <code>NULL</code> on error and <code>redis_errCode</code> is set accordingly.
- * Note that the return value should never be freed since it references the
- * the return value stored in #RedisCmd and will be freed when @cmd is freed.
+ * Returns: the big number as a bstring. It must not be freed.
  **/
-RedisRetVal* redisCmd_exec(REDIS *redis, RedisCmd *cmd)
+bstr_t redisRetVal_getBigNumber(RedisRetVal *rv)
 {
-  bstr_t            rdata;
-  RedisRetVal       *rv;
-  int               rc;
-
-  if (cmd->protocolString == NULL)
-    if (redisCmd_buildProtocolStr(cmd) == NULL) return NULL;
-
-  rc = _redis_send(redis, cmd->protocolString);
-  if (rc != REDIS_NOERROR) return NULL;
-
-  rdata = _redis_receive(redis);
-  if (rdata == NULL) return NULL;
-  rv = _redisRetVal_parse((char *)rdata, NULL);
-  cmd->returnValue = rv;
-  bstr_free(rdata);
-  return rv;
+  assert(rv->type == REDIS_RETURN_BIGNUMBER);
+  return rv->bulk;
 }
 
 /**
- * redisCmd_reset:
- * @cmd: RedisCmd to reset.
- * @cmdName: Redis command name.
+ * redisRetVal_getVerbatim:
+ * @rv: a #RedisRetVal of type %REDIS_RETURN_VERBATIM.
  *
- * Reset @cmd so it can be reused. This is the same as as redisCmd_new() but does
- * not allocate memory. It just reuse the already allocated zone.
+ * Get the content of a RESP3 verbatim string, without its format prefix (see
+ * redisRetVal_getVerbatimFormat()).
  *
- * Returns: return %REDIS_NOERROR on success or the corresponding error code on
- * error.
+ * Returns: the verbatim string. It must not be freed.
  **/
-RedisErrorCode redisCmd_reset(RedisCmd *cmd, char *cmdName)
+bstr_t redisRetVal_getVerbatim(RedisRetVal *rv)
 {
-  int i;
+  assert(rv->type == REDIS_RETURN_VERBATIM);
+  return rv->bulk;
+}
+
+/**
+ * redisRetVal_getVerbatimFormat:
+ * @rv: a #RedisRetVal of type %REDIS_RETURN_VERBATIM.
+ *
+ * Get the format of a RESP3 verbatim string ("txt", "mkd", ...).
+ *
+ * Returns: a 3 characters string. It must not be freed.
+ **/
+const char* redisRetVal_getVerbatimFormat(RedisRetVal *rv)
+{
+  assert(rv->type == REDIS_RETURN_VERBATIM);
+  return rv->verbatimFormat;
+}
+
+/**
+ * redisRetVal_getMapSize:
+ * @rv: a #RedisRetVal of type %REDIS_RETURN_MAP.
+ *
+ * Get the number of key/value pairs of a RESP3 map.
+ *
+ * Returns: the number of pairs in @rv.
+ **/
+int redisRetVal_getMapSize(RedisRetVal *rv)
+{
+  assert(rv->type == REDIS_RETURN_MAP);
+  return rv->elementCount / 2;
+}
+
+/**
+ * redisRetVal_getMapKey:
+ * @rv: a #RedisRetVal of type %REDIS_RETURN_MAP.
+ * @index: index of the pair, between 0 and redisRetVal_getMapSize() - 1.
+ *
+ * Get the key of the pair at @index.
+ *
+ * Returns: the key as a #RedisRetVal owned by @rv or <code>NULL</code> if
+ * @index is out of bound.
+ **/
+RedisRetVal* redisRetVal_getMapKey(RedisRetVal *rv, int index)
+{
+  assert(rv->type == REDIS_RETURN_MAP);
+  if (index < 0 || index >= rv->elementCount / 2) return NULL;
+  return rv->elements[2 * index];
+}
+
+/**
+ * redisRetVal_getMapValue:
+ * @rv: a #RedisRetVal of type %REDIS_RETURN_MAP.
+ * @index: index of the pair, between 0 and redisRetVal_getMapSize() - 1.
+ *
+ * Get the value of the pair at @index.
+ *
+ * Returns: the value as a #RedisRetVal owned by @rv or <code>NULL</code> if
+ * @index is out of bound.
+ **/
+RedisRetVal* redisRetVal_getMapValue(RedisRetVal *rv, int index)
+{
+  assert(rv->type == REDIS_RETURN_MAP);
+  if (index < 0 || index >= rv->elementCount / 2) return NULL;
+  return rv->elements[2 * index + 1];
+}
+
+/**
+ * redisRetVal_getElementCount:
+ * @rv: an aggregate #RedisRetVal (multibulk, set or push).
+ *
+ * Get the number of elements of an aggregate reply.
+ *
+ * Returns: the number of elements of @rv.
+ **/
+int redisRetVal_getElementCount(RedisRetVal *rv)
+{
+  assert(rv->type == REDIS_RETURN_MULTIBULK ||
+         rv->type == REDIS_RETURN_SET       ||
+         rv->type == REDIS_RETURN_PUSH);
+  if (rv->type == REDIS_RETURN_MULTIBULK)
+    return rv->multibulkSize > 0 ? rv->multibulkSize : 0;
+  return rv->elementCount;
+}
+
+/**
+ * redisRetVal_getElement:
+ * @rv: an aggregate #RedisRetVal (multibulk, set or push).
+ * @index: index of the element.
+ *
+ * Get an element of an aggregate reply as a #RedisRetVal. Unlike
+ * redisRetVal_getMultiBulk(), this gives access to nested aggregates and
+ * to RESP3 types inside a multibulk.
+ *
+ * Returns: the element at @index, owned by @rv, or <code>NULL</code> on error.
+ **/
+RedisRetVal* redisRetVal_getElement(RedisRetVal *rv, int index)
+{
+  if (index < 0 || index >= redisRetVal_getElementCount(rv)) return NULL;
+  if (rv->type == REDIS_RETURN_MULTIBULK && rv->elements == NULL &&
+      _redisRetVal_promoteMultiBulk(rv, rv->multibulkSize) != REDIS_NOERROR)
+    return NULL;
+  return rv->elements[index];
+}
+
+/**
+ * redisRetVal_getAttributes:
+ * @rv: a #RedisRetVal.
+ *
+ * Get the RESP3 attributes sent by the server along with @rv.
+ *
+ * Returns: a #RedisRetVal of type %REDIS_RETURN_MAP owned by @rv or
+ * <code>NULL</code> if the reply has no attributes.
+ **/
+RedisRetVal* redisRetVal_getAttributes(RedisRetVal *rv)
+{
+  return rv->attributes;
+}
+
+/**
+ * redisRetVal_free:
+ * @rv: #RedisRetVal structure to free.
+ * 
+ * Free the memory allocated to @rv. It is recommended to call redisRetVal_free()
+ * on #RedisRetVal structures returned by redis_exec() and redis_execStr()
+ * when they are no longer used.
+ **/
+void redisRetVal_free(RedisRetVal *rv)
+{
+  int i;
+
+  /* A reply allocated from an arena is released with the arena */
+  if (rv->arena != NULL) return;
+
+  if (rv->bulk      != NULL) bstr_free(rv->bulk);
+  if (rv->errorMsg  != NULL) bstr_free(rv->errorMsg);
+  if (rv->line      != NULL) bstr_free(rv->line);
+  if (rv->elements  != NULL)
+  {
+    /* Strings of rv->multibulk, if any, belong to the children */
+    for (i=0; i < rv->elementCount; i++)
+      if (rv->elements[i] != NULL) redisRetVal_free(rv->elements[i]);
+    _redisPool_putArray(rv->elements, rv->elementCount);
+    if (rv->multibulk != NULL) _redisPool_putArray(rv->multibulk, rv->multibulkSize);
+  }
+  else if (rv->multibulk != NULL)
+  {
+    for (i=0; i < rv->multibulkSize; i++)
+      if (rv->multibulk[i] != NULL) bstr_free(rv->multibulk[i]);
+    _redisPool_putArray(rv->multibulk, rv->multibulkSize);
+  }
+  if (rv->attributes != NULL) redisRetVal_free(rv->attributes);
+  _redisPool_putRetVal(rv);
+}
+
+/*
+ * Return the appropriate returnValue from string reveived from Redis.
+ */
+static RedisRetVal* _redisRetVal_parse(char *rdata, char **tail)
+{
+  switch (*rdata)
+  {
+    case '-' : return _redisRetVal_parseError(++rdata, tail);
+    case '+' : return _redisRetVal_parseLine(++rdata, tail);
+    case '$' : return _redisRetVal_parseBulk(++rdata, tail);
+    case '*' : return _redisRetVal_parseMultiBulk(++rdata, tail);
+    case ':' : return _redisRetVal_parseInteger(++rdata, tail);
+    case '_' : return _redisRetVal_parseNull(++rdata, tail);
+    case '#' : return _redisRetVal_parseBoolean(++rdata, tail);
+    case ',' : return _redisRetVal_parseDouble(++rdata, tail);
+    case '(' : return _redisRetVal_parseBigNumber(++rdata, tail);
+    case '=' : return _redisRetVal_parseVerbatim(++rdata, tail);
+    case '!' : return _redisRetVal_parseBlobError(++rdata, tail);
+    case '%' : return _redisRetVal_parseAggregate(++rdata, tail, REDIS_RETURN_MAP);
+    case '~' : return _redisRetVal_parseAggregate(++rdata, tail, REDIS_RETURN_SET);
+    case '>' : return _redisRetVal_parseAggregate(++rdata, tail, REDIS_RETURN_PUSH);
+    case '|' : return _redisRetVal_parseAttribute(++rdata, tail);
+    default  : return NULL;
+  }
+}
+
+/*
+ * Parse a reply received on redis, in the arena of the connection if it has
+ * one.
+ */
+static RedisRetVal* _redis_parseReply(REDIS *redis, char *rdata, char **tail)
+{
+  RedisRetVal *rv;
+
+  _redis_replyArena = redis->arena;
+  rv = _redisRetVal_parse(rdata, tail);
+  _redis_replyArena = NULL;
+  return rv;
+}
+
+/* Exec a command and return the corresponding returnValue.
+ * There is 2 ways to exec the command (depending on cmd->protocolType):
+ * - The old way (using the redis_commandSpecTable)
+ * - The new way (using the multibulk command format)
+ *
+ * return NULL on error.
+ */
+/**
+ * redisCmd_exec:
+ * @redis: #REDIS structure to use.
+ * @cmd: #RedisCmd structure to execute
+ *
+ * Execute @cmd by sending the corresponding protocol string and
+ * receiving the response from Redis server described by @redis structure. This
+ * response will stored in #RedisCmd and can be retrieved with
+ * redisCmd_getRetVal().
+ *
+ * Returns: a #RedisRetVal structure containing the response of the server or
+ * <code>NULL</code> on error and <code>redis_errCode</code> is set accordingly.
+ * Note that the return value should never be freed since it references the
+ * the return value stored in #RedisCmd and will be freed when @cmd is freed.
+ **/
+RedisRetVal* redisCmd_exec(REDIS *redis, RedisCmd *cmd)
+{
+  bstr_t            rdata;
+  char              *end;
+  RedisRetVal       *rv;
+  int               rc;
+
+  if (cmd->protocolString == NULL)
+    if (redisCmd_buildProtocolStr(cmd) == NULL) return NULL;
+
+  rc = _redis_send(redis, cmd->protocolString);
+  if (rc != REDIS_NOERROR) return NULL;
+
+  rdata = _redis_receiveReplies(redis, 1, &end);
+  if (rdata == NULL) return NULL;
+  rv = _redis_parseReply(redis, (char *)rdata, NULL);
+  if (cmd->returnValue != NULL) redisRetVal_free(cmd->returnValue);
+  cmd->returnValue = rv;
+  bstr_free(rdata);
+  return rv;
+}
+
+/*
+ * Send a command and receive its whole raw reply, which ends at *end.
+ * An error reply is stored in cmd->returnValue.
+ * return the received data or NULL on error.
+ */
+static bstr_t _redisCmd_transmit(REDIS *redis, RedisCmd *cmd, char **end)
+{
+  bstr_t      rdata;
+  RedisRetVal *rv;
+  char        *p;
+
+  if (cmd->protocolString == NULL)
+    if (redisCmd_buildProtocolStr(cmd) == NULL) return NULL;
+
+  if (_redis_send(redis, cmd->protocolString) != REDIS_NOERROR) return NULL;
+  if ((rdata = _redis_receiveReplies(redis, 1, end)) == NULL) return NULL;
+  p = (char *)rdata;
+
+  if (*p == '-' || *p == '!')
+  {
+    /* Keep the message of the server for redisCmd_getRetVal() */
+    rv = _redis_parseReply(redis, p, NULL);
+    bstr_free(rdata);
+    if (rv == NULL) return NULL;
+    if (cmd->returnValue != NULL) redisRetVal_free(cmd->returnValue);
+    cmd->returnValue = rv;
+    _redis_setSrvError(REDIS_ERROR_RET_SERVER);
+    return NULL;
+  }
+  return rdata;
+}
+
+/*
+ * Read a string element (bulk, line or verbatim) of [p, end) in place.
+ * *str is set to NULL for a nil element.
+ * return REDIS_NOERROR or REDIS_ERROR_RET_UNEXPECTED if p is not a string.
+ */
+static int _redisRetVal_scanString(char   *p,
+                                   char   *end,
+                                   char   **str,
+                                   size_t *len,
+                                   char   **tail)
+{
+  long  n;
+  char  *data;
+
+  if (p >= end) return _redis_setSrvError(REDIS_ERROR_RET_UNEXPECTED);
+  switch (*p)
+  {
+    case '$' :
+    case '=' :
+      n = strtol(p + 1, &data, 10);
+      data += 2;
+      if (n < 0)
+      {
+        *str = NULL;
+        *len = 0;
+        *tail = data;
+        break;
+      }
+      /* Verbatim strings start with a "fmt:" prefix */
+      if (*p == '=' && n < 4) return _redis_setSrvError(REDIS_ERROR_RET_UNEXPECTED);
+      if (n > end - data) return _redis_setSrvError(REDIS_ERROR_RET_UNEXPECTED);
+      *str = data;
+      *len = n;
+      *tail = data + n + 2;
+      if (*p == '=')
+      {
+        *str += 4;
+        *len -= 4;
+      }
+      break;
+    case '+' :
+      data = ++p;
+      while (data + 1 < end && strncmp(data, "\r\n", 2) != 0) data++;
+      *str = p;
+      *len = data - p;
+      *tail = data + 2;
+      break;
+    case '_' :
+      *str = NULL;
+      *len = 0;
+      *tail = p + 3;
+      break;
+    default :
+      return _redis_setSrvError(REDIS_ERROR_RET_UNEXPECTED);
+  }
+  if (*tail > end) return _redis_setSrvError(REDIS_ERROR_RET_UNEXPECTED);
+  return REDIS_NOERROR;
+}
+
+/*
+ * Read a number element (integer, double or a bulk holding a number) of
+ * [p, end) in place. Nil elements are read as 0.
+ * return REDIS_NOERROR or REDIS_ERROR_RET_UNEXPECTED if p is not a number.
+ */
+static int _redisRetVal_scanDouble(char *p, char *end, double *value, char **tail)
+{
+  char   *str;
+  size_t len;
+
+  if (p < end && (*p == ':' || *p == ','))
+  {
+    *value = strtod(p + 1, &str);
+    *tail = str + 2;
+    if (*tail > end) return _redis_setSrvError(REDIS_ERROR_RET_UNEXPECTED);
+    return REDIS_NOERROR;
+  }
+  if (_redisRetVal_scanString(p, end, &str, &len, tail) != REDIS_NOERROR)
+    return redis_errCode;
+  /* The data is always followed by "\r\n", so strtod stops in time */
+  *value = (str == NULL) ? 0 : strtod(str, NULL);
+  return REDIS_NOERROR;
+}
+
+static int _redisRetVal_scanInt64(char *p, char *end, int64_t *value, char **tail)
+{
+  char   *str;
+  size_t len;
+  double d;
+
+  if (p < end && *p == ':')
+  {
+    *value = strtoll(p + 1, &str, 10);
+    *tail = str + 2;
+    if (*tail > end) return _redis_setSrvError(REDIS_ERROR_RET_UNEXPECTED);
+    return REDIS_NOERROR;
+  }
+  if (p < end && *p == ',')
+  {
+    /* A double is truncated, unless it does not fit (inf, nan, ...) */
+    d = strtod(p + 1, &str);
+    *tail = str + 2;
+    if (*tail > end || !(d >= -9223372036854775808.0 &&
+                         d <  9223372036854775808.0))
+      return _redis_setSrvError(REDIS_ERROR_RET_UNEXPECTED);
+    *value = (int64_t)d;
+    return REDIS_NOERROR;
+  }
+  if (_redisRetVal_scanString(p, end, &str, &len, tail) != REDIS_NOERROR)
+    return redis_errCode;
+  *value = (str == NULL) ? 0 : strtoll(str, NULL, 10);
+  return REDIS_NOERROR;
+}
+
+/*
+ * Read the header of an aggregate of [p, end).
+ * return the number of elements (pairs are counted twice for maps) or -1 on
+ * error.
+ */
+static int _redisRetVal_scanAggregate(char *p, char *end, char **tail)
+{
+  long count;
+
+  if (p < end)
+    switch (*p)
+    {
+      case '*' :
+      case '~' :
+      case '>' :
+        count = strtol(p + 1, tail, 10);
+        *tail += 2;
+        return count < 0 ? 0 : count;
+      case '%' :
+        count = strtol(p + 1, tail, 10);
+        *tail += 2;
+        return count * 2;
+    }
+  _redis_setSrvError(REDIS_ERROR_RET_UNEXPECTED);
+  return -1;
+}
+
+/**
+ * RedisHashSetFunc:
+ * @userData: the pointer given to redisCmd_execHash().
+ * @field: the field name (not <code>\0</code> terminated).
+ * @fieldLen: the length of @field.
+ * @value: the value or <code>NULL</code> for a nil value.
+ * @valueLen: the length of @value.
+ *
+ * Called by redisCmd_execHash() for each field/value pair of the reply.
+ * @field and @value point to the receive buffer and are only valid during the
+ * call.
+ **/
+
+/**
+ * redisCmd_execHash:
+ * @redis: #REDIS structure to use.
+ * @cmd: #RedisCmd returning field/value pairs (HGETALL, CONFIG GET, ...).
+ * @setFunc: function storing a pair in the caller's structure.
+ * @userData: pointer passed to @setFunc.
+ *
+ * Execute @cmd and hand each field/value pair of the reply directly to @setFunc.
+ * Both the RESP2 flat multibulk and the RESP3 map are understood. No
+ * #RedisRetVal is built, so redisCmd_getRetVal() is not updated, except when
+ * the server replies with an error: <code>redis_errCode</code> is then
+ * REDIS_ERROR_RET_SERVER and redisCmd_getRetVal() holds the error.
+ *
+ * Returns: the number of pairs decoded or <code>-1</code> on error and
+ * <code>redis_errCode</code> is set accordingly.
+ **/
+int redisCmd_execHash(REDIS            *redis,
+                      RedisCmd         *cmd,
+                      RedisHashSetFunc setFunc,
+                      void             *userData)
+{
+  bstr_t rdata;
+  char   *p, *end;
+  char   *field, *value;
+  size_t fieldLen, valueLen;
+  int    count, i;
+
+  if ((rdata = _redisCmd_transmit(redis, cmd, &end)) == NULL) return -1;
+  p = (char *)rdata;
+  if ((count = _redisRetVal_scanAggregate(p, end, &p)) < 0)
+  {
+    bstr_free(rdata);
+    return -1;
+  }
+  for (i = 0; i < count / 2; i++)
+  {
+    if (_redisRetVal_scanString(p, end, &field, &fieldLen, &p) != REDIS_NOERROR ||
+        _redisRetVal_scanString(p, end, &value, &valueLen, &p) != REDIS_NOERROR)
+    {
+      bstr_free(rdata);
+      return -1;
+    }
+    setFunc(userData, field, fieldLen, value, valueLen);
+  }
+  bstr_free(rdata);
+  return count / 2;
+}
+
+/**
+ * redisCmd_execScores:
+ * @redis: #REDIS structure to use.
+ * @cmd: #RedisCmd returning members with their scores (ZRANGE ... WITHSCORES).
+ * @members: array receiving the members or <code>NULL</code>.
+ * @scores: array receiving the scores.
+ * @size: number of entries available in @members and @scores.
+ *
+ * Execute @cmd and decode the member/score pairs of the reply straight into
+ * two parallel arrays. Scores are stored as doubles whether the server sent
+ * them as bulks (RESP2) or doubles (RESP3). The members stored in @members
+ * should be freed with bstr_free() when no longer needed. An error reply is
+ * reported as for redisCmd_execHash().
+ *
+ * Returns: the number of pairs in the reply, which may exceed @size (only the
+ * first @size are stored), or <code>-1</code> on error and
+ * <code>redis_errCode</code> is set accordingly.
+ **/
+int redisCmd_execScores(REDIS    *redis,
+                        RedisCmd *cmd,
+                        bstr_t   *members,
+                        double   *scores,
+                        int      size)
+{
+  bstr_t rdata;
+  char   *p, *end;
+  char   *member;
+  size_t memberLen;
+  double score = 0;
+  int    count, i;
+  int    nested;
+
+  if ((rdata = _redisCmd_transmit(redis, cmd, &end)) == NULL) return -1;
+  p = (char *)rdata;
+  if ((count = _redisRetVal_scanAggregate(p, end, &p)) < 0)
+  {
+    bstr_free(rdata);
+    return -1;
+  }
+  /* RESP3 sends an array of [member, score] arrays */
+  nested = (count > 0 && *p == '*');
+  if (!nested) count /= 2;
+  for (i = 0; i < count; i++)
+  {
+    if (nested && _redisRetVal_scanAggregate(p, end, &p) != 2)
+    {
+      _redis_setSrvError(REDIS_ERROR_RET_UNEXPECTED);
+      break;
+    }
+    if (_redisRetVal_scanString(p, end, &member, &memberLen, &p) != REDIS_NOERROR ||
+        _redisRetVal_scanDouble(p, end, &score, &p) != REDIS_NOERROR)
+      break;
+    if (i >= size) continue;
+    scores[i] = score;
+    if (members == NULL) continue;
+    if ((members[i] = bstr_new(member, memberLen)) == NULL)
+    {
+      _redis_setMallocError();
+      break;
+    }
+  }
+  bstr_free(rdata);
+  if (i == count) return count;
+  /* On error, release the members already stored */
+  if (members != NULL)
+    while (i-- > 0)
+      if (i < size) bstr_free(members[i]);
+  return -1;
+}
+
+/**
+ * redisCmd_execInt64:
+ * @redis: #REDIS structure to use.
+ * @cmd: #RedisCmd returning numbers (INCR, MGET of counters, SMISMEMBER, ...).
+ * @values: array receiving the numbers.
+ * @size: number of entries available in @values.
+ *
+ * Execute @cmd and decode the numbers of the reply into @values. An integer
+ * reply is stored as a single value; the elements of an aggregate reply can
+ * be integers or bulks holding a number. RESP3 doubles are truncated and nil
+ * replies or elements are stored as 0. An error reply is reported as for
+ * redisCmd_execHash().
+ *
+ * Returns: the number of values in the reply, which may exceed @size (only
+ * the first @size are stored), or <code>-1</code> on error and
+ * <code>redis_errCode</code> is set accordingly.
+ **/
+int redisCmd_execInt64(REDIS    *redis,
+                       RedisCmd *cmd,
+                       int64_t  *values,
+                       int      size)
+{
+  bstr_t  rdata;
+  char    *p, *end;
+  int64_t value = 0;
+  int     count, i;
+
+  if ((rdata = _redisCmd_transmit(redis, cmd, &end)) == NULL) return -1;
+  p = (char *)rdata;
+  if (*p == ':' || *p == '$' || *p == ',' || *p == '_')
+    count = 1;
+  else if ((count = _redisRetVal_scanAggregate(p, end, &p)) < 0)
+  {
+    bstr_free(rdata);
+    return -1;
+  }
+  for (i = 0; i < count; i++)
+  {
+    if (_redisRetVal_scanInt64(p, end, &value, &p) != REDIS_NOERROR)
+    {
+      bstr_free(rdata);
+      return -1;
+    }
+    if (i < size) values[i] = value;
+  }
+  bstr_free(rdata);
+  return count;
+}
+
+/* An aggregate being streamed */
+typedef struct
+{
+  int remaining;                /* Elements left before the end           */
+  int attribute;                /* RESP3 attribute, not a value by itself */
+  int silent;                   /* Not reported to the handler            */
+} RedisStreamFrame;
+
+/*
+ * Get the end of the token starting at p.
+ * return a pointer past the token or NULL if [p, end) does not hold all of it;
+ * *need is then set to the token size when it is already known.
+ */
+static char* _redisStream_tokenEnd(char *p, char *end, size_t *need)
+{
+  char *nl;
+  long n;
+
+  *need = 0;
+  if ((nl = memchr(p, '\n', end - p)) == NULL) return NULL;
+  if (*p != '$' && *p != '=' && *p != '!') return nl + 1;
+  n = strtol(p + 1, NULL, 10);
+  if (n < 0) return nl + 1;
+  *need = (nl + 1 - p) + n + 2;
+  if ((size_t)(end - p) < *need) return NULL;
+  return p + *need;
+}
+
+/*
+ * Account for a complete value at the current depth, closing the aggregates
+ * it completes.
+ * return 1 if a whole reply is complete, 0 otherwise.
+ */
+static int _redisStream_valueDone(RedisStreamFrame  *stack,
+                                  int               *depth,
+                                  RedisReplyHandler *handler,
+                                  void              *userData)
+{
+  RedisStreamFrame *top;
+
+  while (*depth > 0)
+  {
+    top = &stack[*depth - 1];
+    if (--top->remaining > 0) return 0;
+    (*depth)--;
+    /* The value following an attribute is the real one */
+    if (top->attribute) return 0;
+    if (!top->silent && handler->endArray) handler->endArray(userData);
+  }
+  return 1;
+}
+
+/*
+ * Receive replyCount replies and report them to handler while they arrive.
+ * Only the token being decoded is kept in memory.
+ * return REDIS_NOERROR or the error code.
+ */
+static int _redis_receiveStream(REDIS             *redis,
+                                RedisReplyHandler *handler,
+                                void              *userData,
+                                int               replyCount)
+{
+  RedisStreamFrame *stack = NULL;
+  RedisStreamFrame *frame;
+  int              stackSize = 0;
+  int              depth = 0;
+  int              done = 0;
+  int              silent;
+  int              isValue;
+  char             *buf, *p, *end, *tokenEnd, *tmp;
+  size_t           cap = MAXDATASIZE * 16;
+  size_t           used = 0;
+  size_t           need;
+  long             n;
+  int              rc;
+
+  if ((buf = bstr_memAlloc(BSTR_MEM_REPLY, cap)) == NULL)
+    return _redis_setMallocError();
+  while (done < replyCount)
+  {
+    p = buf;
+    end = buf + used;
+    while (done < replyCount &&
+           (tokenEnd = _redisStream_tokenEnd(p, end, &need)) != NULL)
+    {
+      silent  = depth > 0 && stack[depth - 1].silent;
+      isValue = 1;
+      switch (*p)
+      {
+        case '*' :
+        case '%' :
+        case '~' :
+        case '>' :
+        case '|' :
+          n = strtol(p + 1, NULL, 10);
+          if (n < 0)
+          {
+            if (!silent && handler->element) handler->element(userData, NULL, 0);
+            break;
+          }
+          if (!silent && *p != '|' && handler->beginArray)
+            handler->beginArray(userData,
+                                *p == '%' ? REDIS_RETURN_MAP  :
+                                *p == '~' ? REDIS_RETURN_SET  :
+                                *p == '>' ? REDIS_RETURN_PUSH :
+                                            REDIS_RETURN_MULTIBULK,
+                                n);
+          if (*p == '%' || *p == '|') n *= 2;
+          if (n == 0)
+          {
+            /* An empty attribute is followed by the real value */
+            if (*p == '|') isValue = 0;
+            else if (!silent && handler->endArray) handler->endArray(userData);
+            break;
+          }
+          if (depth == stackSize)
+          {
+            stackSize = stackSize ? stackSize * 2 : 8;
+            frame = bstr_memRealloc(BSTR_MEM_REPLY, stack,
+                                    stackSize * sizeof(RedisStreamFrame));
+            if (frame == NULL)
+            {
+              bstr_memFree(stack);
+              bstr_memFree(buf);
+              return _redis_setMallocError();
+            }
+            stack = frame;
+          }
+          stack[depth].remaining = n;
+          stack[depth].attribute = (*p == '|');
+          stack[depth].silent    = silent || (*p == '|');
+          depth++;
+          isValue = 0;
+          break;
+        case ':' :
+          if (!silent && handler->integer)
+            handler->integer(userData, strtoll(p + 1, NULL, 10));
+          break;
+        case '-' :
+          if (!silent && handler->error)
+            handler->error(userData, p + 1, tokenEnd - p - 3);
+          break;
+        case '!' :
+          n = strtol(p + 1, &tmp, 10);
+          if (!silent && handler->error) handler->error(userData, tmp + 2, n);
+          break;
+        case '$' :
+        case '=' :
+          n = strtol(p + 1, &tmp, 10);
+          if (silent || !handler->element) break;
+          if (n < 0)
+            handler->element(userData, NULL, 0);
+          else if (*p == '=')
+            handler->element(userData, tmp + 6, n - 4);
+          else
+            handler->element(userData, tmp + 2, n);
+          break;
+        case '_' :
+          if (!silent && handler->element) handler->element(userData, NULL, 0);
+          break;
+        case '+' :
+        case ',' :
+        case '#' :
+        case '(' :
+          /* Other scalars are reported as their text */
+          if (!silent && handler->element)
+            handler->element(userData, p + 1, tokenEnd - p - 3);
+          break;
+        default :
+          bstr_memFree(stack);
+          bstr_memFree(buf);
+          return _redis_setCnxError(redis, REDIS_ERROR_RET_UNEXPECTED, 0);
+      }
+      if (isValue)
+        done += _redisStream_valueDone(stack, &depth, handler, userData);
+      p = tokenEnd;
+    }
+    if (done == replyCount) break;
+
+    /* Keep the incomplete token and make room for the rest of it */
+    used = end - p;
+    memmove(buf, p, used);
+    if (need > cap || used == cap)
+    {
+      cap = (need > cap) ? need : cap * 2;
+      if ((tmp = bstr_memRealloc(BSTR_MEM_REPLY, buf, cap)) == NULL)
+      {
+        bstr_memFree(stack);
+        bstr_memFree(buf);
+        return _redis_setMallocError();
+      }
+      buf = tmp;
+    }
+
+    rc = _redis_wait(redis, REDIS_WAIT_READ, _redis_nowUsec() + REDIS_IO_TIMEOUT);
+    if (rc > 0) n = recv(redis->fd, buf + used, cap - used, 0);
+    if (rc > 0 && n < 0 && REDIS_WOULDBLOCK(errno)) continue;
+    if (rc <= 0 || n <= 0)
+    {
+      bstr_memFree(stack);
+      bstr_memFree(buf);
+      if (rc == 0) return _redis_setCnxError(redis, REDIS_ERROR_CNX_TIMEOUT, 0);
+      return _redis_setCnxError(redis, REDIS_ERROR_CNX_RECEIVE,
+                                (rc < 0 || n < 0) ? errno : 0);
+    }
+    used += n;
+  }
+  bstr_memFree(stack);
+  bstr_memFree(buf);
+  return REDIS_NOERROR;
+}
+
+/**
+ * RedisReplyHandler:
+ * @beginArray: called at the beginning of an aggregate with its type and its
+ * number of elements (pairs for a map).
+ * @endArray: called at the end of an aggregate.
+ * @element: called for each bulk or line, with <code>NULL</code> for nil
+ * values. Other RESP3 scalars (doubles, booleans, big numbers) are reported
+ * as their text.
+ * @integer: called for each integer.
+ * @error: called for each error.
+ *
+ * Callbacks used by redisCmd_execStream() and redisCmdArray_execStream() to
+ * report a reply while it is received. Any callback can be <code>NULL</code>.
+ * Pointers given to the callbacks reference the receive buffer and are only
+ * valid during the call.
+ **/
+
+/**
+ * redisCmd_execStream:
+ * @redis: #REDIS structure to use.
+ * @cmd: #RedisCmd structure to execute.
+ * @handler: callbacks receiving the reply.
+ * @userData: pointer passed to the callbacks.
+ *
+ * Execute @cmd and report its reply through @handler as the bytes arrive from
+ * the server, without building a #RedisRetVal. Huge replies (KEYS, SMEMBERS,
+ * LRANGE, ...) can thus be filtered or aggregated in constant memory: only
+ * the element being decoded is buffered.
+ *
+ * Returns: %REDIS_NOERROR on success or the error code on error.
+ **/
+RedisErrorCode redisCmd_execStream(REDIS             *redis,
+                                   RedisCmd          *cmd,
+                                   RedisReplyHandler *handler,
+                                   void              *userData)
+{
+  if (cmd->protocolString == NULL)
+    if (redisCmd_buildProtocolStr(cmd) == NULL) return redis_errCode;
+
+  if (_redis_send(redis, cmd->protocolString) != REDIS_NOERROR)
+    return redis_errCode;
+  return _redis_receiveStream(redis, handler, userData, 1);
+}
+
+/**
+ * redisCmd_reset:
+ * @cmd: RedisCmd to reset.
+ * @cmdName: Redis command name.
+ *
+ * Reset @cmd so it can be reused. This is the same as as redisCmd_new() but does
+ * not allocate memory. It just reuse the already allocated zone: the args
+ * array and the args strings are kept and overwritten by the new args.
+ *
+ * Returns: return %REDIS_NOERROR on success or the corresponding error code on
+ * error.
+ **/
+RedisErrorCode redisCmd_reset(RedisCmd *cmd, char *cmdName)
+{
+  int i;
+
+  if (cmd->returnValue != NULL)
+  {
+    redisRetVal_free(cmd->returnValue);
+    cmd->returnValue = NULL;
+  }
+  if (cmd->protocolString != NULL)
+  {
+    bstr_free(cmd->protocolString);
+    cmd->protocolString = NULL;
+  }
+  /*
+   * The args array and the args strings are kept for the new args, but for
+   * references to shared strings, which could not be overwritten anyway.
+   */
+  for (i = 0; i < cmd->argsCount; i++)
+    if (bstr_isShared(cmd->args[i]))
+    {
+      bstr_unref(cmd->args[i]);
+      cmd->args[i] = NULL;
+    }
+  cmd->argsCount = 0;
+  if (cmdName != NULL)
+  {
+    return redisCmd_addArg(cmd, cmdName, -1);
+  }
+  return REDIS_NOERROR;
+}
+
+/**
+ * redisCmd_setProtocolType:
+ * @cmd: the #RedisCmd structure to modify.
+ * @protocol: the protocol to use.
+ *
+ * Set the protocol type of @cmd to @protocol.
+ * If the protocol string is already generated, it refreshen it to reflect the
+ * protocol type specified.
+ *
+ * Returns: %REDIS_NOERROR on success or <code>-1</code> if the protocol string
+ * cannot be generated.
+ **/
+int redisCmd_setProtocolType(RedisCmd *cmd, RedisProtocolType protocol)
+{
+  cmd->protocolType = protocol;
+  if(redisCmd_buildProtocolStr(cmd) == NULL) return -1;
+  return REDIS_NOERROR;
+}
+
+/**
+ * redisCmd_setArg:
+ * @cmd: the #RedisCmd structure to modify.
+ * @argNum: index of the arg to modify.
+ * @argVal: the new value of the arg.
+ * @argLen: the length of the arg or <code>-1</code>.
+ *
+ * Sets the arg at index @argNum to a new value specified by @argVal. If @argLen
+ * is <code>-1</code>, the length of @argVal is determined via
+ * <code>strlen()</code>.
+ *
+ * This function is useful for reusing the same command without allocating a new
+ * one, just change the args and re-execute.
+ *
+ * Returns: %REDIS_NOERROR on success.
+ */
+RedisErrorCode redisCmd_setArg(RedisCmd *cmd,
+                               int argNum,
+                               char *argVal,
+                               size_t argLen)
+{
+  bstr_t newArg;
+  if (cmd->returnValue != NULL)
+  {
+    redisRetVal_free(cmd->returnValue);
+    cmd->returnValue = NULL;
+  }
+  if (argNum <=0 || argNum >= cmd->argsCount)
+    return _redis_setSrvError(REDIS_ERROR_CMD_INVALIDARGNUM);
+  if (argVal == NULL) return _redis_setSrvError(REDIS_ERROR_CMD_ARGS);
+
+  if (argLen == -1) argLen = strlen(argVal);
+  /* Overwrite the old value, its memory is reused when large enough */
+  newArg = bstr_setLen(cmd->args[argNum], argLen);
+  if (newArg == NULL)
+    return _redis_setMallocError();
+  memcpy(newArg, argVal, argLen);
+  cmd->args[argNum] = newArg;
+  _redisCmd_dropProtocolStr(cmd);
+  return REDIS_NOERROR;
+}
+/**
+ * redisCmd_getRetVal:
+ * @cmd: a #RedisCmd structure.
+ *
+ * Get the return value of a @cmd or <code>NULL</code> If the command has not
+ * been executed.
+ *
+ * Returns: the return value stored in @cmd.
+ **/
+RedisRetVal* redisCmd_getRetVal(RedisCmd *cmd)
+{
+  return cmd->returnValue;
+}
+
+/**
+ * redisCmd_getFlags:
+ * @cmd: a #RedisCmd structure.
+ *
+ * Get the #RedisCommandFlags of the command held by @cmd (see
+ * redis_getCommandFlags()).
+ *
+ * Returns: a combination of #RedisCommandFlags or <code>-1</code> if the
+ * command is unknown.
+ **/
+int redisCmd_getFlags(RedisCmd *cmd)
+{
+  if (cmd->argsCount == 0) return -1;
+  return redis_getCommandFlags((char *)cmd->args[0]);
+}
+
+/**
+ * redisCmd_getKeys:
+ * @cmd: a #RedisCmd structure.
+ * @argIndexes: array receiving the indexes of the key args or <code>NULL</code>.
+ * @size: number of entries available in @argIndexes.
+ *
+ * Find the args of @cmd that are keys, for example to route the command to
+ * the right server. Indexes are those used by redisCmd_setArg(): 0 is the
+ * command name.
+ *
+ * Returns: the number of keys of @cmd, which may exceed @size (only the first
+ * @size indexes are stored), or <code>-1</code> if the command is unknown and
+ * <code>redis_errCode</code> is set accordingly.
+ **/
+int redisCmd_getKeys(RedisCmd *cmd, int *argIndexes, int size)
+{
+  struct RedisCmdSpec *cmdSpec;
+  int                 last, i, count;
+
+  if (cmd->argsCount == 0 ||
+      (cmdSpec = _redis_lookupCommandSpec((char *)cmd->args[0])) == NULL)
+  {
+    _redis_setSrvError(REDIS_ERROR_CMD_UNKNOWN);
+    return -1;
+  }
+  if (cmdSpec->firstKey == 0) return 0;
+  last = (cmdSpec->lastKey < 0) ? cmd->argsCount + cmdSpec->lastKey
+                                : cmdSpec->lastKey;
+  count = 0;
+  for (i = cmdSpec->firstKey; i <= last && i < cmd->argsCount; i += cmdSpec->keyStep)
+  {
+    if (argIndexes != NULL && count < size) argIndexes[count] = i;
+    count++;
+  }
+  return count;
+}
+
+/*
+ * Write the multibulk encoding of an arg ("$<len>\r\n<arg>\r\n") at p.
+ * return a pointer past the encoded arg.
+ */
+static char* _redis_writeArg(char *p, char *arg, size_t len)
+{
+  *p++ = '$';
+  p = _redis_writeNum(p, len);
+  *p++ = '\r'; *p++ = '\n';
+  memcpy(p, arg, len);
+  p += len;
+  *p++ = '\r'; *p++ = '\n';
+  return p;
+}
+
+/* Size of the multibulk encoding of an arg of length len */
+static size_t _redis_argSize(size_t len)
+{
+  return 1 + _redis_numLen(len) + 2 + len + 2;
+}
+
+/**
+ * redisPreparedCmd_new:
+ * @cmd: the #RedisCmd to prepare.
+ *
+ * Build a prepared command from @cmd. The protocol string of a prepared command
+ * is encoded once; redisPreparedCmd_setArg() then patches only the arg it
+ * changes (and its length header) in place, so a command sent over and over
+ * with different values costs almost nothing to re-execute:
+ * <informalexample><programlisting>
+ * cmd = redisCmd_newFromStr(REDIS_PROTOCOL_MULTIBULK, "HINCRBY stats:0 hits 1", -1);
+ * pcmd = redisPreparedCmd_new(cmd);
+ * redisCmd_free(cmd);
+ * for (i = 0; i < count; i++)
+ * {
+ *   redisPreparedCmd_setArg(pcmd, 1, keys[i], -1);
+ *   rv = redisPreparedCmd_exec(redis, pcmd);
+ * }
+ * redisPreparedCmd_free(pcmd);
+ * </programlisting></informalexample>
+ * Prepared commands are always sent with %REDIS_PROTOCOL_MULTIBULK. @cmd is
+ * not referenced by the prepared command and can be freed.
+ *
+ * Returns: a new #RedisPreparedCmd or <code>NULL</code> on error and
+ * <code>redis_errCode</code> is set accordingly. It should be freed with
+ * redisPreparedCmd_free() when no longer needed.
+ **/
+RedisPreparedCmd* redisPreparedCmd_new(RedisCmd *cmd)
+{
+  RedisPreparedCmd *pcmd;
+  char             *p;
+  int              i;
+
+  if (cmd == NULL || cmd->argsCount == 0)
+  {
+    _redis_setSrvError(REDIS_ERROR_CMD_INVALID);
+    return NULL;
+  }
+  pcmd = (RedisPreparedCmd *)bstr_memAlloc(BSTR_MEM_COMMAND,
+                                           sizeof(RedisPreparedCmd));
+  if (pcmd == NULL)
+  {
+    _redis_setMallocError();
+    return NULL;
+  }
+  pcmd->argsCount   = cmd->argsCount;
+  pcmd->returnValue = NULL;
+  pcmd->slots       = (size_t *)bstr_memAlloc(BSTR_MEM_COMMAND,
+                                              cmd->argsCount * sizeof(size_t));
+  pcmd->len         = 1 + _redis_numLen(cmd->argsCount) + 2;
+  for (i = 0; i < cmd->argsCount; i++)
+    pcmd->len += _redis_argSize(bstr_len(cmd->args[i]));
+  /* Leave some room so growing args rarely needs a realloc */
+  pcmd->size = pcmd->len + pcmd->len / 2;
+  pcmd->buf  = (char *)bstr_memAlloc(BSTR_MEM_COMMAND, pcmd->size);
+  if (pcmd->slots == NULL || pcmd->buf == NULL)
+  {
+    _redis_setMallocError();
+    redisPreparedCmd_free(pcmd);
+    return NULL;
+  }
+
+  p = pcmd->buf;
+  *p++ = '*';
+  p = _redis_writeNum(p, cmd->argsCount);
+  *p++ = '\r'; *p++ = '\n';
+  for (i = 0; i < cmd->argsCount; i++)
+  {
+    pcmd->slots[i] = p - pcmd->buf;
+    p = _redis_writeArg(p, (char *)cmd->args[i], bstr_len(cmd->args[i]));
+  }
+  return pcmd;
+}
+
+/**
+ * redisPreparedCmd_setArg:
+ * @pcmd: the #RedisPreparedCmd to modify.
+ * @argNum: index of the arg to modify (0 is the command name).
+ * @argVal: the new value of the arg.
+ * @argLen: the length of @argVal or <code>-1</code>.
+ *
+ * Replace the arg at index @argNum directly in the encoded command. Only the
+ * bytes following the arg are moved when its encoded size changes.
+ *
+ * Returns: %REDIS_NOERROR on success or the error code on error.
+ **/
+RedisErrorCode redisPreparedCmd_setArg(RedisPreparedCmd *pcmd,
+                                       int              argNum,
+                                       char             *argVal,
+                                       size_t           argLen)
+{
+  size_t  start, end, newSize, newLen;
+  ssize_t delta;
+  char    *buf;
+  int     i;
+
+  if (argNum < 0 || argNum >= pcmd->argsCount)
+    return _redis_setSrvError(REDIS_ERROR_CMD_INVALIDARGNUM);
+  if (argVal == NULL) return _redis_setSrvError(REDIS_ERROR_CMD_ARGS);
+  if (argLen == -1) argLen = strlen(argVal);
+
+  start = pcmd->slots[argNum];
+  end   = (argNum + 1 < pcmd->argsCount) ? pcmd->slots[argNum + 1] : pcmd->len;
+  newSize = _redis_argSize(argLen);
+  delta = newSize - (end - start);
+  newLen = pcmd->len + delta;
+  if (newLen > pcmd->size)
+  {
+    buf = (char *)bstr_memRealloc(BSTR_MEM_COMMAND, pcmd->buf,
+                                  newLen + newLen / 2);
+    if (buf == NULL) return _redis_setMallocError();
+    pcmd->buf  = buf;
+    pcmd->size = newLen + newLen / 2;
+  }
+  if (delta != 0)
+  {
+    memmove(pcmd->buf + end + delta, pcmd->buf + end, pcmd->len - end);
+    for (i = argNum + 1; i < pcmd->argsCount; i++)
+      pcmd->slots[i] += delta;
+    pcmd->len = newLen;
+  }
+  _redis_writeArg(pcmd->buf + start, argVal, argLen);
+  return REDIS_NOERROR;
+}
+
+/**
+ * redisPreparedCmd_exec:
+ * @redis: #REDIS structure to use.
+ * @pcmd: the #RedisPreparedCmd to execute.
+ *
+ * Send the encoded command as it is and receive the reply.
+ *
+ * Returns: a #RedisRetVal structure containing the response of the server or
+ * <code>NULL</code> on error and <code>redis_errCode</code> is set accordingly.
+ * The return value is owned by @pcmd and is freed on the next execution or
+ * when @pcmd is freed.
+ **/
+RedisRetVal* redisPreparedCmd_exec(REDIS *redis, RedisPreparedCmd *pcmd)
+{
+  bstr_t rdata;
+  char   *end;
+
+  if (pcmd->returnValue != NULL)
+  {
+    redisRetVal_free(pcmd->returnValue);
+    pcmd->returnValue = NULL;
+  }
+  if (_redis_sendBuf(redis, pcmd->buf, pcmd->len) != REDIS_NOERROR)
+    return NULL;
+  if ((rdata = _redis_receiveReplies(redis, 1, &end)) == NULL) return NULL;
+  pcmd->returnValue = _redis_parseReply(redis, (char *)rdata, NULL);
+  bstr_free(rdata);
+  return pcmd->returnValue;
+}
+
+/**
+ * redisPreparedCmd_free:
+ * @pcmd: the #RedisPreparedCmd to free.
+ *
+ * Free the memory allocated to @pcmd and to its last return value.
+ **/
+void redisPreparedCmd_free(RedisPreparedCmd *pcmd)
+{
+  if (pcmd == NULL) return;
+  if (pcmd->returnValue != NULL) redisRetVal_free(pcmd->returnValue);
+  if (pcmd->slots != NULL) bstr_memFree(pcmd->slots);
+  if (pcmd->buf != NULL) bstr_memFree(pcmd->buf);
+  bstr_memFree(pcmd);
+}
+
+/**
+ * redis_exec:
+ * @redis: #REDIS structure to use.
+ * @protocol: the protocol to use to communicate with Redis server.
+ * @cmdName: the Redis command to execute.
+ * @...: <code>NULL</code> terminated list of arg-argLen pairs.
+ *
+ * Execute the command described by @cmdName and the list of args. Last element
+ * of the list must be a literal <code>NULL</code>. The arguments must be in the
+ * form:
+ * <informalexample><programlisting>
+ * redis_exec(redis, protocol, cmdName, arg1, arglen1,
+ *                                      arg2, arglen2,
+ *                                      ...,
+ *                                      NULL);
+ * </programlisting></informalexample>
+ * otherwise the behavior is unpredictable.
+ *
+ * This is a shortcut to the sequence of the following functions:<sbr/>
+ * - redisCmd_new()<sbr/>
+ * - redisCmd_addArg() (optional depending of the command arguments).<sbr/>
+ * - redisCmd_buildProtocolStr().<sbr/>
+ * - redisCmd_exec().<sbr/>
+ *
+ * Returns: a #RedisRetVal structure or <code>NULL</code> on error and
+ * <code>redis_errCode</code> is set accordingly. It is recommended to free
+ * the return value with redisRetVal_free() when no longer needed.
+ **/
+RedisRetVal* redis_exec(REDIS *redis,
+                        RedisProtocolType protocol,
+                        char *cmdName,
+                        ...)
+{
+  va_list           ap;
+  RedisCmd          *cmd;
+  RedisRetVal       *ret;
+  bstr_t            rdata;
+  char              *end;
+  char              *arg;
+  int               arglen;
+
+  if (cmdName == NULL)
+  {
+    _redis_setSrvError(REDIS_ERROR_CMD_INVALID);
+    return NULL;
+  }
+  cmd = redisCmd_new(protocol, cmdName);
+  if (cmd == NULL) return NULL;
+
+  va_start(ap, cmdName);
+  while ((arg = va_arg(ap, char *)) != NULL)
+  {
+    arglen = va_arg(ap, int);
+    if (arglen == 0)
+    {
+      _redis_setSrvError(REDIS_ERROR_CMD_ARGS);
+      redisCmd_free(cmd);
+      va_end(ap);
+      return NULL;
+    }
+    arglen = (arglen == -1) ? strlen(arg)
+                            : arglen;
+    if (redisCmd_addArg(cmd, arg, arglen) != REDIS_NOERROR)
+    {
+      redisCmd_free(cmd);
+      va_end(ap);
+      return NULL;
+    }
+  }
+  va_end(ap);
+
+  if (redisCmd_buildProtocolStr(cmd) == NULL)
+  {
+    redisCmd_free(cmd);
+    return NULL;
+  }
+
+  if(_redis_send(redis, cmd->protocolString) != REDIS_NOERROR)
+  {
+    redisCmd_free(cmd);
+    return NULL;
+  }
+
+  if ((rdata = _redis_receiveReplies(redis, 1, &end)) == NULL)
+  {
+    redisCmd_free(cmd);
+    return NULL;
+  }
+  ret = _redis_parseReply(redis, (char *)rdata, NULL);
+
+  redisCmd_free(cmd);
+  bstr_free(rdata);
+
+  return ret;
+}
+
+/**
+ * redis_execStr:
+ * @redis: #REDIS structure to use.
+ * @protocol: the protocol to use to communicate with Redis server.
+ * @cmdStr: the Redis command sequence to execute.
+ * @cmdStrLen: @cmdStr length or <code>-1</code>
+ *
+ * Execute @cmdStr on the server and return the result as a #RedisRetVal structure.
+ * @cmdStr and @cmdStrLen meet the same requirement as those passed to
+ * redisCmd_newFromStr().
+ *
+ * In fact, redis_execStr() is a shortcut to the following call sequence:<sbr/>
+ * - redisCmd_newFromStr().<sbr/>
+ * - redisCmd_buildProtocolStr().<sbr/>
+ * - redisCmd_exec().<sbr/>
+ *
+ * 
+ *
+ *
+ * Returns: a  #RedisRetVal structure or <code>NULL</code> on error and
+ * <code>redis_errCode</code> is set accordingly. It is recommended to free
+ * the return value with redisRetVal_free() when no longer needed.
+ **/
+RedisRetVal* redis_execStr(REDIS *redis,
+                           RedisProtocolType protocol,
+                           char *cmdStr,
+                           int cmdStrLen)
+{
+  RedisCmd    *cmd;
+  RedisRetVal *ret;
+  bstr_t      cmdBStr;
+  bstr_t      rdata;
+  char        *end;
+
+  cmdBStr = bstr_new(cmdStr, cmdStrLen);
+  if (cmdBStr == NULL)
+  {
+    _redis_setMallocError();
+    return NULL;
+  }
+  if ((cmd = _redisCmd_newFromSqlString(protocol, cmdBStr)) == NULL)
+  {
+    redisCmd_free(cmd);
+    bstr_free(cmdBStr);
+    return NULL;
+  }
+  bstr_free(cmdBStr);
+
+  if (redisCmd_buildProtocolStr(cmd) == NULL)
+  {
+    redisCmd_free(cmd);
+    return NULL;
+  }
+
+  if(_redis_send(redis, cmd->protocolString) != REDIS_NOERROR)
+  {
+    redisCmd_free(cmd);
+    return NULL;
+  }
+
+  if ((rdata = _redis_receiveReplies(redis, 1, &end)) == NULL)
+  {
+    redisCmd_free(cmd);
+    return NULL;
+  }
+  ret = _redis_parseReply(redis, (char *)rdata, NULL);
+
+  redisCmd_free(cmd);
+  bstr_free(rdata);
+
+  return ret;
+}
+
+/*
+ * Encoding of caller owned argument vectors.
+ *
+ * Headers ("*<argc>", "$<len>", CRLF) and small args are written to a single
+ * scratch buffer; args of REDIS_ARGV_COPYLIMIT bytes or more are not copied
+ * and the iovec array sent to the server points directly to them.
+ */
+#define REDIS_ARGV_COPYLIMIT 512
+
+typedef struct
+{
+  struct iovec *iov;
+  int          iovCount;
+  char         *scratch;
+  char         *p;              /* Write position in scratch              */
+  char         *chunk;          /* Start of scratch data not in iov yet   */
+} RedisArgvEncoder;
+
+static size_t _redis_argvLen(const char **argv, const size_t *argvlen, int i)
+{
+  return (argvlen != NULL) ? argvlen[i] : strlen(argv[i]);
+}
+
+/* Add the scratch and iovec space needed to encode argv to *size and *iovCount */
+static void _redis_argvMeasure(int          argc,
+                               const char   **argv,
+                               const size_t *argvlen,
+                               size_t       *size,
+                               int          *iovCount)
+{
+  size_t len;
+  int    i;
+
+  *size += 1 + _redis_numLen(argc) + 2;
+  for (i = 0; i < argc; i++)
+  {
+    len = _redis_argvLen(argv, argvlen, i);
+    *size += 1 + _redis_numLen(len) + 2 + 2;
+    if (len < REDIS_ARGV_COPYLIMIT) *size += len;
+    else                            *iovCount += 2;
+  }
+}
+
+/* Close the current scratch chunk */
+static void _redis_argvFlush(RedisArgvEncoder *enc)
+{
+  if (enc->p == enc->chunk) return;
+  enc->iov[enc->iovCount].iov_base = enc->chunk;
+  enc->iov[enc->iovCount].iov_len  = enc->p - enc->chunk;
+  enc->iovCount++;
+  enc->chunk = enc->p;
+}
+
+static void _redis_argvEncode(RedisArgvEncoder *enc,
+                              int              argc,
+                              const char       **argv,
+                              const size_t     *argvlen)
+{
+  size_t len;
+  int    i;
+
+  *enc->p++ = '*';
+  enc->p = _redis_writeNum(enc->p, argc);
+  *enc->p++ = '\r'; *enc->p++ = '\n';
+  for (i = 0; i < argc; i++)
+  {
+    len = _redis_argvLen(argv, argvlen, i);
+    *enc->p++ = '$';
+    enc->p = _redis_writeNum(enc->p, len);
+    *enc->p++ = '\r'; *enc->p++ = '\n';
+    if (len < REDIS_ARGV_COPYLIMIT)
+    {
+      memcpy(enc->p, argv[i], len);
+      enc->p += len;
+    }
+    else
+    {
+      _redis_argvFlush(enc);
+      enc->iov[enc->iovCount].iov_base = (void *)argv[i];
+      enc->iov[enc->iovCount].iov_len  = len;
+      enc->iovCount++;
+    }
+    *enc->p++ = '\r'; *enc->p++ = '\n';
+  }
+}
+
+/*
+ * Encode and send cmdCount argument vectors as a single write.
+ * return REDIS_NOERROR or the error code.
+ */
+static int _redis_sendArgvs(REDIS        *redis,
+                            int          cmdCount,
+                            const int    *argcs,
+                            const char   ***argvs,
+                            const size_t **argvlens)
+{
+  RedisArgvEncoder enc;
+  size_t           size = 0;
+  int              iovCount = 1;
+  int              i, rc;
+
+  for (i = 0; i < cmdCount; i++)
+  {
+    if (argcs[i] <= 0 || argvs[i] == NULL)
+      return _redis_setSrvError(REDIS_ERROR_CMD_INVALID);
+    _redis_argvMeasure(argcs[i], argvs[i], argvlens ? argvlens[i] : NULL,
+                       &size, &iovCount);
+  }
+  enc.scratch  = (char *)bstr_memAlloc(BSTR_MEM_COMMAND, size);
+  enc.iov      = (struct iovec *)bstr_memAlloc(BSTR_MEM_COMMAND,
+                                               iovCount * sizeof(struct iovec));
+  if (enc.scratch == NULL || enc.iov == NULL)
+  {
+    bstr_memFree(enc.scratch);
+    bstr_memFree(enc.iov);
+    return _redis_setMallocError();
+  }
+  enc.iovCount = 0;
+  enc.p        = enc.scratch;
+  enc.chunk    = enc.scratch;
+  for (i = 0; i < cmdCount; i++)
+    _redis_argvEncode(&enc, argcs[i], argvs[i], argvlens ? argvlens[i] : NULL);
+  _redis_argvFlush(&enc);
+
+  rc = _redis_sendIov(redis, enc.iov, enc.iovCount);
+  bstr_memFree(enc.scratch);
+  bstr_memFree(enc.iov);
+  return rc;
+}
+
+/**
+ * redis_execArgv:
+ * @redis: #REDIS structure to use.
+ * @argc: number of elements in @argv.
+ * @argv: the command name followed by its args.
+ * @argvlen: the lengths of the elements of @argv or <code>NULL</code> if they
+ * are all <code>\0</code> terminated.
+ *
+ * Execute the command described by @argv. Unlike redis_exec(), the args are not
+ * copied into a #RedisCmd: the command is encoded with
+ * %REDIS_PROTOCOL_MULTIBULK straight from @argv, and large args are sent from
+ * the caller's buffers. Args may contain binary data and may be empty.
+ * <informalexample><programlisting>
+ * const char *argv[] = {"SET", key, value};
+ * size_t     argvlen[] = {3, keyLen, valueLen};
+ *
+ * rv = redis_execArgv(redis, 3, argv, argvlen);
+ * </programlisting></informalexample>
+ * @argv and @argvlen are only used during the call.
+ *
+ * Returns: a #RedisRetVal structure or <code>NULL</code> on error and
+ * <code>redis_errCode</code> is set accordingly. The return value should be
+ * freed with redisRetVal_free() when no longer needed.
+ **/
+RedisRetVal* redis_execArgv(REDIS        *redis,
+                            int          argc,
+                            const char   **argv,
+                            const size_t *argvlen)
+{
+  RedisRetVal *ret;
+  bstr_t      rdata;
+  char        *end;
+
+  if (_redis_sendArgvs(redis, 1, &argc, &argv, &argvlen) != REDIS_NOERROR)
+    return NULL;
+  if ((rdata = _redis_receiveReplies(redis, 1, &end)) == NULL) return NULL;
+  ret = _redis_parseReply(redis, (char *)rdata, NULL);
+  bstr_free(rdata);
+  return ret;
+}
+
+/**
+ * redis_execArgvArray:
+ * @redis: #REDIS structure to use.
+ * @cmdCount: number of commands.
+ * @argcs: the number of elements of each argument vector.
+ * @argvs: the argument vectors, one per command.
+ * @argvlens: the lengths of the elements of each argument vector, or
+ * <code>NULL</code> if all the args are <code>\0</code> terminated. Single
+ * entries can also be <code>NULL</code>.
+ *
+ * Pipelined counterpart of redis_execArgv(): all the commands are encoded
+ * from the caller's buffers, sent at once and their replies are retrieved
+ * with a single call, like redisCmdArray_exec() does.
+ *
+ * Returns: a <code>NULL</code> terminated array of #RedisRetVal (one per
+ * command) or <code>NULL</code> on error and <code>redis_errCode</code> is
+ * set accordingly. Each element should be freed with redisRetVal_free() and
+ * the array with bstr_memFree().
+ **/
+RedisRetVal** redis_execArgvArray(REDIS        *redis,
+                                  int          cmdCount,
+                                  const int    *argcs,
+                                  const char   ***argvs,
+                                  const size_t **argvlens)
+{
+  RedisRetVal **ret;
+  bstr_t      rdata;
+  char        *tail, *end;
+  int         i;
+
+  if (cmdCount <= 0)
+  {
+    _redis_setSrvError(REDIS_ERROR_CMD_INVALID);
+    return NULL;
+  }
+  if (_redis_sendArgvs(redis, cmdCount, argcs, argvs, argvlens) != REDIS_NOERROR)
+    return NULL;
+  rdata = _redis_receiveReplies(redis, cmdCount, &end);
+  if (rdata == NULL) return NULL;
+  ret = (RedisRetVal **)bstr_memAlloc(BSTR_MEM_OTHER,
+                                      (cmdCount + 1) * sizeof(RedisRetVal *));
+  if (ret == NULL)
+  {
+    bstr_free(rdata);
+    _redis_setMallocError();
+    return NULL;
+  }
+  tail = (char *)rdata;
+  for (i = 0; i < cmdCount; i++)
+    ret[i] = _redis_parseReply(redis, tail, &tail);
+  ret[cmdCount] = NULL;
+  bstr_free(rdata);
+  return ret;
+}
+
+/*
+ * Expand the directive at *fmt (which points to '%') and copy the result to
+ * out when out is not NULL. *fmt is moved past the directive.
+ * return the length of the expansion or -1 on an unknown directive or a NaN
+ * double.
+ */
+static ssize_t _redis_fmtDirective(const char **fmt, va_list *ap, char *out)
+{
+  const char *f = *fmt + 1;
+  char       numBuf[32];
+  char       *str;
+  size_t     len;
+  int        n;
+  int        lng = 0;
+
+  switch (*f)
+  {
+    case '%' :
+      str = "%";
+      len = 1;
+      break;
+    case 's' :
+      str = va_arg(*ap, char *);
+      len = strlen(str);
+      break;
+    case 'b' :
+      str = va_arg(*ap, char *);
+      len = va_arg(*ap, size_t);
+      break;
+    case 'f' :
+    case 'g' :
+      if ((n = _redis_formatDouble(numBuf, va_arg(*ap, double))) < 0) return -1;
+      len = n;
+      str = numBuf;
+      break;
+    default :
+      /* Integers: %d, %i, %u with optional l, ll or z length modifier */
+      if (*f == 'z')
+      {
+        lng = 3;
+        f++;
+      }
+      else
+        while (*f == 'l' && lng < 2)
+        {
+          lng++;
+          f++;
+        }
+      if (*f == 'd' || *f == 'i')
+      {
+        long long value;
+        value = (lng == 0) ? va_arg(*ap, int)
+              : (lng == 1) ? va_arg(*ap, long)
+              : (lng == 2) ? va_arg(*ap, long long)
+                           : va_arg(*ap, ssize_t);
+        len = snprintf(numBuf, sizeof(numBuf), "%lld", value);
+      }
+      else if (*f == 'u')
+      {
+        unsigned long long value;
+        value = (lng == 0) ? va_arg(*ap, unsigned int)
+              : (lng == 1) ? va_arg(*ap, unsigned long)
+              : (lng == 2) ? va_arg(*ap, unsigned long long)
+                           : va_arg(*ap, size_t);
+        len = snprintf(numBuf, sizeof(numBuf), "%llu", value);
+      }
+      else return -1;
+      str = numBuf;
+  }
+  *fmt = f + 1;
+  if (out != NULL) memcpy(out, str, len);
+  return len;
+}
+
+/* Number of args in fmt: one per run of non space characters */
+static int _redis_fmtArgCount(const char *fmt)
+{
+  int count = 0;
+
+  while (*fmt != '\0')
+  {
+    while (*fmt == ' ') fmt++;
+    if (*fmt == '\0') break;
+    count++;
+    while (*fmt != '\0' && *fmt != ' ') fmt++;
+  }
+  return count;
+}
+
+/*
+ * Walk fmt and its args. When out is NULL, the length of each arg is stored in
+ * lens; otherwise the args are encoded to out using the lengths of the first
+ * walk.
+ * return 0 or -1 on an unknown directive.
+ */
+static int _redis_fmtWalk(const char *fmt, va_list ap, size_t *lens, char *out)
+{
+  va_list aq;
+  char    *p = out;
+  ssize_t n;
+  int     argi = -1;
+
+  va_copy(aq, ap);
+  while (*fmt != '\0')
+  {
+    if (*fmt == ' ')
+    {
+      fmt++;
+      continue;
+    }
+    argi++;
+    if (out != NULL)
+    {
+      *p++ = '$';
+      p = _redis_writeNum(p, lens[argi]);
+      *p++ = '\r'; *p++ = '\n';
+    }
+    else lens[argi] = 0;
+
+    while (*fmt != '\0' && *fmt != ' ')
+    {
+      if (*fmt == '%')
+      {
+        n = _redis_fmtDirective(&fmt, &aq, p);
+        if (n < 0)
+        {
+          va_end(aq);
+          return -1;
+        }
+      }
+      else
+      {
+        if (out != NULL) *p = *fmt;
+        fmt++;
+        n = 1;
+      }
+      if (out != NULL) p += n;
+      else             lens[argi] += n;
+    }
+    if (out != NULL)
+    {
+      *p++ = '\r'; *p++ = '\n';
+    }
+  }
+  va_end(aq);
+  return 0;
+}
+
+/*
+ * Encode the command described by format and ap to the output buffer of redis.
+ * return REDIS_NOERROR and the encoded length in *size, or the error code.
+ */
+static int _redis_formatCommand(REDIS      *redis,
+                                const char *format,
+                                va_list    ap,
+                                size_t     *size)
+{
+  size_t stackLens[32];
+  size_t *lens = stackLens;
+  char   *buf;
+  int    argc, i, rc;
+
+  argc = (format != NULL) ? _redis_fmtArgCount(format) : 0;
+  if (argc == 0) return _redis_setSrvError(REDIS_ERROR_CMD_INVALID);
+  if (argc > 32)
+  {
+    lens = (size_t *)bstr_memAlloc(BSTR_MEM_OTHER, argc * sizeof(size_t));
+    if (lens == NULL) return _redis_setMallocError();
+  }
+
+  rc = REDIS_NOERROR;
+  if (_redis_fmtWalk(format, ap, lens, NULL) != 0)
+    rc = _redis_setSrvError(REDIS_ERROR_CMD_ARGS);
+  else
+  {
+    *size = 1 + _redis_numLen(argc) + 2;
+    for (i = 0; i < argc; i++)
+      *size += 1 + _redis_numLen(lens[i]) + 2 + lens[i] + 2;
+    if (*size > redis->outBufSize)
+    {
+      buf = (char *)bstr_memRealloc(BSTR_MEM_CONNECTION, redis->outBuf, *size);
+      if (buf == NULL) rc = _redis_setMallocError();
+      else
+      {
+        redis->outBuf     = buf;
+        redis->outBufSize = *size;
+      }
+    }
+  }
+  if (rc == REDIS_NOERROR)
+  {
+    buf = redis->outBuf;
+    *buf++ = '*';
+    buf = _redis_writeNum(buf, argc);
+    *buf++ = '\r'; *buf++ = '\n';
+    _redis_fmtWalk(format, ap, lens, buf);
+  }
+  if (lens != stackLens) bstr_memFree(lens);
+  return rc;
+}
+
+/**
+ * redis_execFmt:
+ * @redis: #REDIS structure to use.
+ * @format: the command, printf-like.
+ * @...: the values of the directives of @format.
+ *
+ * Format a command and execute it. Each run of non space characters of @format
+ * is one argument of the command, whatever the directives it contains expand
+ * to (a "%s" expanding to a string with spaces is still one argument).
+ * Supported directives are:<sbr/>
+ * - %s: a <code>\0</code> terminated string.<sbr/>
+ * - %b: a binary safe string, given as a <code>char *</code> and a
+ * <code>size_t</code> length.<sbr/>
+ * - %d, %i, %u with an optional l, ll or z modifier: integers.<sbr/>
+ * - %f, %g: a double, written as by redisCmd_addArgDouble() (NaN is rejected).<sbr/>
+ * - %%: a literal '%'.
+ * <informalexample><programlisting>
+ * rv = redis_execFmt(redis, "SET user:%d %b EX %lld", id, buf, len, ttl);
+ * </programlisting></informalexample>
+ * The command is encoded with %REDIS_PROTOCOL_MULTIBULK directly into the
+ * output buffer of @redis; no #RedisCmd nor argument copy is created.
+ *
+ * Returns: a #RedisRetVal structure or <code>NULL</code> on error and
+ * <code>redis_errCode</code> is set accordingly. The return value should be
+ * freed with redisRetVal_free() when no longer needed.
+ **/
+RedisRetVal* redis_execFmt(REDIS *redis, const char *format, ...)
+{
+  va_list     ap;
+  RedisRetVal *ret;
+  bstr_t      rdata;
+  char        *end;
+  size_t      size;
+  int         rc;
+
+  va_start(ap, format);
+  rc = _redis_formatCommand(redis, format, ap, &size);
+  va_end(ap);
+  if (rc != REDIS_NOERROR) return NULL;
+
+  if (_redis_sendBuf(redis, redis->outBuf, size) != REDIS_NOERROR) return NULL;
+  if ((rdata = _redis_receiveReplies(redis, 1, &end)) == NULL) return NULL;
+  ret = _redis_parseReply(redis, (char *)rdata, NULL);
+  bstr_free(rdata);
+  return ret;
+}
+
+/**
+ * redis_hello:
+ * @redis: #REDIS structure to use.
+ * @protocolVersion: RESP version to switch to (2 or 3).
+ *
+ * Send <code>HELLO @protocolVersion</code> to the server. Once the server has
+ * accepted version 3, replies use the RESP3 types: HGETALL returns a
+ * %REDIS_RETURN_MAP, scores are returned as %REDIS_RETURN_DOUBLE, ...
+ * Requests are still sent with the protocol given to each command.
+ *
+ * Returns: the reply of the server (a map describing the server on success,
+ * an error if the server does not support HELLO) or <code>NULL</code> on error
+ * and <code>redis_errCode</code> is set accordingly. It is recommended to free
+ * the return value with redisRetVal_free() when no longer needed.
+ **/
+RedisRetVal* redis_hello(REDIS *redis, int protocolVersion)
+{
+  RedisRetVal *rv;
+  char        version[12];
+
+  snprintf(version, sizeof(version), "%d", protocolVersion);
+  rv = redis_exec(redis, REDIS_PROTOCOL_MULTIBULK, "HELLO", version, -1, NULL);
+  if (rv == NULL) return NULL;
+  if (redisRetVal_getType(rv) != REDIS_RETURN_ERROR)
+    redis->protocolVersion = protocolVersion;
+  return rv;
+}
+
+/**
+ * redis_setArena:
+ * @redis: #REDIS structure to use.
+ * @arena: arena to allocate replies from or <code>NULL</code>.
+ *
+ * Allocate the replies received on @redis (the #RedisRetVal structures, their
+ * elements and their strings) from @arena instead of the heap. Parsing a reply
+ * then costs a few pointer bumps and redisRetVal_free() does nothing on it:
+ * all the replies are released at once by bstr_arenaReset() or
+ * bstr_arenaFree(), after which they must no longer be used. Passing
+ * <code>NULL</code> goes back to heap allocated replies.
+ **/
+void redis_setArena(REDIS *redis, bstr_arena_t *arena)
+{
+  redis->arena = arena;
+}
+
+/**
+ * redis_setWaitFunc:
+ * @redis: #REDIS structure to use.
+ * @waitFunc: function waiting for the socket of @redis or <code>NULL</code>.
+ * @userData: passed to @waitFunc.
+ *
+ * Let @waitFunc wait whenever @redis has to wait for the server, instead of
+ * blocking the thread in <function>select()</function>. @waitFunc gets the
+ * socket, the #RedisWaitEvent it must become ready for and the deadline of the
+ * operation, in microseconds of <code>CLOCK_MONOTONIC</code>. It returns 1
+ * once the socket is ready, 0 if the deadline passed and -1 on error with
+ * <code>errno</code> set, like <function>select()</function>.
+ *
+ * This lets a coroutine or green thread scheduler suspend the caller and run
+ * other tasks until the socket is ready (epoll, io_uring, ...), so that every
+ * call on @redis behaves as a blocking call for the coroutine only. For this,
+ * the socket is switched to non-blocking mode while a wait function is set,
+ * and a spurious readiness just makes @waitFunc called again. Passing
+ * <code>NULL</code> goes back to <function>select()</function> and a blocking
+ * socket. Note that redis_connect() still connects with a blocking call.
+ *
+ * Returns: %REDIS_NOERROR or %REDIS_ERROR_CNX_SOCKET if the mode of the
+ * socket could not be changed.
+ **/
+RedisErrorCode redis_setWaitFunc(REDIS         *redis,
+                                 RedisWaitFunc waitFunc,
+                                 void          *userData)
+{
+  int flags;
+
+  if ((flags = fcntl(redis->fd, F_GETFL)) == -1 ||
+      fcntl(redis->fd, F_SETFL, waitFunc ? (flags | O_NONBLOCK)
+                                         : (flags & ~O_NONBLOCK)) == -1)
+    return _redis_setCnxError(redis, REDIS_ERROR_CNX_SOCKET, errno);
+  redis->waitFunc = waitFunc;
+  redis->waitData = userData;
+  return REDIS_NOERROR;
+}
+
+/**
+ * redis_setAllocator:
+ * @mallocFunc: function replacing <function>malloc()</function>.
+ * @callocFunc: function replacing <function>calloc()</function>.
+ * @reallocFunc: function replacing <function>realloc()</function>.
+ * @freeFunc: function replacing <function>free()</function>.
+ * @ctx: pointer passed as is to the functions above.
+ *
+ * Make every allocation of libredis (connections, commands, replies and
+ * bstrings) go through the given functions, see bstr_setAllocator(). It must
+ * be called before any other libredis function. Memory handed to the caller
+ * to free, like the array returned by redis_execArgvArray(), should then be
+ * freed with bstr_memFree().
+ *
+ * Building libredis with <code>BSTR_MEM_STATS</code> defined adds a counting
+ * mode reporting the memory used by each part of the library, see
+ * bstr_memStats().
+ **/
+void redis_setAllocator(bstr_mallocFunc  mallocFunc,
+                        bstr_callocFunc  callocFunc,
+                        bstr_reallocFunc reallocFunc,
+                        bstr_freeFunc    freeFunc,
+                        void             *ctx)
+{
+  bstr_setAllocator(mallocFunc, callocFunc, reallocFunc, freeFunc, ctx);
+}
+
+/**
+ * redis_getProtocolVersion:
+ * @redis: a #REDIS structure.
+ *
+ * Get the RESP version used by the server to reply on this connection.
+ *
+ * Returns: 2 unless redis_hello() switched the connection to another version.
+ **/
+int redis_getProtocolVersion(REDIS *redis)
+{
+  return redis->protocolVersion;
+}
+
+/**
+ * redisCmdArray_new:
+ *
+ * 
+ *
+ * Returns: 
+ **/
+RedisCmdArray* redisCmdArray_new()
+{
+  RedisCmdArray *cmdArray;
+  cmdArray = (RedisCmdArray *)bstr_memAlloc(BSTR_MEM_COMMAND,
+                                            sizeof(RedisCmdArray));
+  if (cmdArray == NULL)
+  {
+    _redis_setMallocError();
+    return NULL;
+  }
+  cmdArray->cmds             = NULL;
+  cmdArray->returnValues     = NULL;
+  cmdArray->cmdCount         = 0;
+  cmdArray->cmdsSize         = 0;
+  cmdArray->spareCount       = 0;
+  cmdArray->returnValuesSize = 0;
+  cmdArray->protocolString   = NULL;
+  cmdArray->protocolBuffer   = NULL;
+  return cmdArray;
+}
+
+/**
+ * redisCmdArray_free:
+ * @cmdArray: 
+ *
+ * 
+ **/
+void redisCmdArray_free(RedisCmdArray *cmdArray)
+{
+ if (cmdArray == NULL) return;
+ if (cmdArray->protocolString != NULL) bstr_free(cmdArray->protocolString);
+ if (cmdArray->protocolBuffer != NULL) bstr_free(cmdArray->protocolBuffer);
+ if (cmdArray->cmds != NULL)
+ {
+   int i;
+   for (i = 0; i < cmdArray->cmdCount; i++)
+     redisCmd_free(cmdArray->cmds[i]);
+   for (i = cmdArray->cmdsSize - cmdArray->spareCount; i < cmdArray->cmdsSize; i++)
+     redisCmd_free(cmdArray->cmds[i]);
+   bstr_memFree(cmdArray->cmds);
+ }
+ if (cmdArray->returnValues != NULL)bstr_memFree(cmdArray->returnValues);
+ bstr_memFree(cmdArray);
+}
+
+/*
+ * Mark the pipeline string as outdated. Its memory is kept for the next
+ * redisCmdArray_buildProtocolStr().
+ */
+static void _redisCmdArray_dropProtocolStr(RedisCmdArray *cmdArray)
+{
+  if (cmdArray->protocolString == NULL) return;
+  if (cmdArray->protocolBuffer != NULL) bstr_free(cmdArray->protocolBuffer);
+  cmdArray->protocolBuffer = cmdArray->protocolString;
+  cmdArray->protocolString = NULL;
+}
+
+/**
+ * redisCmdArray_reset:
+ * @cmdArray: the #RedisCmdArray to reset.
+ *
+ * Remove all the commands of @cmdArray (and their return values) so it can be
+ * filled again, keeping the memory already allocated: the commands array, the
+ * return values array, the protocol string and the commands themselves (with
+ * their args strings), which are reused by redisCmdArray_addArgv(). A batch
+ * loop doing
+ * <informalexample><programlisting>
+ * while (running)
+ * {
+ *   for (i = 0; i < count; i++)
+ *     redisCmdArray_addArgv(batch, argc, argv[i], argvlen[i]);
+ *   redisCmdArray_exec(redis, batch);
+ *   redisCmdArray_reset(batch);
+ * }
+ * </programlisting></informalexample>
+ * does not grow or reallocate these structures once the largest batch has been
+ * seen.
+ **/
+void redisCmdArray_reset(RedisCmdArray *cmdArray)
+{
+  RedisCmd *cmd;
+  int      i;
+
+  /*
+   * Move the commands to the spare area at the end of the array. Going
+   * backward guarantees a spare slot never holds a command not moved yet.
+   */
+  for (i = cmdArray->cmdCount - 1; i >= 0; i--)
+  {
+    cmd = cmdArray->cmds[i];
+    /* Commands of an arena may not outlive it, they are not kept */
+    if (cmd->arena != NULL)
+    {
+      redisCmd_free(cmd);
+      continue;
+    }
+    redisCmd_reset(cmd, NULL);
+    cmdArray->spareCount++;
+    cmdArray->cmds[cmdArray->cmdsSize - cmdArray->spareCount] = cmd;
+  }
+  cmdArray->cmdCount = 0;
+  if (cmdArray->cmds != NULL) cmdArray->cmds[0] = NULL;
+  if (cmdArray->returnValues != NULL) cmdArray->returnValues[0] = NULL;
+  _redisCmdArray_dropProtocolStr(cmdArray);
+}
+
+/*
+ * Append cmd to cmdArray, which becomes its owner.
+ * return REDIS_NOERROR or the error code.
+ */
+static int _redisCmdArray_append(RedisCmdArray *cmdArray, RedisCmd *cmd)
+{
+  RedisCmd **cmds;
+  int      size;
+
+  /* Room for the new RedisCmd, the NULL termination and the spare commands */
+  if (cmdArray->cmdCount + 2 > cmdArray->cmdsSize - cmdArray->spareCount &&
+      cmdArray->spareCount > 0)
+  {
+    /* Spare commands are not worth growing the array: drop one */
+    redisCmd_free(cmdArray->cmds[cmdArray->cmdsSize - cmdArray->spareCount]);
+    cmdArray->spareCount--;
+  }
+  if (cmdArray->cmdCount + 2 + cmdArray->spareCount > cmdArray->cmdsSize)
+  {
+    size = cmdArray->cmdsSize ? cmdArray->cmdsSize * 2 : 16;
+    cmds = (RedisCmd **)bstr_memRealloc(BSTR_MEM_COMMAND, cmdArray->cmds,
+                                        size * sizeof(RedisCmd *));
+    if (cmds == NULL)
+      return _redis_setMallocError();
+    /* Spare commands stay at the end of the array */
+    memmove(cmds + size - cmdArray->spareCount,
+            cmds + cmdArray->cmdsSize - cmdArray->spareCount,
+            cmdArray->spareCount * sizeof(RedisCmd *));
+    cmdArray->cmds     = cmds;
+    cmdArray->cmdsSize = size;
+  }
+  cmdArray->cmds[cmdArray->cmdCount] = cmd;
+  cmdArray->cmdCount++;
+  cmdArray->cmds[cmdArray->cmdCount] = NULL;
+  /* The pipeline string no longer matches the commands */
+  _redisCmdArray_dropProtocolStr(cmdArray);
+  return REDIS_NOERROR;
+}
+
+/**
+ * redisCmdArray_addCmd:
+ * @cmdArray: 
+ * @cmd: 
+ *
+ * 
+ *
+ * Returns: 
+ **/
+RedisErrorCode redisCmdArray_addCmd(RedisCmdArray *cmdArray, RedisCmd *cmd)
+{
+  RedisCmd *cmdCopy;
+  int      rc;
+
+  if ((cmdCopy = _redisCmd_dup(cmd)) == NULL)
+      return redis_errCode;
+  if ((rc = _redisCmdArray_append(cmdArray, cmdCopy)) != REDIS_NOERROR)
+    redisCmd_free(cmdCopy);
+  return rc;
+}
+
+/**
+ * redisCmdArray_takeCmd:
+ * @cmdArray: the #RedisCmdArray to add @cmd to.
+ * @cmd: the #RedisCmd to add.
+ *
+ * Add @cmd to @cmdArray without copying it, unlike redisCmdArray_addCmd().
+ * On success, @cmd belongs to @cmdArray and is freed by redisCmdArray_free();
+ * the caller must not free it. On error, @cmd still belongs to the caller.
+ *
+ * Returns: %REDIS_NOERROR on success or the error code on error.
+ **/
+RedisErrorCode redisCmdArray_takeCmd(RedisCmdArray *cmdArray, RedisCmd *cmd)
+{
+  if (cmd == NULL || cmd->argsCount == 0)
+    return _redis_setSrvError(REDIS_ERROR_CMD_INVALID);
+  return _redisCmdArray_append(cmdArray, cmd);
+}
+
+/**
+ * redisCmdArray_addArgv:
+ * @cmdArray: the #RedisCmdArray to add the command to.
+ * @argc: number of elements in @argv.
+ * @argv: the command name followed by its args.
+ * @argvlen: the lengths of the elements of @argv or <code>NULL</code> if they
+ * are all <code>\0</code> terminated.
+ *
+ * Append the command described by @argv to @cmdArray, encoded with
+ * %REDIS_PROTOCOL_MULTIBULK. Each arg is copied once, directly into the
+ * command stored by @cmdArray; no intermediate #RedisCmd is built and copied.
+ *
+ * Returns: %REDIS_NOERROR on success or the error code on error.
+ **/
+RedisErrorCode redisCmdArray_addArgv(RedisCmdArray *cmdArray,
+                                     int           argc,
+                                     const char    **argv,
+                                     const size_t  *argvlen)
+{
+  RedisCmd *cmd;
+  size_t   len;
+  char     *p;
+  int      i, rc;
+
+  if (argc <= 0 || argv == NULL)
+    return _redis_setSrvError(REDIS_ERROR_CMD_INVALID);
+  if (cmdArray->spareCount > 0)
+  {
+    /* Reuse a command left by redisCmdArray_reset() */
+    cmd = cmdArray->cmds[cmdArray->cmdsSize - cmdArray->spareCount];
+    cmdArray->spareCount--;
+    cmd->protocolType = REDIS_PROTOCOL_MULTIBULK;
+  }
+  else if ((cmd = redisCmd_new(REDIS_PROTOCOL_MULTIBULK, NULL)) == NULL)
+    return redis_errCode;
+  if (_redisCmd_reserveArgs(cmd, argc) != REDIS_NOERROR)
+  {
+    redisCmd_free(cmd);
+    return redis_errCode;
+  }
+  for (i = 0; i < argc; i++)
+  {
+    len = (argvlen != NULL) ? argvlen[i] : strlen(argv[i]);
+    if ((p = _redisCmd_newArg(cmd, len)) == NULL)
+    {
+      redisCmd_free(cmd);
+      return redis_errCode;
+    }
+    memcpy(p, argv[i], len);
+  }
+  if ((rc = _redisCmdArray_append(cmdArray, cmd)) != REDIS_NOERROR)
+    redisCmd_free(cmd);
+  return rc;
+}
+
+/**
+ * redisCmdArray_buildProtocolStr:
+ * @cmdArray: the #RedisCmdArray to encode.
+ *
+ * Build the protocol string sent by redisCmdArray_exec(), the concatenation of
+ * the protocol strings of all the commands of @cmdArray. Its size is computed
+ * first and it is filled in a single pass; multibulk commands with no protocol
+ * string yet are encoded directly into it.
+ *
+ * Returns: the protocol string (owned by @cmdArray) or <code>NULL</code> on
+ * error and <code>redis_errCode</code> is set accordingly.
+ **/
+bstr_t redisCmdArray_buildProtocolStr(RedisCmdArray *cmdArray)
+{
+  RedisCmd *cmd;
+  size_t   size = 0;
+  char     *p;
+  int      i;
+  bstr_t   ret;
+
+  for (i=0; i < cmdArray->cmdCount; i++)
+  {
+    cmd = cmdArray->cmds[i];
+    if (cmd->protocolString != NULL)
+      size += bstr_len(cmd->protocolString);
+    else if (cmd->protocolType == REDIS_PROTOCOL_MULTIBULK)
+      size += _redisCmd_multiBulkSize(cmd);
+    else if (redisCmd_buildProtocolStr(cmd) != NULL)
+      size += bstr_len(cmd->protocolString);
+    else
+      return NULL;
+  }
+  /* Rebuild in the memory of the previous pipeline string */
+  if (cmdArray->protocolString == NULL)
+  {
+    cmdArray->protocolString = cmdArray->protocolBuffer;
+    cmdArray->protocolBuffer = NULL;
+  }
+  if ((ret = bstr_setLen(cmdArray->protocolString, size)) == NULL)
+  {
+    _redis_setMallocError();
+    return NULL;
+  }
+  p = (char *)ret;
+  for (i=0; i < cmdArray->cmdCount; i++)
+  {
+    cmd = cmdArray->cmds[i];
+    if (cmd->protocolString != NULL)
+    {
+      memcpy(p, cmd->protocolString, bstr_len(cmd->protocolString));
+      p += bstr_len(cmd->protocolString);
+    }
+    else
+      p = _redisCmd_writeMultiBulk(cmd, p);
+  }
+  cmdArray->protocolString = ret;
+  return ret;
+}
+
+/*
+ * Make room in cmdArray->returnValues for one reply per command and the NULL
+ * terminator.
+ * return REDIS_NOERROR or the error code.
+ */
+static int _redisCmdArray_reserveRetVals(RedisCmdArray *cmdArray)
+{
+  RedisRetVal **ret;
+  int         size;
+
+  if (cmdArray->cmdCount + 1 <= cmdArray->returnValuesSize)
+    return REDIS_NOERROR;
+  /* Sized like cmds, so it follows its geometric growth */
+  size = (cmdArray->cmdsSize > cmdArray->cmdCount) ? cmdArray->cmdsSize
+                                                   : cmdArray->cmdCount + 1;
+  ret = (RedisRetVal **)bstr_memRealloc(BSTR_MEM_COMMAND, cmdArray->returnValues,
+                                        size * sizeof(RedisRetVal *));
+  if (ret == NULL) return _redis_setMallocError();
+  cmdArray->returnValues     = ret;
+  cmdArray->returnValuesSize = size;
+  return REDIS_NOERROR;
+}
+
+/**
+ * redisCmdArray_exec:
+ * @redis: 
+ * @cmdArray: 
+ *
+ * 
+ *
+ * Returns: 
+ **/
+RedisRetVal** redisCmdArray_exec(REDIS *redis, RedisCmdArray *cmdArray)
+{
+  bstr_t            rdata;
+  char              *tail, *end;
+  RedisRetVal       *rv;
+  RedisRetVal       **ret;
+  int               rc, i;
+
+  if (cmdArray->cmdCount <= 0)
+  {
+    _redis_setSrvError(REDIS_ERROR_CMD_INVALID);
+    return NULL;
+  }
+  if (cmdArray->protocolString == NULL)
+    if (redisCmdArray_buildProtocolStr(cmdArray) == NULL) return NULL;
+
+  rc = _redis_send(redis, cmdArray->protocolString);
+  if (rc != REDIS_NOERROR) return NULL;
+
+  rdata = _redis_receiveReplies(redis, cmdArray->cmdCount, &end);
+  if (rdata == NULL) return NULL;
+  if (_redisCmdArray_reserveRetVals(cmdArray) != REDIS_NOERROR)
+  {
+    bstr_free(rdata);
+    return NULL;
+  }
+  ret = cmdArray->returnValues;
+  tail = (char *)rdata;
+  for (i=0; i < cmdArray->cmdCount; i++)
+  {
+    rv = _redis_parseReply(redis, tail, &tail);
+    if (cmdArray->cmds[i]->returnValue != NULL)
+      redisRetVal_free(cmdArray->cmds[i]->returnValue);
+    cmdArray->cmds[i]->returnValue = rv;
+    ret[i] = rv;
+  }
+  ret[cmdArray->cmdCount] = NULL;
+  bstr_free(rdata);
+  return ret;
+
+}
+
+/**
+ * redisCmdArray_execStream:
+ * @redis: #REDIS structure to use.
+ * @cmdArray: #RedisCmdArray to execute.
+ * @handler: callbacks receiving the replies.
+ * @userData: pointer passed to the callbacks.
+ *
+ * Pipelined counterpart of redisCmd_execStream(): the replies of all the
+ * commands of @cmdArray are reported, in order, through @handler.
+ *
+ * Returns: %REDIS_NOERROR on success or the error code on error.
+ **/
+RedisErrorCode redisCmdArray_execStream(REDIS             *redis,
+                                        RedisCmdArray     *cmdArray,
+                                        RedisReplyHandler *handler,
+                                        void              *userData)
+{
+  if (cmdArray->protocolString == NULL)
+    if (redisCmdArray_buildProtocolStr(cmdArray) == NULL) return redis_errCode;
+
+  if (_redis_send(redis, cmdArray->protocolString) != REDIS_NOERROR)
+    return redis_errCode;
+  return _redis_receiveStream(redis, handler, userData, cmdArray->cmdCount);
+}
+
+/**
+ * redisCmdArray_getProtocolStr:
+ * @cmdArray: 
+ *
+ * 
+ *
+ * Returns: 
+ **/
+bstr_t redisCmdArray_getProtocolStr(RedisCmdArray *cmdArray)
+{
+  return cmdArray->protocolString ? cmdArray->protocolString
+                                  : redisCmdArray_buildProtocolStr(cmdArray);
+}
+
+RedisCmd** redisCmdArray_getCmds(RedisCmdArray *cmdArray)
+{
+  return cmdArray->cmds;
+}
+
+int redisCmdArray_getCmdCount(RedisCmdArray *cmdArray)
+{
+  return cmdArray->cmdCount;
+}
+
+/**
+ * redisCmdArray_getRetVals:
+ * @cmdArray: 
+ *
+ * 
+ *
+ * Returns: 
+ **/
+RedisRetVal**  redisCmdArray_getRetVals(RedisCmdArray *cmdArray)
+{
+  RedisRetVal **ret;
+  int i;
+
+  if (_redisCmdArray_reserveRetVals(cmdArray) != REDIS_NOERROR) return NULL;
+  ret = cmdArray->returnValues;
+  for (i=0; i < cmdArray->cmdCount; i++)
+    ret[i] = cmdArray->cmds[i]->returnValue;
+  ret[cmdArray->cmdCount] = NULL;
+  return ret;
+}
+
+/**
+ * redisMulti_begin:
+ * @redis: 
+ *
+ * 
+ *
+ * Returns: 
+ **/
+RedisErrorCode redisMulti_begin(REDIS *redis)
+{
+  RedisRetVal *rv;
+  rv = redis_execStr(redis, REDIS_PROTOCOL_MULTIBULK, "MULTI", -1);
+  if (rv == NULL) return redis_errCode;
+
+  if (redisRetVal_getType(rv) == REDIS_RETURN_ERROR)
+    _redis_setCnxError(redis, REDIS_ERROR_MLT_UNSUPPORTED, 0);
+
+  redis->multiMode = 1;
+  redisRetVal_free(rv);
+  return REDIS_NOERROR;
+}
+
+/**
+ * redisMulti_exec:
+ * @redis: 
+ *
+ * 
+ *
+ * Returns: 
+ **/
+RedisRetVal** redisMulti_exec(REDIS *redis)
+{
+  RedisCmd    *cmd;
+  bstr_t      protocolStr;
+  RedisRetVal **ret;
+  int         retSize;
+  int         rc;
+  bstr_t      rdata;
+  char        *end;
+  char        *p;
+  int         i;
+
+  if (!redis->multiMode)
+  {
+    _redis_setCnxError(redis, REDIS_ERROR_MLT_NOTMULTIMODE, 0);
+    return NULL;
+  }
+  cmd = redisCmd_new(REDIS_PROTOCOL_MULTIBULK, "EXEC");
+  if (cmd == NULL) return NULL;
+  protocolStr = redisCmd_buildProtocolStr(cmd);
+  if (protocolStr == NULL)return NULL;
+  rc = _redis_send(redis, cmd->protocolString);
+  redis->multiMode = 0;
+  redisCmd_free(cmd);
+  if (rc != REDIS_NOERROR) return NULL;
+
+  rdata = _redis_receiveReplies(redis, 1, &end);
+  if (rdata == NULL) return NULL;
+
+  /* Bypass '*' */
+  p = (char *)rdata +1;
+  /* Get the multiBulk size */
+  retSize = strtol(p, &p, 0);
+  ret = (RedisRetVal **)bstr_memAlloc(BSTR_MEM_OTHER,
+                                      (retSize + 1) * sizeof(RedisRetVal *));
+  if (ret == NULL)
+  {
+    bstr_free(rdata);
+    _redis_setMallocError();
+    return NULL;
+  }
+
+  /* Bypass "\r\n" */
+  p += 2;
+  for (i=0; i < retSize; i++)
+    ret[i] = _redis_parseReply(redis, p, &p);
+  ret[retSize] = NULL;
+  bstr_free(rdata);
+  return ret;
+}
+
+/**
+ * redisMulti_discard:
+ * @redis: 
+ *
+ * 
+ *
+ * Returns: 
+ **/
+RedisErrorCode redisMulti_discard(REDIS *redis)
+{
+  RedisRetVal *rv;
+  if (!redis->multiMode)
+    return _redis_setCnxError(redis, REDIS_ERROR_MLT_NOTMULTIMODE, 0);
 
-  if (cmd->returnValue != NULL)
+  rv = redis_execStr(redis, REDIS_PROTOCOL_MULTIBULK, "DISCARD", -1);
+  if (rv == NULL) return redis_errCode;
+
+  if (redisRetVal_getType(rv) == REDIS_RETURN_ERROR)
+    _redis_setCnxError(redis, REDIS_ERROR_MLT_UNSUPPORTED, 0);
+
+  redis->multiMode = 0;
+  redisRetVal_free(rv);
+  return REDIS_NOERROR;
+}
+
+/**
+ * redisMulti_isMultiMode:
+ * @redis: #REDIS structure to use.
+ *
+ * Tell whether a transaction was started on @redis with redisMulti_begin()
+ * and is not executed or discarded yet.
+ *
+ * Returns: 1 in a transaction, 0 otherwise.
+ **/
+int redisMulti_isMultiMode(REDIS *redis)
+{
+  return redis->multiMode;
+}
+
+/*
+ * Multiplexed connections.
+ *
+ * A RedisMux shares one connection between any number of threads. Submitted
+ * commands go through a bounded ring with one slot per queued future: a
+ * producer claims a slot with a compare-and-swap on the enqueue position and
+ * publishes it by bumping the sequence number of the slot, the I/O thread is
+ * the only consumer. Producers make no system call unless the I/O thread is
+ * asleep (it announces it in sleeping) or the ring is full. A producer finding
+ * the ring full spins a little, then counts itself in fullWaiters and sleeps
+ * on spaceCond until the I/O thread hands slots back.
+ *
+ * On each wakeup, the I/O thread takes what is published, at most a ring's
+ * worth, sends it with a single writev() and completes the futures in FIFO
+ * order while the replies arrive. Completion is a flag of the future; threads
+ * blocked in redisFuture_wait() count themselves in waiters and sleep on
+ * doneCond, which is only broadcast when that count is not 0.
+ */
+#define REDIS_MUX_RINGSIZE 1024 /* Must be a power of 2 */
+#define REDIS_MUX_SPINS    64   /* Yields on a full ring before sleeping  */
+
+struct _RedisFuture
+{
+  bstr_t          request;      /* Encoded command                        */
+  RedisRetVal     *reply;
+  int             errCode;      /* Error of the command, if any           */
+  int             sysErrno;
+  int             done;         /* Set (atomically) once reply is final   */
+  RedisMux        *mux;         /* Multiplexer of the command, if any     */
+  REDIS           *redis;       /* Pipelined connection of the command    */
+  RedisFuture     *next;        /* Next in-flight command                 */
+};
+
+typedef struct
+{
+  size_t          seq;          /* Position the slot is ready for         */
+  RedisFuture     *future;
+} RedisMuxSlot;
+
+struct _RedisMux
+{
+  REDIS           *redis;
+  pthread_t       thread;
+  RedisMuxSlot    *ring;
+  pthread_mutex_t lock;         /* Only guards sleeping on the conditions */
+  pthread_cond_t  workCond;     /* Commands were queued or stop is set    */
+  pthread_cond_t  doneCond;     /* Futures were completed                 */
+  pthread_cond_t  spaceCond;    /* Slots were handed back to producers    */
+  int             sleeping;     /* The I/O thread waits on workCond       */
+  int             waiters;      /* Threads waiting on doneCond            */
+  int             fullWaiters;  /* Producers waiting on spaceCond         */
+  int             stop;
+  int             refs;         /* The owner and the futures not freed    */
+  int             errCode;      /* Set once the connection is broken      */
+  int             sysErrno;
+  /* Written by every producer, kept away from the fields above */
+  char            pad[64];
+  size_t          enqueuePos;
+  char            pad2[64];
+  /* Used by the I/O thread only */
+  size_t          dequeuePos;
+  bstr_t          inBuf;
+  struct iovec    *iov;
+  int             iovSize;
+};
+
+/* State of the search for the end of a reply, kept between reads */
+typedef struct
+{
+  size_t offset;                /* Bytes of the buffer already scanned    */
+  long   pending;               /* Values left to scan, 0 between replies */
+} RedisReplyScan;
+
+/*
+ * Continue the search for the end of a reply in [buf, end), from where scan
+ * stopped, so the bytes already scanned are not scanned again.
+ * return a pointer past the reply or NULL if it is not complete yet.
+ */
+static char* _redis_scanReply(RedisReplyScan *scan, char *buf, char *end)
+{
+  char   *p = buf + scan->offset;
+  char   *tokenEnd;
+  long   n;
+  size_t need;
+
+  if (scan->pending == 0) scan->pending = 1;
+  while (scan->pending > 0)
   {
-    redisRetVal_free(cmd->returnValue);
-    cmd->returnValue = NULL;
+    if (p >= end || (tokenEnd = _redisStream_tokenEnd(p, end, &need)) == NULL)
+    {
+      scan->offset = p - buf;
+      return NULL;
+    }
+    scan->pending--;
+    switch (*p)
+    {
+      case '*' :
+      case '~' :
+      case '>' :
+        n = strtol(p + 1, NULL, 10);
+        if (n > 0) scan->pending += n;
+        break;
+      case '%' :
+        n = strtol(p + 1, NULL, 10);
+        if (n > 0) scan->pending += 2 * n;
+        break;
+      case '|' :
+        /* An attribute is followed by the value it describes */
+        n = strtol(p + 1, NULL, 10);
+        scan->pending += 2 * (n > 0 ? n : 0) + 1;
+        break;
+    }
+    p = tokenEnd;
   }
-  if (cmd->protocolString != NULL)
+  scan->offset = p - buf;
+  return p;
+}
+
+/*
+ * Get the end of the first reply of [p, end).
+ * return a pointer past the reply or NULL if it is not complete yet.
+ */
+static char* _redis_replyEnd(char *p, char *end)
+{
+  RedisReplyScan scan = { 0, 0 };
+
+  return _redis_scanReply(&scan, p, end);
+}
+
+/* Complete future with reply or the error code */
+static void _redisFuture_complete(RedisFuture *future,
+                                  RedisRetVal *reply,
+                                  int         errCode,
+                                  int         sysErrno)
+{
+  future->reply    = reply;
+  future->errCode  = errCode;
+  future->sysErrno = sysErrno;
+  __atomic_store_n(&future->done, 1, __ATOMIC_SEQ_CST);
+}
+
+/* Wake the threads waiting for futures of mux, if any */
+static void _redisMux_wakeWaiters(RedisMux *mux)
+{
+  if (__atomic_load_n(&mux->waiters, __ATOMIC_SEQ_CST) == 0) return;
+  pthread_mutex_lock(&mux->lock);
+  pthread_cond_broadcast(&mux->doneCond);
+  pthread_mutex_unlock(&mux->lock);
+}
+
+/* Fail a list of futures with errCode */
+static void _redisFuture_failList(RedisFuture *list, int errCode, int sysErrno)
+{
+  RedisFuture *next;
+
+  for (; list != NULL; list = next)
   {
-    bstr_free(cmd->protocolString);
-    cmd->protocolString = NULL;
+    next = list->next;
+    _redisFuture_complete(list, NULL, errCode, sysErrno);
   }
-  if (cmd->args != NULL)
+}
+
+/* Mark the connection of mux as broken, with the error of the I/O thread */
+static void _redisMux_break(RedisMux *mux)
+{
+  mux->sysErrno = redis_sysErrno;
+  __atomic_store_n(&mux->errCode, redis_errCode, __ATOMIC_RELEASE);
+}
+
+/*
+ * Take the commands published in the ring of mux, in order and at most
+ * REDIS_MUX_RINGSIZE of them, as a list linked by their next field. The cap
+ * bounds a batch when producers keep publishing while it is taken.
+ * return the list or NULL if the ring is empty.
+ */
+static RedisFuture* _redisMux_dequeue(RedisMux *mux)
+{
+  RedisMuxSlot *slot;
+  RedisFuture  *head = NULL;
+  RedisFuture  **tail = &head;
+  int          count;
+
+  for (count = 0; count < REDIS_MUX_RINGSIZE; count++)
   {
-    for(i = 0; i < cmd->argsCount; i++)
-      if (cmd->args[i] != NULL) bstr_free(cmd->args[i]);
-    free(cmd->args);
-    cmd->args = NULL;
+    slot = &mux->ring[mux->dequeuePos & (REDIS_MUX_RINGSIZE - 1)];
+    if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != mux->dequeuePos + 1)
+      break;
+    *tail = slot->future;
+    tail = &slot->future->next;
+    /* Hand the slot back to producers for the next lap */
+    __atomic_store_n(&slot->seq, mux->dequeuePos + REDIS_MUX_RINGSIZE,
+                     __ATOMIC_RELEASE);
+    mux->dequeuePos++;
   }
-  cmd->argsCount = 0;
-  if (cmdName != NULL)
+  *tail = NULL;
+
+  /* Order the slots handed back before the check of fullWaiters */
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  if (count > 0 && __atomic_load_n(&mux->fullWaiters, __ATOMIC_SEQ_CST) != 0)
   {
-    return redisCmd_addArg(cmd, cmdName, -1);
+    pthread_mutex_lock(&mux->lock);
+    pthread_cond_broadcast(&mux->spaceCond);
+    pthread_mutex_unlock(&mux->lock);
+  }
+  return head;
+}
+
+/*
+ * Wait for commands to be published in the ring of mux, or for mux to be
+ * stopped.
+ * return the commands (see _redisMux_dequeue()) or NULL when stopping.
+ */
+static RedisFuture* _redisMux_waitWork(RedisMux *mux)
+{
+  RedisFuture *batch;
+
+  while (1)
+  {
+    if ((batch = _redisMux_dequeue(mux)) != NULL) return batch;
+    if (__atomic_load_n(&mux->stop, __ATOMIC_ACQUIRE)) return NULL;
+
+    /*
+     * Announce the sleep before checking the ring again, a producer publishing
+     * in between sees the flag and wakes this thread up.
+     */
+    __atomic_store_n(&mux->sleeping, 1, __ATOMIC_SEQ_CST);
+    if ((batch = _redisMux_dequeue(mux)) != NULL)
+    {
+      __atomic_store_n(&mux->sleeping, 0, __ATOMIC_RELAXED);
+      return batch;
+    }
+    pthread_mutex_lock(&mux->lock);
+    while (__atomic_load_n(&mux->sleeping, __ATOMIC_SEQ_CST) &&
+           !__atomic_load_n(&mux->stop, __ATOMIC_SEQ_CST))
+      pthread_cond_wait(&mux->workCond, &mux->lock);
+    pthread_mutex_unlock(&mux->lock);
+    __atomic_store_n(&mux->sleeping, 0, __ATOMIC_RELAXED);
+  }
+}
+
+/* Wake the I/O thread of mux up if it sleeps */
+static void _redisMux_wakeWorker(RedisMux *mux)
+{
+  if (__atomic_exchange_n(&mux->sleeping, 0, __ATOMIC_SEQ_CST) == 0) return;
+  pthread_mutex_lock(&mux->lock);
+  pthread_cond_signal(&mux->workCond);
+  pthread_mutex_unlock(&mux->lock);
+}
+
+/* Send the commands of batch in one writev() */
+static int _redisMux_send(RedisMux *mux, RedisFuture *batch)
+{
+  RedisFuture  *f;
+  struct iovec *iov;
+  int          count = 0;
+
+  for (f = batch; f != NULL; f = f->next) count++;
+  if (count > mux->iovSize)
+  {
+    iov = (struct iovec *)bstr_memRealloc(BSTR_MEM_CONNECTION, mux->iov,
+                                          count * sizeof(struct iovec));
+    if (iov == NULL) return _redis_setMallocError();
+    mux->iov     = iov;
+    mux->iovSize = count;
+  }
+  count = 0;
+  for (f = batch; f != NULL; f = f->next)
+  {
+    mux->iov[count].iov_base = (char *)f->request;
+    mux->iov[count].iov_len  = bstr_len(f->request);
+    count++;
+  }
+  return _redis_sendIov(mux->redis, mux->iov, count);
+}
+
+/*
+ * Read more data from redis, appended to *buf.
+ * return REDIS_NOERROR or the error code.
+ */
+static int _redis_readMore(REDIS *redis, bstr_t *buf)
+{
+  long long deadline;
+  size_t    len, cap;
+  ssize_t   n;
+  bstr_t    data;
+  int       rc;
+
+  len = *buf ? bstr_len(*buf) : 0;
+  cap = *buf ? bstr_capacity(*buf) : 0;
+  if (cap - len < MAXDATASIZE)
+  {
+    /* Grow geometrically so a large reply is not copied over and over */
+    cap = 2 * cap > len + MAXDATASIZE * 16 ? 2 * cap : len + MAXDATASIZE * 16;
+    if ((data = bstr_reserve(*buf, cap)) == NULL)
+      return _redis_setMallocError();
+    *buf = data;
+  }
+  data = *buf;
+  deadline = _redis_nowUsec() + REDIS_IO_TIMEOUT;
+  do
+  {
+    rc = _redis_wait(redis, REDIS_WAIT_READ, deadline);
+    if (rc == 0)  return _redis_setCnxError(redis, REDIS_ERROR_CNX_TIMEOUT, 0);
+    if (rc == -1)
+      return _redis_setCnxError(redis, REDIS_ERROR_CNX_RECEIVE, errno);
+    n = recv(redis->fd, (char *)data + len, bstr_capacity(data) - len, 0);
+  } while (n == -1 && REDIS_WOULDBLOCK(errno));
+  if (n <= 0)
+    return _redis_setCnxError(redis, REDIS_ERROR_CNX_RECEIVE, n ? errno : 0);
+  *buf = bstr_setLen(data, len + n);
+  return REDIS_NOERROR;
+}
+
+/*
+ * Receive count complete replies on redis.
+ * return the data received, the replies ending at *end, or NULL on error and
+ * redis_errCode is set.
+ */
+static bstr_t _redis_receiveReplies(REDIS *redis, int count, char **end)
+{
+  RedisReplyScan scan = { 0, 0 };
+  bstr_t         buf = NULL;
+
+  while (count > 0)
+  {
+    if (_redis_readMore(redis, &buf) != REDIS_NOERROR)
+    {
+      if (buf != NULL) bstr_free(buf);
+      return NULL;
+    }
+    while (count > 0 &&
+           (*end = _redis_scanReply(&scan, (char *)buf,
+                                    (char *)buf + bstr_len(buf))) != NULL)
+      count--;
+  }
+  return buf;
+}
+
+/*
+ * Receive the replies of batch on redis and complete its futures, a chunk at a
+ * time. buf holds the data received but not parsed yet. The waiters of mux, if
+ * not NULL, are woken after each chunk.
+ * return REDIS_NOERROR or the error code, the futures left are then not
+ * completed.
+ */
+static int _redis_receiveFutures(REDIS       *redis,
+                                 bstr_t      *buf,
+                                 RedisFuture **batch,
+                                 RedisMux    *mux)
+{
+  RedisReplyScan scan = { 0, 0 };
+  RedisFuture    *f, *next;
+  RedisRetVal    *reply;
+  char           *base, *p, *end, *replyEnd;
+  size_t         left;
+
+  while (*batch != NULL)
+  {
+    if (_redis_readMore(redis, buf) != REDIS_NOERROR) return redis_errCode;
+    base = p = (char *)*buf;
+    end  = p + bstr_len(*buf);
+
+    while (*batch != NULL &&
+           (replyEnd = _redis_scanReply(&scan, base, end)) != NULL)
+    {
+      f = *batch;
+      next = f->next;
+      reply = _redis_parseReply(redis, p, NULL);
+      _redisFuture_complete(f, reply, reply ? REDIS_NOERROR : redis_errCode,
+                            reply ? 0 : redis_sysErrno);
+      *batch = next;
+      p = replyEnd;
+    }
+    if (p == base) continue;
+    if (mux != NULL) _redisMux_wakeWaiters(mux);
+
+    /* Keep the beginning of the next reply */
+    left = end - p;
+    memmove(base, p, left);
+    *buf = bstr_setLen(*buf, left);
+    scan.offset -= p - base;
   }
   return REDIS_NOERROR;
 }
 
+/* Body of the I/O thread of a mux */
+static void* _redisMux_run(void *arg)
+{
+  RedisMux    *mux = (RedisMux *)arg;
+  RedisFuture *batch;
+
+  while ((batch = _redisMux_waitWork(mux)) != NULL)
+  {
+    if (mux->errCode == REDIS_NOERROR &&
+        (_redisMux_send(mux, batch) != REDIS_NOERROR ||
+         _redis_receiveFutures(mux->redis, &mux->inBuf, &batch, mux)
+         != REDIS_NOERROR))
+      _redisMux_break(mux);
+    if (batch != NULL)
+    {
+      _redisFuture_failList(batch, mux->errCode, mux->sysErrno);
+      _redisMux_wakeWaiters(mux);
+    }
+  }
+  return NULL;
+}
+
 /**
- * redisCmd_setProtocolType:
- * @cmd: the #RedisCmd structure to modify.
- * @protocol: the protocol to use.
+ * redisMux_new:
+ * @redis: the connection to share.
  *
- * Set the protocol type of @cmd to @protocol.
- * If the protocol string is already generated, it refreshen it to reflect the
- * protocol type specified.
+ * Create a multiplexer sharing @redis between threads. Any thread can then
+ * submit commands with redisMux_submit() or redisMux_submitArgv() and wait
+ * for their replies with redisFuture_wait(). An I/O thread sends everything
+ * submitted since its last write in one system call and hands the replies
+ * back in order, so commands of many threads are pipelined naturally and a
+ * few connections can serve a large number of threads.
  *
- * Returns: %REDIS_NOERROR on success or <code>-1</code> if the protocol string
- * cannot be generated.
+ * @redis belongs to the multiplexer and must no longer be used directly. The
+ * connection must not be in a transaction or subscribed to channels, and
+ * RESP3 push messages are not supported on it.
+ *
+ * Returns: the multiplexer or <code>NULL</code> on error and
+ * <code>redis_errCode</code> is set accordingly. It should be freed with
+ * redisMux_free().
  **/
-int redisCmd_setProtocolType(RedisCmd *cmd, RedisProtocolType protocol)
+RedisMux* redisMux_new(REDIS *redis)
+{
+  RedisMux *mux;
+  size_t   i;
+
+  if (redis->pipeline != NULL &&
+      redis_setAutoPipeline(redis, 0, 0, 0) != REDIS_NOERROR)
+    return NULL;
+
+  mux = (RedisMux *)bstr_memAlloc(BSTR_MEM_CONNECTION, sizeof(RedisMux));
+  if (mux == NULL)
+  {
+    _redis_setMallocError();
+    return NULL;
+  }
+  mux->redis       = redis;
+  mux->sleeping    = 0;
+  mux->waiters     = 0;
+  mux->fullWaiters = 0;
+  mux->stop        = 0;
+  mux->refs        = 1;
+  mux->errCode     = REDIS_NOERROR;
+  mux->sysErrno    = 0;
+  mux->enqueuePos  = 0;
+  mux->dequeuePos  = 0;
+  mux->iov         = NULL;
+  mux->iovSize     = 0;
+  mux->ring = (RedisMuxSlot *)bstr_memAlloc(BSTR_MEM_CONNECTION,
+                                   REDIS_MUX_RINGSIZE * sizeof(RedisMuxSlot));
+  mux->inBuf = bstr_reserve(NULL, MAXDATASIZE * 16);
+  if (mux->ring == NULL || mux->inBuf == NULL)
+  {
+    bstr_memFree(mux->ring);
+    bstr_free(mux->inBuf);
+    bstr_memFree(mux);
+    _redis_setMallocError();
+    return NULL;
+  }
+  for (i = 0; i < REDIS_MUX_RINGSIZE; i++) mux->ring[i].seq = i;
+  pthread_mutex_init(&mux->lock, NULL);
+  pthread_cond_init(&mux->workCond, NULL);
+  pthread_cond_init(&mux->doneCond, NULL);
+  pthread_cond_init(&mux->spaceCond, NULL);
+  if (pthread_create(&mux->thread, NULL, _redisMux_run, mux) != 0)
+  {
+    _redis_setCnxError(NULL, REDIS_ERROR_CNX_SOCKET, errno);
+    pthread_cond_destroy(&mux->spaceCond);
+    pthread_cond_destroy(&mux->doneCond);
+    pthread_cond_destroy(&mux->workCond);
+    pthread_mutex_destroy(&mux->lock);
+    bstr_memFree(mux->ring);
+    bstr_free(mux->inBuf);
+    bstr_memFree(mux);
+    return NULL;
+  }
+  return mux;
+}
+
+/* Drop a reference to mux, freeing what is left of it with the last one */
+static void _redisMux_unref(RedisMux *mux)
+{
+  if (__atomic_sub_fetch(&mux->refs, 1, __ATOMIC_ACQ_REL) > 0) return;
+  pthread_cond_destroy(&mux->spaceCond);
+  pthread_cond_destroy(&mux->doneCond);
+  pthread_cond_destroy(&mux->workCond);
+  pthread_mutex_destroy(&mux->lock);
+  bstr_memFree(mux);
+}
+
+/**
+ * redisMux_free:
+ * @mux: the multiplexer to free.
+ *
+ * Stop @mux and close its connection. The commands already submitted are
+ * executed first. Futures obtained from @mux stay valid and must still be
+ * freed with redisFuture_free().
+ **/
+void redisMux_free(RedisMux *mux)
+{
+  if (mux == NULL) return;
+  __atomic_store_n(&mux->stop, 1, __ATOMIC_SEQ_CST);
+  pthread_mutex_lock(&mux->lock);
+  pthread_cond_signal(&mux->workCond);
+  pthread_mutex_unlock(&mux->lock);
+  pthread_join(mux->thread, NULL);
+
+  redis_close(mux->redis);
+  bstr_memFree(mux->ring);
+  bstr_free(mux->inBuf);
+  bstr_memFree(mux->iov);
+  _redisMux_unref(mux);
+}
+
+/*
+ * Append the encoding of a command given as an argument vector to to, NULL to
+ * get a new bstring.
+ * return the bstring or NULL on error and redis_errCode is set.
+ */
+static bstr_t _redis_catArgv(bstr_t       to,
+                             int          argc,
+                             const char   **argv,
+                             const size_t *argvlen)
+{
+  bstr_t ret;
+  size_t start, size, len;
+  char   *p;
+  int    i;
+
+  if (argc <= 0 || argv == NULL)
+  {
+    _redis_setSrvError(REDIS_ERROR_CMD_ARGS);
+    return NULL;
+  }
+  start = to ? bstr_len(to) : 0;
+  size = 1 + _redis_numLen(argc) + 2;
+  for (i = 0; i < argc; i++)
+    size += _redis_argSize(argvlen ? argvlen[i] : strlen(argv[i]));
+  if ((ret = bstr_setLen(to, start + size)) == NULL)
+  {
+    _redis_setMallocError();
+    return NULL;
+  }
+  p = (char *)ret + start;
+  *p++ = '*';
+  p = _redis_writeNum(p, argc);
+  *p++ = '\r'; *p++ = '\n';
+  for (i = 0; i < argc; i++)
+  {
+    len = argvlen ? argvlen[i] : strlen(argv[i]);
+    p = _redis_writeArg(p, (char *)argv[i], len);
+  }
+  return ret;
+}
+
+/*
+ * Create a pending future, for request on mux or for a command pipelined on
+ * redis.
+ * return the future or NULL on error and redis_errCode is set.
+ */
+static RedisFuture* _redisFuture_new(bstr_t request, RedisMux *mux, REDIS *redis)
+{
+  RedisFuture *future;
+
+  future = (RedisFuture *)bstr_memAlloc(BSTR_MEM_COMMAND, sizeof(RedisFuture));
+  if (future == NULL)
+  {
+    _redis_setMallocError();
+    return NULL;
+  }
+  future->request  = request;
+  future->reply    = NULL;
+  future->errCode  = REDIS_NOERROR;
+  future->sysErrno = 0;
+  future->done     = 0;
+  future->mux      = mux;
+  future->redis    = redis;
+  future->next     = NULL;
+  return future;
+}
+
+/*
+ * Wait until the ring of mux has room for the slot at pos, or the slot was
+ * claimed by another producer: yield a few times, then sleep on spaceCond.
+ */
+static void _redisMux_waitSpace(RedisMux *mux, RedisMuxSlot *slot, size_t pos)
+{
+  int spins;
+
+  for (spins = 0; spins < REDIS_MUX_SPINS; spins++)
+  {
+    _redisMux_wakeWorker(mux);
+    sched_yield();
+    if ((ssize_t)(__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) - pos) >= 0)
+      return;
+  }
+
+  /* Announce the sleep before checking again, see _redisMux_dequeue() */
+  __atomic_add_fetch(&mux->fullWaiters, 1, __ATOMIC_SEQ_CST);
+  pthread_mutex_lock(&mux->lock);
+  while ((ssize_t)(__atomic_load_n(&slot->seq, __ATOMIC_SEQ_CST) - pos) < 0)
+    pthread_cond_wait(&mux->spaceCond, &mux->lock);
+  pthread_mutex_unlock(&mux->lock);
+  __atomic_sub_fetch(&mux->fullWaiters, 1, __ATOMIC_SEQ_CST);
+}
+
+/*
+ * Queue a future holding an encoded request.
+ * return the future or NULL if the connection is broken (the request is freed
+ * and redis_errCode is set).
+ */
+static RedisFuture* _redisMux_queue(RedisMux *mux, bstr_t request)
+{
+  RedisFuture  *future;
+  RedisMuxSlot *slot;
+  size_t       pos;
+  ssize_t      diff;
+  int          errCode;
+
+  if ((future = _redisFuture_new(request, mux, NULL)) == NULL)
+  {
+    bstr_free(request);
+    return NULL;
+  }
+
+  errCode = __atomic_load_n(&mux->errCode, __ATOMIC_ACQUIRE);
+  if (errCode != REDIS_NOERROR || __atomic_load_n(&mux->stop, __ATOMIC_ACQUIRE))
+  {
+    if (errCode != REDIS_NOERROR)
+      _redis_setCnxError(NULL, errCode, mux->sysErrno);
+    else
+      _redis_setSrvError(REDIS_ERROR_CMD_INVALID);
+    bstr_free(request);
+    bstr_memFree(future);
+    return NULL;
+  }
+  __atomic_add_fetch(&mux->refs, 1, __ATOMIC_RELAXED);
+
+  /* Claim the slot at the enqueue position once the consumer released it */
+  pos = __atomic_load_n(&mux->enqueuePos, __ATOMIC_RELAXED);
+  while (1)
+  {
+    slot = &mux->ring[pos & (REDIS_MUX_RINGSIZE - 1)];
+    diff = (ssize_t)(__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) - pos);
+    if (diff == 0)
+    {
+      if (__atomic_compare_exchange_n(&mux->enqueuePos, &pos, pos + 1, 1,
+                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        break;
+    }
+    else if (diff < 0)
+    {
+      /* Full: let the I/O thread make room */
+      _redisMux_waitSpace(mux, slot, pos);
+      pos = __atomic_load_n(&mux->enqueuePos, __ATOMIC_RELAXED);
+    }
+    else
+      pos = __atomic_load_n(&mux->enqueuePos, __ATOMIC_RELAXED);
+  }
+  slot->future = future;
+  __atomic_store_n(&slot->seq, pos + 1, __ATOMIC_SEQ_CST);
+  _redisMux_wakeWorker(mux);
+  return future;
+}
+
+/**
+ * redisMux_submit:
+ * @mux: the multiplexer to use.
+ * @cmd: the command to execute.
+ *
+ * Queue @cmd for execution on the connection of @mux and return without
+ * waiting for the reply. @cmd is encoded right away and can be modified,
+ * reused or freed as soon as this function returns.
+ *
+ * Returns: a future to wait for the reply with redisFuture_wait(), or
+ * <code>NULL</code> on error and <code>redis_errCode</code> is set
+ * accordingly. It should be freed with redisFuture_free().
+ **/
+RedisFuture* redisMux_submit(RedisMux *mux, RedisCmd *cmd)
 {
-  cmd->protocolType = protocol;
-  if(redisCmd_buildProtocolStr(cmd) == NULL) return -1;
-  return REDIS_NOERROR;
+  bstr_t request;
+
+  if (cmd->protocolString == NULL && redisCmd_buildProtocolStr(cmd) == NULL)
+    return NULL;
+  if ((request = bstr_dup(cmd->protocolString)) == NULL)
+  {
+    _redis_setMallocError();
+    return NULL;
+  }
+  return _redisMux_queue(mux, request);
 }
 
 /**
- * redisCmd_setArg:
- * @cmd: the #RedisCmd structure to modify.
- * @argNum: index of the arg to modify.
- * @argVal: the new value of the arg.
- * @argLen: the length of the arg or <code>-1</code>.
- *
- * Sets the arg at index @argNum to a new value specified by @argVal. If @argLen
- * is <code>-1</code>, the length of @argVal is determined via
+ * redisMux_submitArgv:
+ * @mux: the multiplexer to use.
+ * @argc: number of args, the command name included.
+ * @argv: the args.
+ * @argvlen: lengths of the args or <code>NULL</code> to use
  * <code>strlen()</code>.
  *
- * This function is useful for reusing the same command without allocating a new
- * one, just change the args and re-execute.
+ * Same as redisMux_submit() for a command given as an argument vector (see
+ * redis_execArgv()), encoded without building a #RedisCmd.
  *
- * Returns: %REDIS_NOERROR on success.
- */
-RedisErrorCode redisCmd_setArg(RedisCmd *cmd,
-                               int argNum,
-                               char *argVal,
-                               size_t argLen)
+ * Returns: a future to wait for the reply with redisFuture_wait(), or
+ * <code>NULL</code> on error and <code>redis_errCode</code> is set
+ * accordingly. It should be freed with redisFuture_free().
+ **/
+RedisFuture* redisMux_submitArgv(RedisMux     *mux,
+                                 int          argc,
+                                 const char   **argv,
+                                 const size_t *argvlen)
 {
-  bstr_t newArg;
-  if (cmd->returnValue != NULL) redisRetVal_free(cmd->returnValue);
-  if (argNum <=0 || argNum > cmd->argsCount)
-    return _redis_setSrvError(REDIS_ERROR_CMD_INVALIDARGNUM);
+  bstr_t request;
 
-  newArg = bstr_new(argVal, argLen);
-  if (newArg == NULL)
-    return _redis_setMallocError();
-  if (cmd->args[argNum] != NULL) bstr_free(cmd->args[argNum]);
-  cmd->args[argNum] = newArg;
-  return REDIS_NOERROR;
+  if ((request = _redis_catArgv(NULL, argc, argv, argvlen)) == NULL)
+    return NULL;
+  return _redisMux_queue(mux, request);
 }
+
 /**
- * redisCmd_getRetVal:
- * @cmd: a #RedisCmd structure.
+ * redisFuture_isDone:
+ * @future: a future returned by redisMux_submit() or redis_submit().
  *
- * Get the return value of a @cmd or <code>NULL</code> If the command has not
- * been executed.
+ * Tell whether the reply of @future arrived (or the command failed), without
+ * blocking.
  *
- * Returns: the return value stored in @cmd.
+ * Returns: 1 if redisFuture_wait() would not block, 0 otherwise.
  **/
-RedisRetVal* redisCmd_getRetVal(RedisCmd *cmd)
+int redisFuture_isDone(RedisFuture *future)
 {
-  return cmd->returnValue;
+  return __atomic_load_n(&future->done, __ATOMIC_ACQUIRE);
 }
 
 /**
- * redis_exec:
- * @redis: #REDIS structure to use.
- * @protocol: the protocol to use to communicate with Redis server.
- * @cmdName: the Redis command to execute.
- * @...: <code>NULL</code> terminated list of arg-argLen pairs.
- *
- * Execute the command described by @cmdName and the list of args. Last element
- * of the list must be a literal <code>NULL</code>. The arguments must be in the
- * form:
- * <informalexample><programlisting>
- * redis_exec(redis, protocol, cmdName, arg1, arglen1,
- *                                      arg2, arglen2,
- *                                      ...,
- *                                      NULL);
- * </programlisting></informalexample>
- * otherwise the behavior is unpredictable.
+ * redisFuture_wait:
+ * @future: a future returned by redisMux_submit() or redis_submit().
  *
- * This is a shortcut to the sequence of the following functions:<sbr/>
- * - redisCmd_new()<sbr/>
- * - redisCmd_addArg() (optional depending of the command arguments).<sbr/>
- * - redisCmd_buildProtocolStr().<sbr/>
- * - redisCmd_exec().<sbr/>
+ * Wait for the reply of the command of @future. For a command buffered by
+ * redis_submit(), the buffer of its connection is flushed first.
  *
- * Returns: a #RedisRetVal structure or <code>NULL</code> on error and
- * <code>redis_errCode</code> is set accordingly. It is recommended to free
- * the return value with redisRetVal_free() when no longer needed.
+ * Returns: the reply, which belongs to @future and is freed by
+ * redisFuture_free(), or <code>NULL</code> on error and
+ * <code>redis_errCode</code> is set accordingly.
  **/
-RedisRetVal* redis_exec(REDIS *redis,
-                        RedisProtocolType protocol,
-                        char *cmdName,
-                        ...)
+RedisRetVal* redisFuture_wait(RedisFuture *future)
 {
-  va_list           ap;
-  RedisCmd          *cmd;
-  RedisRetVal       *ret;
-  bstr_t            rdata;
-  char              *arg;
-  int               arglen;
-
-  if (cmdName == NULL)
-  {
-    _redis_setSrvError(REDIS_ERROR_CMD_INVALID);
-    return NULL;
-  }
-  cmd = redisCmd_new(protocol, cmdName);
-  if (cmd == NULL) return NULL;
+  RedisMux *mux = future->mux;
 
-  va_start(ap, cmdName);
-  while ((arg = va_arg(ap, char *)) != NULL)
+  /* A pipelined command is sent once its reply is needed */
+  if (future->redis != NULL && !future->done)
+    _redis_flushPipeline(future->redis);
+  if (!__atomic_load_n(&future->done, __ATOMIC_ACQUIRE))
   {
-    arglen = va_arg(ap, int);
-    if (arglen == 0)
-    {
-      _redis_setSrvError(REDIS_ERROR_CMD_ARGS);
-      redisCmd_free(cmd);
-      va_end(ap);
-      return NULL;
-    }
-    arglen = (arglen == -1) ? strlen(arg)
-                            : arglen;
-    if (redisCmd_addArg(cmd, arg, arglen) != REDIS_NOERROR)
-    {
-      redisCmd_free(cmd);
-      va_end(ap);
-      return NULL;
-    }
+    pthread_mutex_lock(&mux->lock);
+    __atomic_add_fetch(&mux->waiters, 1, __ATOMIC_SEQ_CST);
+    while (!__atomic_load_n(&future->done, __ATOMIC_SEQ_CST))
+      pthread_cond_wait(&mux->doneCond, &mux->lock);
+    __atomic_sub_fetch(&mux->waiters, 1, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&mux->lock);
   }
-  va_end(ap);
-
-  if (redisCmd_buildProtocolStr(cmd) == NULL)
+  if (future->reply == NULL)
   {
-    redisCmd_free(cmd);
-    return NULL;
+    redis_errCode  = future->errCode;
+    redis_sysErrno = future->sysErrno;
   }
+  return future->reply;
+}
 
-  if(_redis_send(redis, cmd->protocolString) != REDIS_NOERROR)
-  {
-    redisCmd_free(cmd);
-    return NULL;
-  }
+/**
+ * redisFuture_free:
+ * @future: the future to free.
+ *
+ * Free @future and its reply. If the command is still running, this waits for
+ * it first.
+ **/
+void redisFuture_free(RedisFuture *future)
+{
+  if (future == NULL) return;
+  redisFuture_wait(future);
+  if (future->reply != NULL) redisRetVal_free(future->reply);
+  bstr_free(future->request);
+  if (future->mux != NULL) _redisMux_unref(future->mux);
+  bstr_memFree(future);
+}
 
-  if ((rdata = _redis_receive(redis)) == NULL)
-  {
-    redisCmd_free(cmd);
-    return NULL;
-  }
-  ret = _redisRetVal_parse((char *)rdata, NULL);
+/*
+ * Auto-pipelining.
+ *
+ * Commands given to redis_submit() are encoded at the end of outBuf and their
+ * futures queued. The whole buffer is sent with one system call when a
+ * threshold is reached, and the replies are then all received before
+ * returning, exactly like a RedisCmdArray. Any other command sent on the
+ * connection flushes the buffer first, so replies are never mixed up.
+ */
+typedef struct _RedisPipeline
+{
+  int             maxCmds;      /* Flush thresholds, 0 if unused          */
+  size_t          maxBytes;
+  long            maxDelayUsec;
+  bstr_t          outBuf;       /* Encoded commands not sent yet          */
+  RedisFuture     *head;        /* Their futures, oldest first            */
+  RedisFuture     *tail;
+  int             count;
+  long long       firstUsec;    /* When the oldest one was buffered       */
+  bstr_t          inBuf;        /* Replies received but not parsed yet    */
+} RedisPipeline;
 
-  redisCmd_free(cmd);
-  bstr_free(rdata);
+/*
+ * Send the commands buffered on redis and receive their replies.
+ * return REDIS_NOERROR or the error code, the futures of the commands are then
+ * failed with it.
+ */
+static int _redis_flushPipeline(REDIS *redis)
+{
+  RedisPipeline *pl = redis->pipeline;
+  RedisFuture   *batch;
+  int           rc;
+
+  if (pl == NULL || pl->head == NULL) return REDIS_NOERROR;
+  /* Detach the batch first, sending it must not flush it again */
+  batch = pl->head;
+  pl->head = pl->tail = NULL;
+  pl->count = 0;
+  rc = _redis_sendBuf(redis, (char *)pl->outBuf, bstr_len(pl->outBuf));
+  pl->outBuf = bstr_setLen(pl->outBuf, 0);
+  if (rc == REDIS_NOERROR)
+    rc = _redis_receiveFutures(redis, &pl->inBuf, &batch, NULL);
+  if (rc != REDIS_NOERROR)
+    _redisFuture_failList(batch, redis_errCode, redis_sysErrno);
+  return rc;
+}
 
-  return ret;
+/* Flush and free the auto-pipelining state of redis */
+static void _redis_freePipeline(REDIS *redis)
+{
+  RedisPipeline *pl = redis->pipeline;
+
+  if (pl == NULL) return;
+  _redis_flushPipeline(redis);
+  bstr_free(pl->outBuf);
+  bstr_free(pl->inBuf);
+  bstr_memFree(pl);
+  redis->pipeline = NULL;
 }
 
 /**
- * redis_execStr:
+ * redis_setAutoPipeline:
  * @redis: #REDIS structure to use.
- * @protocol: the protocol to use to communicate with Redis server.
- * @cmdStr: the Redis command sequence to execute.
- * @cmdStrLen: @cmdStr length or <code>-1</code>
- *
- * Execute @cmdStr on the server and return the result as a #RedisRetVal structure.
- * @cmdStr and @cmdStrLen meet the same requirement as those passed to
- * redisCmd_newFromStr().
+ * @maxCmds: number of commands buffered before they are sent, 0 or 1 to send
+ * every command right away.
+ * @maxBytes: size of the buffered commands that makes them sent, 0 for no
+ * limit.
+ * @maxDelayUsec: age in microseconds of the oldest buffered command that
+ * makes them sent, 0 for no limit.
  *
- * In fact, redis_execStr() is a shortcut to the following call sequence:<sbr/>
- * - redisCmd_newFromStr().<sbr/>
- * - redisCmd_buildProtocolStr().<sbr/>
- * - redisCmd_exec().<sbr/>
+ * Make redis_submit() and redis_submitArgv() buffer commands instead of
+ * executing them one at a time. The buffered commands are sent together, and
+ * their replies received, as soon as one of the thresholds is reached, a
+ * reply is needed by redisFuture_wait() or any other command is executed on
+ * @redis. A burst of independent commands then costs about one round trip, as
+ * with a #RedisCmdArray, without being collected by the caller.
  *
- * 
+ * The delay is checked when a command is submitted: commands submitted
+ * before a pause stay buffered until their replies are needed (or
+ * redis_flushPipeline() is called).
  *
+ * Changing the thresholds sends the commands already buffered.
  *
- * Returns: a  #RedisRetVal structure or <code>NULL</code> on error and
- * <code>redis_errCode</code> is set accordingly. It is recommended to free
- * the return value with redisRetVal_free() when no longer needed.
+ * Returns: %REDIS_NOERROR or the error code of sending the buffered
+ * commands.
  **/
-RedisRetVal* redis_execStr(REDIS *redis,
-                           RedisProtocolType protocol,
-                           char *cmdStr,
-                           int cmdStrLen)
+RedisErrorCode redis_setAutoPipeline(REDIS  *redis,
+                                     int    maxCmds,
+                                     size_t maxBytes,
+                                     long   maxDelayUsec)
 {
-  RedisCmd    *cmd;
-  RedisRetVal *ret;
-  bstr_t      cmdBStr;
-  bstr_t      rdata;
+  RedisPipeline *pl = redis->pipeline;
+  int           rc;
 
-  cmdBStr = bstr_new(cmdStr, cmdStrLen);
-  if (cmdBStr == NULL)
+  if ((rc = _redis_flushPipeline(redis)) != REDIS_NOERROR) return rc;
+  if (pl == NULL)
   {
-    _redis_setMallocError();
-    return NULL;
-  }
-  if ((cmd = _redisCmd_newFromSqlString(protocol, cmdBStr)) == NULL)
-  {
-    redisCmd_free(cmd);
-    bstr_free(cmdBStr);
-    return NULL;
+    pl = (RedisPipeline *)bstr_memCalloc(BSTR_MEM_CONNECTION, 1,
+                                         sizeof(RedisPipeline));
+    if (pl == NULL) return _redis_setMallocError();
+    redis->pipeline = pl;
   }
-  bstr_free(cmdBStr);
+  pl->maxCmds      = (maxCmds > 1) ? maxCmds : 1;
+  pl->maxBytes     = maxBytes;
+  pl->maxDelayUsec = (maxDelayUsec > 0) ? maxDelayUsec : 0;
+  return REDIS_NOERROR;
+}
 
-  if (redisCmd_buildProtocolStr(cmd) == NULL)
-  {
-    redisCmd_free(cmd);
-    return NULL;
-  }
+/**
+ * redis_flushPipeline:
+ * @redis: #REDIS structure to use.
+ *
+ * Send the commands buffered by redis_submit() on @redis and receive their
+ * replies now.
+ *
+ * Returns: %REDIS_NOERROR or the error code, which is also the error of the
+ * futures of the commands.
+ **/
+RedisErrorCode redis_flushPipeline(REDIS *redis)
+{
+  return _redis_flushPipeline(redis);
+}
 
-  if(_redis_send(redis, cmd->protocolString) != REDIS_NOERROR)
-  {
-    redisCmd_free(cmd);
-    return NULL;
-  }
+/*
+ * Queue future, whose command was just appended to the buffer of redis, and
+ * flush the buffer if a threshold is reached.
+ */
+static RedisFuture* _redis_pipelineQueue(REDIS *redis, RedisFuture *future)
+{
+  RedisPipeline *pl = redis->pipeline;
+  long long     now = 0;
 
-  if ((rdata = _redis_receive(redis)) == NULL)
+  if (pl->tail != NULL) pl->tail->next = future;
+  else
   {
-    redisCmd_free(cmd);
-    return NULL;
+    pl->head = future;
+    if (pl->maxDelayUsec > 0) pl->firstUsec = _redis_nowUsec();
   }
-  ret = _redisRetVal_parse((char *)rdata, NULL);
-
-  redisCmd_free(cmd);
-  bstr_free(rdata);
+  pl->tail = future;
+  pl->count++;
+
+  if (pl->maxDelayUsec > 0 && pl->count > 1) now = _redis_nowUsec();
+  if (pl->count >= pl->maxCmds ||
+      (pl->maxBytes > 0 && bstr_len(pl->outBuf) >= pl->maxBytes) ||
+      (now > 0 && now - pl->firstUsec >= pl->maxDelayUsec))
+    /* On error, the futures hold it */
+    _redis_flushPipeline(redis);
+  return future;
+}
 
-  return ret;
+/*
+ * Create the future of a command about to be buffered on redis, with the
+ * default state (one command at a time) if auto-pipelining was never set.
+ * return the future or NULL on error and redis_errCode is set.
+ */
+static RedisFuture* _redis_pipelineFuture(REDIS *redis)
+{
+  if (redis->pipeline == NULL &&
+      redis_setAutoPipeline(redis, 1, 0, 0) != REDIS_NOERROR)
+    return NULL;
+  return _redisFuture_new(NULL, NULL, redis);
 }
 
 /**
- * redisCmdArray_new:
+ * redis_submit:
+ * @redis: #REDIS structure to use.
+ * @cmd: the command to execute.
  *
- * 
+ * Execute @cmd as part of the auto-pipeline of @redis (see
+ * redis_setAutoPipeline()): it is buffered and its reply is retrieved later
+ * with redisFuture_wait(). Without auto-pipelining, @cmd is executed right
+ * away. @cmd is encoded immediately and can be modified, reused or freed as
+ * soon as this function returns.
  *
- * Returns: 
+ * Returns: a future for the reply, to be freed with redisFuture_free(), or
+ * <code>NULL</code> on error and <code>redis_errCode</code> is set
+ * accordingly. The error of the execution itself is reported by
+ * redisFuture_wait().
  **/
-RedisCmdArray* redisCmdArray_new()
+RedisFuture* redis_submit(REDIS *redis, RedisCmd *cmd)
 {
-  RedisCmdArray *cmdArray;
-  cmdArray = (RedisCmdArray *)malloc(sizeof(RedisCmdArray));
-  if (cmdArray == NULL)
+  RedisFuture *future;
+  bstr_t      buf;
+
+  if (cmd->protocolString == NULL && redisCmd_buildProtocolStr(cmd) == NULL)
+    return NULL;
+  if ((future = _redis_pipelineFuture(redis)) == NULL) return NULL;
+  if ((buf = bstr_catBStr(redis->pipeline->outBuf, cmd->protocolString)) == NULL)
   {
+    bstr_memFree(future);
     _redis_setMallocError();
     return NULL;
   }
-  cmdArray->cmds           = NULL;
-  cmdArray->returnValues   = NULL;
-  cmdArray->cmdCount       = 0;
-  cmdArray->protocolString = NULL;
-  return cmdArray;
+  redis->pipeline->outBuf = buf;
+  return _redis_pipelineQueue(redis, future);
 }
 
 /**
- * redisCmdArray_free:
- * @cmdArray: 
+ * redis_submitArgv:
+ * @redis: #REDIS structure to use.
+ * @argc: number of args, the command name included.
+ * @argv: the args.
+ * @argvlen: lengths of the args or <code>NULL</code> to use
+ * <code>strlen()</code>.
  *
- * 
+ * Same as redis_submit() for a command given as an argument vector (see
+ * redis_execArgv()).
+ *
+ * Returns: a future for the reply, to be freed with redisFuture_free(), or
+ * <code>NULL</code> on error and <code>redis_errCode</code> is set
+ * accordingly.
  **/
-void redisCmdArray_free(RedisCmdArray *cmdArray)
+RedisFuture* redis_submitArgv(REDIS        *redis,
+                              int          argc,
+                              const char   **argv,
+                              const size_t *argvlen)
 {
- if (cmdArray == NULL) return;
- if (cmdArray->protocolString != NULL) bstr_free(cmdArray->protocolString);
- if (cmdArray->cmds != NULL)
- {
-   int i;
-   for (i = 0; i <= cmdArray->cmdCount; i++)
-     redisCmd_free(cmdArray->cmds[i]);
-   free(cmdArray->cmds);
- }
- if (cmdArray->returnValues != NULL)free(cmdArray->returnValues);
- free(cmdArray);
+  RedisFuture *future;
+  bstr_t      buf;
+
+  if ((future = _redis_pipelineFuture(redis)) == NULL) return NULL;
+  buf = _redis_catArgv(redis->pipeline->outBuf, argc, argv, argvlen);
+  if (buf == NULL)
+  {
+    bstr_memFree(future);
+    return NULL;
+  }
+  redis->pipeline->outBuf = buf;
+  return _redis_pipelineQueue(redis, future);
+}
+
+/*
+ * Client side caching.
+ *
+ * Replies of read-only single key commands are kept, as raw RESP data, in a
+ * table split into shards by the hash of the key, each with its own lock.
+ * Every shard evicts with the CLOCK algorithm: entries sit on a ring, a hit
+ * sets the referenced bit of its entry and the hand clears the bits it passes
+ * until it finds an entry without one to evict.
+ *
+ * The server tracks the keys read on the attached connections (CLIENT
+ * TRACKING with REDIRECT) and sends invalidations to a dedicated connection:
+ * RESP3 push messages if the cache was created on a RESP3 connection, messages
+ * of the __redis__:invalidate channel otherwise. That connection is drained,
+ * without blocking, before every lookup. Each shard counts the invalidations
+ * it applies (epoch) so that a reply read while its key was invalidated is not
+ * cached.
+ */
+#define REDIS_CACHE_SHARDS 16   /* Must be a power of 2 */
+
+typedef struct _RedisCacheEntry RedisCacheEntry;
+struct _RedisCacheEntry
+{
+  uint32_t        keyHash;
+  bstr_t          key;          /* Key the reply depends on               */
+  bstr_t          request;      /* Encoded command                        */
+  bstr_t          reply;        /* Raw reply, parsed again by every hit   */
+  size_t          size;         /* Memory accounted for the entry         */
+  long long       expires;      /* Monotonic usec, 0 if it never expires  */
+  int             referenced;   /* CLOCK bit, set by hits                 */
+  RedisCacheEntry *next;        /* Next entry of the bucket               */
+  RedisCacheEntry *clockPrev;   /* Ring swept by the hand                 */
+  RedisCacheEntry *clockNext;
+};
+
+typedef struct
+{
+  pthread_mutex_t lock;
+  RedisCacheEntry **buckets;
+  size_t          bucketCount;  /* Power of 2                             */
+  size_t          count;
+  size_t          bytes;
+  RedisCacheEntry *hand;        /* Next entry considered for eviction     */
+  unsigned long   epoch;        /* Bumped by each invalidation            */
+} RedisCacheShard;
+
+struct _RedisCache
+{
+  RedisCacheShard shards[REDIS_CACHE_SHARDS];
+  size_t          maxShardBytes;
+  long long       maxTtlUsec;   /* 0 if entries never expire              */
+  REDIS           *inv;         /* Connection receiving invalidations     */
+  int             invId;        /* Its client id, for REDIRECT            */
+  pthread_mutex_t invLock;      /* Guards inv and invBuf                  */
+  bstr_t          invBuf;
+  int             broken;       /* Invalidations lost, caching stopped    */
+  uint64_t        hits;
+  uint64_t        misses;
+  uint64_t        evictions;
+  uint64_t        invalidations;
+};
+
+/* FNV-1a hash of a key */
+static uint32_t _redisCache_hash(const char *key, size_t len)
+{
+  uint32_t h = 2166136261u;
+  size_t   i;
+
+  for (i = 0; i < len; i++)
+  {
+    h ^= (unsigned char)key[i];
+    h *= 16777619u;
+  }
+  return h;
+}
+
+/* Unlink entry from shard and free it */
+static void _redisCache_remove(RedisCacheShard *shard, RedisCacheEntry *entry)
+{
+  RedisCacheEntry **link;
+
+  link = &shard->buckets[entry->keyHash & (shard->bucketCount - 1)];
+  while (*link != entry) link = &(*link)->next;
+  *link = entry->next;
+
+  if (entry->clockNext == entry) shard->hand = NULL;
+  else
+  {
+    entry->clockPrev->clockNext = entry->clockNext;
+    entry->clockNext->clockPrev = entry->clockPrev;
+    if (shard->hand == entry) shard->hand = entry->clockNext;
+  }
+  shard->count--;
+  shard->bytes -= entry->size;
+  bstr_free(entry->key);
+  bstr_free(entry->request);
+  bstr_free(entry->reply);
+  bstr_memFree(entry);
 }
 
-/**
- * redisCmdArray_addCmd:
- * @cmdArray: 
- * @cmd: 
- *
- * 
- *
- * Returns: 
- **/
-RedisErrorCode redisCmdArray_addCmd(RedisCmdArray *cmdArray, RedisCmd *cmd)
+/* Remove all the entries of shard */
+static void _redisCache_clearShard(RedisCacheShard *shard)
 {
-  RedisCmd *cmdCopy;
-  /* reallocate to cmdCount + 2: the new RedisCmd and the NULL termination */
-  cmdArray->cmds = (RedisCmd **)realloc(cmdArray->cmds,
-                                        (cmdArray->cmdCount +2) * sizeof(RedisCmd *));
-  if (cmdArray->cmds == NULL)
-    return _redis_setMallocError();
+  while (shard->hand != NULL) _redisCache_remove(shard, shard->hand);
+  shard->epoch++;
+}
 
-  if ((cmdCopy = _redisCmd_dup(cmd)) == NULL)
-      return redis_errCode;
-  cmdArray->cmds[cmdArray->cmdCount] = cmdCopy;
-  cmdArray->cmdCount++;
-  cmdArray->cmds[cmdArray->cmdCount] = NULL;
+/*
+ * Double the buckets of shard.
+ * return REDIS_NOERROR or REDIS_ERROR_MEM_ALLOC, shard is then unchanged.
+ */
+static int _redisCache_grow(RedisCacheShard *shard)
+{
+  RedisCacheEntry **buckets;
+  RedisCacheEntry *entry, *next;
+  size_t          count = shard->bucketCount * 2;
+  size_t          i;
+
+  buckets = (RedisCacheEntry **)bstr_memCalloc(BSTR_MEM_OTHER, count,
+                                               sizeof(RedisCacheEntry *));
+  if (buckets == NULL) return _redis_setMallocError();
+  for (i = 0; i < shard->bucketCount; i++)
+    for (entry = shard->buckets[i]; entry != NULL; entry = next)
+    {
+      next = entry->next;
+      entry->next = buckets[entry->keyHash & (count - 1)];
+      buckets[entry->keyHash & (count - 1)] = entry;
+    }
+  bstr_memFree(shard->buckets);
+  shard->buckets = buckets;
+  shard->bucketCount = count;
   return REDIS_NOERROR;
 }
 
-/**
- * redisCmdArray_buildProtocolStr:
- * @cmdArray: 
- *
- * 
- *
- * Returns: 
- **/
-bstr_t redisCmdArray_buildProtocolStr(RedisCmdArray *cmdArray)
+/* Find the entry of request in shard, NULL if none */
+static RedisCacheEntry* _redisCache_find(RedisCacheShard *shard,
+                                         uint32_t        keyHash,
+                                         bstr_t          request)
 {
-  int    i;
-  bstr_t ret = NULL;
+  RedisCacheEntry *entry;
+
+  entry = shard->buckets[keyHash & (shard->bucketCount - 1)];
+  for (; entry != NULL; entry = entry->next)
+    if (entry->keyHash == keyHash &&
+        bstr_len(entry->request) == bstr_len(request) &&
+        memcmp(entry->request, request, bstr_len(request)) == 0)
+      return entry;
+  return NULL;
+}
 
-  for (i=0; i < cmdArray->cmdCount; i++)
+/* Evict entries of shard with the CLOCK algorithm until it fits in maxBytes */
+static void _redisCache_evict(RedisCache *cache, RedisCacheShard *shard)
+{
+  RedisCacheEntry *entry;
+
+  while (shard->bytes > cache->maxShardBytes && shard->hand != NULL)
   {
-    ret = bstr_catBStr(ret, redisCmd_getProtocolStr(cmdArray->cmds[i]));
-    if (ret == NULL)
+    entry = shard->hand;
+    if (entry->referenced)
     {
-      bstr_free(ret);
-      _redis_setMallocError();
-      return NULL;
+      entry->referenced = 0;
+      shard->hand = entry->clockNext;
+      continue;
     }
+    _redisCache_remove(shard, entry);
+    __atomic_add_fetch(&cache->evictions, 1, __ATOMIC_RELAXED);
   }
-  if (cmdArray->protocolString != NULL) bstr_free(cmdArray->protocolString);
-  cmdArray->protocolString = ret;
-  return ret;
 }
 
-/**
- * redisCmdArray_exec:
- * @redis: 
- * @cmdArray: 
- *
- * 
- *
- * Returns: 
- **/
-RedisRetVal** redisCmdArray_exec(REDIS *redis, RedisCmdArray *cmdArray)
+/* Add entry to shard, behind the hand so that it is swept last */
+static void _redisCache_insert(RedisCache      *cache,
+                               RedisCacheShard *shard,
+                               RedisCacheEntry *entry)
 {
-  bstr_t            rdata;
-  char              *tail;
-  RedisRetVal       *rv;
-  RedisRetVal       **ret;
-  int               rc, i;
-
-  if (cmdArray->protocolString == NULL)
-    if (redisCmdArray_buildProtocolStr(cmdArray) == NULL) return NULL;
-
-  rc = _redis_send(redis, cmdArray->protocolString);
-  if (rc != REDIS_NOERROR) return NULL;
+  RedisCacheEntry **bucket;
 
-  rdata = _redis_receive(redis);
-  if (rdata == NULL) return NULL;
-  ret = (RedisRetVal **)malloc((cmdArray->cmdCount+ 1) * sizeof(RedisRetVal *));
-  if (ret == NULL)
+  if (shard->count >= shard->bucketCount) _redisCache_grow(shard);
+  bucket = &shard->buckets[entry->keyHash & (shard->bucketCount - 1)];
+  entry->next = *bucket;
+  *bucket = entry;
+  if (shard->hand == NULL)
   {
-    bstr_free(rdata);
-    _redis_setMallocError();
-    return NULL;
+    entry->clockPrev = entry->clockNext = entry;
+    shard->hand = entry;
   }
-  tail = (char *)rdata;
-  for (i=0; i < cmdArray->cmdCount; i++)
+  else
   {
-    rv = _redisRetVal_parse(tail, &tail);
-    cmdArray->cmds[i]->returnValue = rv;
-    ret[i] = rv;
+    entry->clockNext = shard->hand;
+    entry->clockPrev = shard->hand->clockPrev;
+    entry->clockPrev->clockNext = entry;
+    shard->hand->clockPrev = entry;
   }
-  ret[cmdArray->cmdCount] = NULL;
-  cmdArray->returnValues = ret;
-  bstr_free(rdata);
-  return ret;
-
+  shard->count++;
+  shard->bytes += entry->size;
+  _redisCache_evict(cache, shard);
 }
 
-/**
- * redisCmdArray_getProtocolStr:
- * @cmdArray: 
- *
- * 
- *
- * Returns: 
- **/
-bstr_t redisCmdArray_getProtocolStr(RedisCmdArray *cmdArray)
+/* Drop the entries depending on key */
+static void _redisCache_invalidateKey(RedisCache *cache, char *key, size_t len)
 {
-  return cmdArray->protocolString ? cmdArray->protocolString
-                                  : redisCmdArray_buildProtocolStr(cmdArray);
+  RedisCacheShard *shard;
+  RedisCacheEntry *entry, *next;
+  uint32_t        keyHash = _redisCache_hash(key, len);
+
+  shard = &cache->shards[keyHash & (REDIS_CACHE_SHARDS - 1)];
+  pthread_mutex_lock(&shard->lock);
+  entry = shard->buckets[keyHash & (shard->bucketCount - 1)];
+  for (; entry != NULL; entry = next)
+  {
+    next = entry->next;
+    if (entry->keyHash == keyHash && bstr_len(entry->key) == len &&
+        memcmp(entry->key, key, len) == 0)
+    {
+      _redisCache_remove(shard, entry);
+      __atomic_add_fetch(&cache->invalidations, 1, __ATOMIC_RELAXED);
+    }
+  }
+  shard->epoch++;
+  pthread_mutex_unlock(&shard->lock);
 }
 
-RedisCmd** redisCmdArray_getCmds(RedisCmdArray *cmdArray)
+/*
+ * Apply the invalidation message [p, end): a RESP3 push
+ * (invalidate, keys) or a RESP2 message of the __redis__:invalidate channel.
+ * Keys are null when the server flushed its data.
+ */
+static void _redisCache_applyMessage(RedisCache *cache, char *p, char *end)
 {
-  return cmdArray->cmds;
+  char   *str;
+  size_t len;
+  int    count, i;
+
+  if (*p != '*' && *p != '>') return;
+  count = _redisRetVal_scanAggregate(p, end, &p);
+  if (_redisRetVal_scanString(p, end, &str, &len, &p) != REDIS_NOERROR ||
+      str == NULL)
+    return;
+  if (count == 3 && len == 7 && memcmp(str, "message", 7) == 0)
+  {
+    if (_redisRetVal_scanString(p, end, &str, &len, &p) != REDIS_NOERROR ||
+        str == NULL || len != 20 ||
+        memcmp(str, "__redis__:invalidate", 20) != 0)
+      return;
+  }
+  else if (count != 2 || len != 10 || memcmp(str, "invalidate", 10) != 0)
+    return;
+
+  if (*p == '_' || strncmp(p, "*-1", 3) == 0 || strncmp(p, "$-1", 3) == 0)
+  {
+    redisCache_clear(cache);
+    return;
+  }
+  if (*p != '*') return;
+  count = _redisRetVal_scanAggregate(p, end, &p);
+  for (i = 0; i < count; i++)
+  {
+    if (_redisRetVal_scanString(p, end, &str, &len, &p) != REDIS_NOERROR) return;
+    if (str != NULL) _redisCache_invalidateKey(cache, str, len);
+  }
 }
 
-int redisCmdArray_getCmdCount(RedisCmdArray *cmdArray)
+/*
+ * Apply the invalidations received so far, without blocking. If the
+ * invalidation connection fails, the cache is emptied and stops caching.
+ */
+static void _redisCache_drain(RedisCache *cache)
 {
-  return cmdArray->cmdCount;
+  char    *p, *end, *next;
+  size_t  len;
+  ssize_t n;
+  bstr_t  buf;
+
+  pthread_mutex_lock(&cache->invLock);
+  while (!cache->broken)
+  {
+    len = bstr_len(cache->invBuf);
+    if ((buf = bstr_reserve(cache->invBuf, len + MAXDATASIZE)) == NULL) break;
+    cache->invBuf = buf;
+    n = recv(cache->inv->fd, (char *)buf + len, bstr_capacity(buf) - len,
+             MSG_DONTWAIT);
+    if (n > 0)
+    {
+      cache->invBuf = bstr_setLen(buf, len + n);
+      continue;
+    }
+    if (n == -1 && REDIS_WOULDBLOCK(errno)) break;
+    /* Keys can change unnoticed from now on */
+    __atomic_store_n(&cache->broken, 1, __ATOMIC_RELEASE);
+    redisCache_clear(cache);
+  }
+
+  p   = (char *)cache->invBuf;
+  end = p + bstr_len(cache->invBuf);
+  while ((next = _redis_replyEnd(p, end)) != NULL)
+  {
+    _redisCache_applyMessage(cache, p, next);
+    p = next;
+  }
+  memmove((char *)cache->invBuf, p, end - p);
+  cache->invBuf = bstr_setLen(cache->invBuf, end - p);
+  pthread_mutex_unlock(&cache->invLock);
 }
 
 /**
- * redisCmdArray_getRetVals:
- * @cmdArray: 
+ * redisCache_new:
+ * @redis: a connection to cache the replies of.
+ * @maxBytes: memory the cached replies can use.
+ * @maxTtlMsec: time in milliseconds a reply stays cached at most, 0 for no
+ * limit.
  *
- * 
+ * Create a client side cache and attach @redis to it (see
+ * redisCache_attach()). Replies of read-only commands on a single key
+ * executed with redisCache_exec() are then served from memory until the server
+ * reports that their key changed, they are evicted to stay within @maxBytes or
+ * they are older than @maxTtlMsec.
  *
- * Returns: 
+ * The cache opens its own connection to the server of @redis to receive the
+ * invalidations: with RESP3 push messages if @redis uses RESP3 (see
+ * redis_hello()), through the <code>__redis__:invalidate</code> channel
+ * otherwise. Requires Redis 6 or later.
+ *
+ * The cache can be used by several threads at once, each with its own
+ * connection.
+ *
+ * Returns: the cache or <code>NULL</code> on error and
+ * <code>redis_errCode</code> is set accordingly. It should be freed with
+ * redisCache_free().
  **/
-RedisRetVal**  redisCmdArray_getRetVals(RedisCmdArray *cmdArray)
+RedisCache* redisCache_new(REDIS *redis, size_t maxBytes, long maxTtlMsec)
 {
-  RedisRetVal **ret;
-  int i;
+  RedisCache  *cache;
+  RedisRetVal *rv;
+  int         i;
 
-  ret = (RedisRetVal **)malloc((cmdArray->cmdCount+ 1) * sizeof(RedisRetVal *));
-  if (ret == NULL)
+  cache = (RedisCache *)bstr_memCalloc(BSTR_MEM_OTHER, 1, sizeof(RedisCache));
+  if (cache == NULL)
   {
     _redis_setMallocError();
     return NULL;
   }
-  for (i=0; i < cmdArray->cmdCount; i++)
-    ret[i] = cmdArray->cmds[i]->returnValue;
-  ret[cmdArray->cmdCount] = NULL;
-  if (cmdArray->returnValues != NULL) free(cmdArray->returnValues);
-  cmdArray->returnValues = ret;
-  return ret;
+  cache->maxShardBytes = maxBytes / REDIS_CACHE_SHARDS;
+  cache->maxTtlUsec    = (maxTtlMsec > 0) ? maxTtlMsec * 1000LL : 0;
+  pthread_mutex_init(&cache->invLock, NULL);
+  for (i = 0; i < REDIS_CACHE_SHARDS; i++)
+    pthread_mutex_init(&cache->shards[i].lock, NULL);
+  for (i = 0; i < REDIS_CACHE_SHARDS; i++)
+  {
+    cache->shards[i].bucketCount = 16;
+    cache->shards[i].buckets = (RedisCacheEntry **)bstr_memCalloc(
+                         BSTR_MEM_OTHER, 16, sizeof(RedisCacheEntry *));
+    if (cache->shards[i].buckets == NULL) goto error;
+  }
+  if ((cache->invBuf = bstr_new(NULL, 0)) == NULL) goto error;
+
+  /* The connection the server sends the invalidations to */
+  if ((cache->inv = redis_connect(redis->host, redis->port)) == NULL)
+    goto fail;
+  if (redis->protocolVersion == 3)
+  {
+    if ((rv = redis_hello(cache->inv, 3)) == NULL) goto fail;
+    redisRetVal_free(rv);
+    if (cache->inv->protocolVersion != 3) goto unexpected;
+  }
+  rv = redis_exec(cache->inv, REDIS_PROTOCOL_MULTIBULK, "CLIENT",
+                  "ID", -1, NULL);
+  if (rv == NULL) goto fail;
+  if (redisRetVal_getType(rv) != REDIS_RETURN_INTEGER)
+  {
+    redisRetVal_free(rv);
+    goto unexpected;
+  }
+  cache->invId = redisRetVal_getInteger(rv);
+  redisRetVal_free(rv);
+  if (redis->protocolVersion != 3)
+  {
+    rv = redis_exec(cache->inv, REDIS_PROTOCOL_MULTIBULK, "SUBSCRIBE",
+                    "__redis__:invalidate", -1, NULL);
+    if (rv == NULL) goto fail;
+    redisRetVal_free(rv);
+  }
+  if (redisCache_attach(cache, redis) != REDIS_NOERROR) goto fail;
+  return cache;
+
+unexpected:
+  _redis_setSrvError(REDIS_ERROR_RET_UNEXPECTED);
+  goto fail;
+error:
+  _redis_setMallocError();
+fail:
+  i = redis_errCode;
+  redisCache_free(cache);
+  redis_errCode = i;
+  return NULL;
 }
 
 /**
- * redisMulti_begin:
- * @redis: 
+ * redisCache_attach:
+ * @cache: the cache to use.
+ * @redis: the connection to cache the replies of.
  *
- * 
+ * Enable the tracking of the keys read on @redis, so that redisCache_exec()
+ * can cache its replies in @cache. @redis must be connected to the same server
+ * as the connection @cache was created with.
  *
- * Returns: 
+ * Returns: %REDIS_NOERROR or the error code.
  **/
-RedisErrorCode redisMulti_begin(REDIS *redis)
+RedisErrorCode redisCache_attach(RedisCache *cache, REDIS *redis)
 {
   RedisRetVal *rv;
-  rv = redis_execStr(redis, REDIS_PROTOCOL_MULTIBULK, "MULTI", -1);
+  char        id[24];
+  int         isError;
+
+  snprintf(id, sizeof(id), "%d", cache->invId);
+  rv = redis_exec(redis, REDIS_PROTOCOL_MULTIBULK, "CLIENT",
+                  "TRACKING", -1, "ON", -1, "REDIRECT", -1, id, -1, NULL);
   if (rv == NULL) return redis_errCode;
+  isError = redisRetVal_getType(rv) == REDIS_RETURN_ERROR;
+  redisRetVal_free(rv);
+  if (isError) return _redis_setSrvError(REDIS_ERROR_RET_UNEXPECTED);
+  redis->cache = cache;
+  return REDIS_NOERROR;
+}
 
-  if (redisRetVal_getType(rv) == REDIS_RETURN_ERROR)
-    _redis_setSrvError(REDIS_ERROR_MLT_UNSUPPORTED);
+/**
+ * redisCache_detach:
+ * @cache: the cache @redis is attached to.
+ * @redis: the connection to detach.
+ *
+ * Stop the tracking of the keys read on @redis. redisCache_exec() then
+ * executes every command on @redis.
+ *
+ * Returns: %REDIS_NOERROR or the error code.
+ **/
+RedisErrorCode redisCache_detach(RedisCache *cache, REDIS *redis)
+{
+  RedisRetVal *rv;
 
-  _redis_multiMode = 1;
+  if (redis->cache != cache) return REDIS_NOERROR;
+  redis->cache = NULL;
+  rv = redis_exec(redis, REDIS_PROTOCOL_MULTIBULK, "CLIENT",
+                  "TRACKING", -1, "OFF", -1, NULL);
+  if (rv == NULL) return redis_errCode;
   redisRetVal_free(rv);
   return REDIS_NOERROR;
 }
 
+/*
+ * Receive exactly one raw reply on redis.
+ * return the reply or NULL on error and redis_errCode is set.
+ */
+static bstr_t _redisCache_receiveRaw(REDIS *redis)
+{
+  bstr_t buf;
+  char   *end;
+
+  if ((buf = _redis_receiveReplies(redis, 1, &end)) == NULL) return NULL;
+  return bstr_setLen(buf, end - (char *)buf);
+}
+
 /**
- * redisMulti_exec:
- * @redis: 
+ * redisCache_exec:
+ * @cache: the cache to use.
+ * @redis: #REDIS structure to use.
+ * @cmd: #RedisCmd structure to execute.
  *
- * 
+ * Same as redisCmd_exec(), but the reply is taken from @cache when it holds
+ * one for the same command, and kept in it otherwise. Only commands on a
+ * single key whose reply depends on nothing but its value (GET, HGETALL,
+ * ZRANGE, ... but not TTL or SRANDMEMBER, see %REDIS_COMMAND_CACHEABLE) are
+ * cached, and only on a connection attached to @cache; anything else is just
+ * executed.
  *
- * Returns: 
+ * Returns: the reply, stored in @cmd as with redisCmd_exec(), or
+ * <code>NULL</code> on error and <code>redis_errCode</code> is set
+ * accordingly.
  **/
-RedisRetVal** redisMulti_exec(REDIS *redis)
+RedisRetVal* redisCache_exec(RedisCache *cache, REDIS *redis, RedisCmd *cmd)
 {
-  RedisCmd    *cmd;
-  bstr_t      protocolStr;
-  RedisRetVal **ret;
-  int         retSize;
-  int         rc;
-  bstr_t      rdata;
-  char        *p;
-  int         i;
+  RedisCacheShard *shard;
+  RedisCacheEntry *entry, *old;
+  RedisRetVal     *rv;
+  bstr_t          key, reply;
+  uint32_t        keyHash;
+  unsigned long   epoch;
+  long long       now;
+  int             keyIndex;
+  int             flags;
+
+  flags = redisCmd_getFlags(cmd);
+  if (redis->cache != cache || redis->multiMode ||
+      __atomic_load_n(&cache->broken, __ATOMIC_ACQUIRE) ||
+      flags == -1 || !(flags & REDIS_COMMAND_CACHEABLE) ||
+      redisCmd_getKeys(cmd, &keyIndex, 1) != 1)
+    return redisCmd_exec(redis, cmd);
+  if (cmd->protocolString == NULL && redisCmd_buildProtocolStr(cmd) == NULL)
+    return NULL;
+
+  _redisCache_drain(cache);
+  key     = cmd->args[keyIndex];
+  keyHash = _redisCache_hash((char *)key, bstr_len(key));
+  shard   = &cache->shards[keyHash & (REDIS_CACHE_SHARDS - 1)];
+  now     = cache->maxTtlUsec ? _redis_nowUsec() : 0;
 
-  if (!_redis_multiMode)
+  pthread_mutex_lock(&shard->lock);
+  entry = _redisCache_find(shard, keyHash, cmd->protocolString);
+  if (entry != NULL && entry->expires != 0 && entry->expires <= now)
   {
-    _redis_setSrvError(REDIS_ERROR_MLT_NOTMULTIMODE);
-    return NULL;
+    _redisCache_remove(shard, entry);
+    entry = NULL;
   }
-  cmd = redisCmd_new(REDIS_PROTOCOL_MULTIBULK, "EXEC");
-  if (cmd == NULL) return NULL;
-  protocolStr = redisCmd_buildProtocolStr(cmd);
-  if (protocolStr == NULL)return NULL;
-  rc = _redis_send(redis, cmd->protocolString);
-  _redis_multiMode = 0;
-  redisCmd_free(cmd);
-  if (rc != REDIS_NOERROR) return NULL;
-
-  rdata = _redis_receive(redis);
-  if (rdata == NULL) return NULL;
+  if (entry != NULL)
+  {
+    entry->referenced = 1;
+    rv = _redis_parseReply(redis, (char *)entry->reply, NULL);
+    pthread_mutex_unlock(&shard->lock);
+    if (rv == NULL) return NULL;
+    __atomic_add_fetch(&cache->hits, 1, __ATOMIC_RELAXED);
+    if (cmd->returnValue != NULL) redisRetVal_free(cmd->returnValue);
+    cmd->returnValue = rv;
+    return rv;
+  }
+  epoch = shard->epoch;
+  pthread_mutex_unlock(&shard->lock);
+  __atomic_add_fetch(&cache->misses, 1, __ATOMIC_RELAXED);
 
-  /* Bypass '*' */
-  p = (char *)rdata +1;
-  /* Get the multiBulk size */
-  retSize = strtol(p, &p, 0);
-  ret = (RedisRetVal **)malloc((retSize + 1) * sizeof(RedisRetVal *));
-  if (ret == NULL)
+  if (_redis_send(redis, cmd->protocolString) != REDIS_NOERROR) return NULL;
+  if ((reply = _redisCache_receiveRaw(redis)) == NULL) return NULL;
+  if ((rv = _redis_parseReply(redis, (char *)reply, NULL)) == NULL)
   {
-    bstr_free(rdata);
-    _redis_setMallocError();
+    bstr_free(reply);
     return NULL;
   }
+  if (cmd->returnValue != NULL) redisRetVal_free(cmd->returnValue);
+  cmd->returnValue = rv;
 
-  /* Bypass "\r\n" */
-  p += 2;
-  for (i=0; i < retSize; i++)
-    ret[i] = _redisRetVal_parse(p, &p);
-  ret[retSize] = NULL;
-  bstr_free(rdata);
-  return ret;
+  /* Errors are not cached */
+  if (*(char *)reply == '-' || *(char *)reply == '!' ||
+      (entry = (RedisCacheEntry *)bstr_memAlloc(BSTR_MEM_OTHER,
+                                                sizeof(RedisCacheEntry)))
+      == NULL)
+  {
+    bstr_free(reply);
+    return rv;
+  }
+  entry->keyHash    = keyHash;
+  entry->key        = bstr_new((char *)key, bstr_len(key));
+  entry->request    = bstr_dup(cmd->protocolString);
+  entry->reply      = bstr_shrinkToFit(reply);
+  entry->expires    = cache->maxTtlUsec ? _redis_nowUsec() + cache->maxTtlUsec
+                                        : 0;
+  entry->referenced = 0;
+  if (entry->reply == NULL) entry->reply = reply;
+  entry->size       = sizeof(RedisCacheEntry) + bstr_len(key)
+                      + bstr_len(cmd->protocolString) + bstr_len(entry->reply);
+  if (entry->key == NULL || entry->request == NULL ||
+      entry->size > cache->maxShardBytes)
+  {
+    bstr_free(entry->key);
+    bstr_free(entry->request);
+    bstr_free(entry->reply);
+    bstr_memFree(entry);
+    return rv;
+  }
+
+  pthread_mutex_lock(&shard->lock);
+  /* The key was invalidated meanwhile, the reply may be stale already */
+  if (shard->epoch != epoch)
+  {
+    pthread_mutex_unlock(&shard->lock);
+    bstr_free(entry->key);
+    bstr_free(entry->request);
+    bstr_free(entry->reply);
+    bstr_memFree(entry);
+    return rv;
+  }
+  /* Another thread may have cached the same command meanwhile */
+  if ((old = _redisCache_find(shard, keyHash, entry->request)) != NULL)
+    _redisCache_remove(shard, old);
+  _redisCache_insert(cache, shard, entry);
+  pthread_mutex_unlock(&shard->lock);
+  return rv;
 }
 
 /**
- * redisMulti_discard:
- * @redis: 
- *
- * 
+ * redisCache_clear:
+ * @cache: the cache to empty.
  *
- * Returns: 
+ * Remove all the replies held by @cache.
  **/
-RedisErrorCode redisMulti_discard(REDIS *redis)
+void redisCache_clear(RedisCache *cache)
 {
-  RedisRetVal *rv;
-  if (!_redis_multiMode)
-    return _redis_setSrvError(REDIS_ERROR_MLT_NOTMULTIMODE);
-
-  rv = redis_execStr(redis, REDIS_PROTOCOL_MULTIBULK, "DISCARD", -1);
-  if (rv == NULL) return redis_errCode;
-
-  if (redisRetVal_getType(rv) == REDIS_RETURN_ERROR)
-    _redis_setSrvError(REDIS_ERROR_MLT_UNSUPPORTED);
+  int i;
 
-  _redis_multiMode = 0;
-  redisRetVal_free(rv);
-  return REDIS_NOERROR;
+  for (i = 0; i < REDIS_CACHE_SHARDS; i++)
+  {
+    pthread_mutex_lock(&cache->shards[i].lock);
+    _redisCache_clearShard(&cache->shards[i]);
+    pthread_mutex_unlock(&cache->shards[i].lock);
+  }
 }
 
 /**
- * redisMulti_isMultiMode:
- * @: 
+ * redisCache_getStats:
+ * @cache: the cache to query.
+ * @hits: where to store the number of replies served from @cache, or
+ * <code>NULL</code>.
+ * @misses: where to store the number of cacheable commands sent to the
+ * server, or <code>NULL</code>.
+ * @evictions: where to store the number of replies evicted to make room, or
+ * <code>NULL</code>.
+ * @invalidations: where to store the number of replies dropped because their
+ * key changed, or <code>NULL</code>.
  *
- * 
+ * Get the counters of @cache since its creation.
+ **/
+void redisCache_getStats(RedisCache *cache,
+                         uint64_t   *hits,
+                         uint64_t   *misses,
+                         uint64_t   *evictions,
+                         uint64_t   *invalidations)
+{
+  if (hits)      *hits      = __atomic_load_n(&cache->hits, __ATOMIC_RELAXED);
+  if (misses)    *misses    = __atomic_load_n(&cache->misses, __ATOMIC_RELAXED);
+  if (evictions) *evictions = __atomic_load_n(&cache->evictions,
+                                              __ATOMIC_RELAXED);
+  if (invalidations)
+    *invalidations = __atomic_load_n(&cache->invalidations, __ATOMIC_RELAXED);
+}
+
+/**
+ * redisCache_free:
+ * @cache: the cache to free.
  *
- * Returns: 
+ * Free @cache and close its invalidation connection. The connections still
+ * in use must be detached first with redisCache_detach().
  **/
-int redisMulti_isMultiMode()
+void redisCache_free(RedisCache *cache)
 {
-  return _redis_multiMode;
+  int i;
+
+  if (cache == NULL) return;
+  for (i = 0; i < REDIS_CACHE_SHARDS; i++)
+  {
+    if (cache->shards[i].buckets != NULL)
+      _redisCache_clearShard(&cache->shards[i]);
+    bstr_memFree(cache->shards[i].buckets);
+    pthread_mutex_destroy(&cache->shards[i].lock);
+  }
+  if (cache->inv != NULL) redis_close(cache->inv);
+  bstr_free(cache->invBuf);
+  pthread_mutex_destroy(&cache->invLock);
+  bstr_memFree(cache);
 }
@@ -28,6 +28,7 @@
 #include <sys/socket.h>
 #include <arpa/inet.h>
 #include <netdb.h>
+#include <stdint.h>
 #include <bstr.h>
 #include <redis.h>
 /**
@@ -47,7 +48,15 @@ typedef enum
   REDIS_RETURN_LINE,
   REDIS_RETURN_BULK,
   REDIS_RETURN_MULTIBULK,
-  REDIS_RETURN_INTEGER
+  REDIS_RETURN_INTEGER,
+  REDIS_RETURN_NULL,
+  REDIS_RETURN_BOOLEAN,
+  REDIS_RETURN_DOUBLE,
+  REDIS_RETURN_BIGNUMBER,
+  REDIS_RETURN_VERBATIM,
+  REDIS_RETURN_MAP,
+  REDIS_RETURN_SET,
+  REDIS_RETURN_PUSH
 } RedisReturnType;
 
 typedef enum
@@ -106,9 +115,66 @@ typedef struct _RedisCmd RedisCmd;
 
 typedef struct _RedisCmdArray RedisCmdArray;
 
-volatile int redis_errCode = 0;
+/**
+ * RedisPreparedCmd:
+ *
+ * A command encoded once and re-executed many times with some of its args
+ * changed (see redisPreparedCmd_new()). Changing an arg only patches the
+ * encoded command in place.
+ *
+ * #RedisPreparedCmd should be freed with redisPreparedCmd_free() when it is
+ * no longer needed.
+ **/
+typedef struct _RedisPreparedCmd RedisPreparedCmd;
+
+/**
+ * RedisMux:
+ *
+ * A connection shared by several threads (see redisMux_new()). Commands
+ * submitted by all the threads are pipelined by an I/O thread.
+ *
+ * #RedisMux should be freed with redisMux_free() when it is no longer needed.
+ **/
+typedef struct _RedisMux RedisMux;
+
+/**
+ * RedisFuture:
+ *
+ * The pending reply of a command submitted to a #RedisMux or pipelined with
+ * redis_submit(). It should be freed with redisFuture_free() when it is no
+ * longer needed.
+ **/
+typedef struct _RedisFuture RedisFuture;
+
+/**
+ * RedisCache:
+ *
+ * A client side cache of replies, kept up to date by the server (see
+ * redisCache_new()).
+ *
+ * #RedisCache should be freed with redisCache_free() when it is no longer
+ * needed.
+ **/
+typedef struct _RedisCache RedisCache;
+
+/* Error code of the last failed call of the calling thread */
+extern __thread int redis_errCode;
 /* errno set by standardlib functions */
-volatile int redis_sysErrno = 0;
+extern __thread int redis_sysErrno;
+
+typedef enum
+{
+  REDIS_COMMAND_READONLY   = 1 << 0,
+  REDIS_COMMAND_WRITE      = 1 << 1,
+  REDIS_COMMAND_IDEMPOTENT = 1 << 2,
+  REDIS_COMMAND_CACHEABLE  = 1 << 3
+} RedisCommandFlags;
+
+typedef enum
+{
+  REDIS_WAIT_READ  = 1 << 0,
+  REDIS_WAIT_WRITE = 1 << 1
+} RedisWaitEvent;
 
 typedef enum
 {
@@ -126,17 +192,40 @@ typedef enum
   REDIS_ERROR_CMD_INVALID,
   REDIS_ERROR_CMD_UNBALANCEDQ,
   REDIS_ERROR_MLT_UNSUPPORTED,
-  REDIS_ERROR_MLT_NOTMULTIMODE
+  REDIS_ERROR_MLT_NOTMULTIMODE,
+  REDIS_ERROR_RET_UNEXPECTED,
+  REDIS_ERROR_RET_SERVER
 } RedisErrorCode;
 
 REDIS* redis_connect(char *host, char *port);
 void   redis_close(REDIS *redis);
+RedisRetVal* redis_hello(REDIS *redis, int protocolVersion);
+void         redis_setArena(REDIS *redis, bstr_arena_t *arena);
+void         redis_setAllocator(bstr_mallocFunc  mallocFunc,
+                                bstr_callocFunc  callocFunc,
+                                bstr_reallocFunc reallocFunc,
+                                bstr_freeFunc    freeFunc,
+                                void             *ctx);
+int          redis_getProtocolVersion(REDIS *redis);
+typedef int  (*RedisWaitFunc)(int            fd,
+                              RedisWaitEvent event,
+                              long long      deadlineUsec,
+                              void           *userData);
+RedisErrorCode redis_setWaitFunc(REDIS         *redis,
+                                 RedisWaitFunc waitFunc,
+                                 void          *userData);
 
 RedisCmd*     redisCmd_new(RedisProtocolType protocolType, char *cmdName);
+RedisCmd*     redisCmd_newInArena(bstr_arena_t      *arena,
+                                  RedisProtocolType protocolType,
+                                  char              *cmdName);
 RedisCmd*     redisCmd_newFromStr(RedisProtocolType protocolType,
                                   char              *cmdStr,
                                   int               cmdLen);
 RedisErrorCode redisCmd_addArg(RedisCmd *cmd, char *arg, size_t arglen);
+RedisErrorCode redisCmd_addArgRef(RedisCmd *cmd, bstr_t arg);
+RedisErrorCode redisCmd_addArgInt64(RedisCmd *cmd, int64_t value);
+RedisErrorCode redisCmd_addArgDouble(RedisCmd *cmd, double value);
 RedisErrorCode redisCmd_setArg(RedisCmd *cmd,
                                int      argNum,
                                char     *argVal,
@@ -149,16 +238,69 @@ int            redisCmd_setProtocolType(RedisCmd *cmd,
 RedisRetVal*   redisCmd_exec(REDIS *redis, RedisCmd *cmd);
 bstr_t         redisCmd_getProtocolStr(RedisCmd *cmd);
 RedisRetVal*   redisCmd_getRetVal(RedisCmd *cmd);
+int            redisCmd_getFlags(RedisCmd *cmd);
+int            redisCmd_getKeys(RedisCmd *cmd, int *argIndexes, int size);
+int            redis_getCommandFlags(char *cmdName);
+
+typedef void (*RedisHashSetFunc)(void   *userData,
+                                 char   *field,
+                                 size_t fieldLen,
+                                 char   *value,
+                                 size_t valueLen);
+int            redisCmd_execHash(REDIS            *redis,
+                                 RedisCmd         *cmd,
+                                 RedisHashSetFunc setFunc,
+                                 void             *userData);
+int            redisCmd_execScores(REDIS    *redis,
+                                   RedisCmd *cmd,
+                                   bstr_t   *members,
+                                   double   *scores,
+                                   int      size);
+int            redisCmd_execInt64(REDIS    *redis,
+                                  RedisCmd *cmd,
+                                  int64_t  *values,
+                                  int      size);
+
+typedef struct
+{
+  void (*beginArray)(void *userData, RedisReturnType type, int count);
+  void (*endArray)  (void *userData);
+  void (*element)   (void *userData, char *data, size_t len);
+  void (*integer)   (void *userData, int64_t value);
+  void (*error)     (void *userData, char *msg, size_t len);
+} RedisReplyHandler;
+RedisErrorCode redisCmd_execStream(REDIS             *redis,
+                                   RedisCmd          *cmd,
+                                   RedisReplyHandler *handler,
+                                   void              *userData);
+
+RedisPreparedCmd* redisPreparedCmd_new(RedisCmd *cmd);
+RedisErrorCode    redisPreparedCmd_setArg(RedisPreparedCmd *pcmd,
+                                          int              argNum,
+                                          char             *argVal,
+                                          size_t           argLen);
+RedisRetVal*      redisPreparedCmd_exec(REDIS *redis, RedisPreparedCmd *pcmd);
+void              redisPreparedCmd_free(RedisPreparedCmd *pcmd);
 
 RedisCmdArray* redisCmdArray_new();
 void           redisCmdArray_free(RedisCmdArray *cmdArray);
+void           redisCmdArray_reset(RedisCmdArray *cmdArray);
 RedisErrorCode redisCmdArray_addCmd(RedisCmdArray *cmdArray, RedisCmd *cmd);
+RedisErrorCode redisCmdArray_takeCmd(RedisCmdArray *cmdArray, RedisCmd *cmd);
+RedisErrorCode redisCmdArray_addArgv(RedisCmdArray *cmdArray,
+                                     int           argc,
+                                     const char    **argv,
+                                     const size_t  *argvlen);
 bstr_t         redisCmdArray_buildProtocolStr(RedisCmdArray *cmdArray);
 bstr_t         redisCmdArray_getProtocolStr(RedisCmdArray *cmdArray);
 RedisCmd**     redisCmdArray_getCmds(RedisCmdArray *cmdArray);
 int            redisCmdArray_getCmdCount(RedisCmdArray *cmdArray);
 RedisRetVal**  redisCmdArray_exec(REDIS *redis, RedisCmdArray *cmdArray);
 RedisRetVal**  redisCmdArray_getRetVals(RedisCmdArray *cmdArray);
+RedisErrorCode redisCmdArray_execStream(REDIS             *redis,
+                                        RedisCmdArray     *cmdArray,
+                                        RedisReplyHandler *handler,
+                                        void              *userData);
 
 RedisReturnType redisRetVal_getType(RedisRetVal *rv);
 bstr_t          redisRetVal_getError(RedisRetVal *rv);
@@ -167,12 +309,25 @@ bstr_t          redisRetVal_getLine(RedisRetVal *rv);
 bstr_t          redisRetVal_getBulk(RedisRetVal *rv);
 bstr_t*         redisRetVal_getMultiBulk(RedisRetVal *rv);
 int             redisRetVal_getMultiBulkSize(RedisRetVal *rv);
+int             redisRetVal_getBoolean(RedisRetVal *rv);
+double          redisRetVal_getDouble(RedisRetVal *rv);
+bstr_t          redisRetVal_getBigNumber(RedisRetVal *rv);
+bstr_t          redisRetVal_getVerbatim(RedisRetVal *rv);
+const char*     redisRetVal_getVerbatimFormat(RedisRetVal *rv);
+int             redisRetVal_getMapSize(RedisRetVal *rv);
+RedisRetVal*    redisRetVal_getMapKey(RedisRetVal *rv, int index);
+RedisRetVal*    redisRetVal_getMapValue(RedisRetVal *rv, int index);
+int             redisRetVal_getElementCount(RedisRetVal *rv);
+RedisRetVal*    redisRetVal_getElement(RedisRetVal *rv, int index);
+RedisRetVal*    redisRetVal_getAttributes(RedisRetVal *rv);
 void            redisRetVal_free(RedisRetVal *rv);
+void            redis_setPoolLimit(size_t maxBytes);
+void            redis_trimPool();
 
 RedisErrorCode  redisMulti_begin(REDIS *redis);
 RedisErrorCode  redisMulti_discard(REDIS *redis);
 RedisRetVal**   redisMulti_exec(REDIS *redis);
-int             redisMulti_isMultiMode();
+int             redisMulti_isMultiMode(REDIS *redis);
 
 RedisRetVal* redis_exec(REDIS *redis,
                         RedisProtocolType protocol,
@@ -182,6 +337,54 @@ RedisRetVal* redis_execStr(REDIS *redis,
                            RedisProtocolType protocol,
                            char *cmdStr,
                            int cmdStrLen);
+RedisRetVal*  redis_execArgv(REDIS        *redis,
+                             int          argc,
+                             const char   **argv,
+                             const size_t *argvlen);
+RedisRetVal** redis_execArgvArray(REDIS        *redis,
+                                  int          cmdCount,
+                                  const int    *argcs,
+                                  const char   ***argvs,
+                                  const size_t **argvlens);
+RedisRetVal*  redis_execFmt(REDIS *redis, const char *format, ...);
+
+RedisMux*     redisMux_new(REDIS *redis);
+void          redisMux_free(RedisMux *mux);
+RedisFuture*  redisMux_submit(RedisMux *mux, RedisCmd *cmd);
+RedisFuture*  redisMux_submitArgv(RedisMux     *mux,
+                                  int          argc,
+                                  const char   **argv,
+                                  const size_t *argvlen);
+int           redisFuture_isDone(RedisFuture *future);
+RedisRetVal*  redisFuture_wait(RedisFuture *future);
+void          redisFuture_free(RedisFuture *future);
+RedisErrorCode redis_setAutoPipeline(REDIS  *redis,
+                                     int    maxCmds,
+                                     size_t maxBytes,
+                                     long   maxDelayUsec);
+RedisErrorCode redis_flushPipeline(REDIS *redis);
+RedisFuture*  redis_submit(REDIS *redis, RedisCmd *cmd);
+RedisFuture*  redis_submitArgv(REDIS        *redis,
+                               int          argc,
+                               const char   **argv,
+                               const size_t *argvlen);
+
+RedisCache*    redisCache_new(REDIS *redis, size_t maxBytes, long maxTtlMsec);
+RedisErrorCode redisCache_attach(RedisCache *cache, REDIS *redis);
+RedisErrorCode redisCache_detach(RedisCache *cache, REDIS *redis);
+RedisRetVal*   redisCache_exec(RedisCache *cache, REDIS *redis, RedisCmd *cmd);
+void           redisCache_clear(RedisCache *cache);
+void           redisCache_getStats(RedisCache *cache,
+                                   uint64_t   *hits,
+                                   uint64_t   *misses,
+                                   uint64_t   *evictions,
+                                   uint64_t   *invalidations);
+void           redisCache_free(RedisCache *cache);
+
 const char* redisError_getStr(RedisErrorCode errorCode);
 const char* redisError_getSysErrorStr(RedisErrorCode errorCode, int sysErrCode);
+RedisErrorCode redisError_getCode(void);
+int         redisError_getSysErrno(void);
+RedisErrorCode redis_getLastError(REDIS *redis);
+int         redis_getLastSysErrno(REDIS *redis);
 #endif /* REDIS_H_ */